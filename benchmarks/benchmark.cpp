@@ -20,7 +20,7 @@ int main(int argc, char *argv[]) {
   } else if (benchmark == "einsum") {
     return benchmark_einsum(argc, argv);
   } else if (benchmark == "proptime") {
-    benchmark_proptime();
+    return benchmark_proptime(argc, argv);
   } else {
     std::cerr << "Error: unknown benchmark" << std::endl;
   }
@@ -1,27 +1,120 @@
+#include "../include/analysis_cache.hpp"
 #include "../include/einsum.hpp"
+#include "../include/propagation_batch.hpp"
+#include "../include/tensor_io.hpp"
 #include "../include/utils.hpp"
+#include <cstdlib>
+#include <sstream>
 
-void run(const std::string &file_path, const bool propagate,
-         const double sparsity, const bool sparse, const bool compute = true) {
+bool is_snapshot(const std::string &file_path) {
+  const std::string suffix = ".snap";
+  return file_path.size() > suffix.size() &&
+         file_path.compare(file_path.size() - suffix.size(), suffix.size(),
+                           suffix) == 0;
+}
 
+/// Replaces the vectors of graph inputs with those of the .tns/.mtx files in
+/// the comma-separated \p files, each seeding the first unseeded input of
+/// the same sizes.
+void import_sparsities(Graph &g, const std::string &files) {
+  std::vector<bool> seeded(g.inputs.size(), false);
+  std::stringstream list(files);
+  std::string file;
+  while (std::getline(list, file, ',')) {
+    if (file.empty())
+      continue;
+    TensorPtr imported;
+    try {
+      imported = read_tensor_file(file);
+    } catch (const std::runtime_error &e) {
+      std::cerr << e.what() << "\n";
+      continue;
+    }
+    size_t i = 0;
+    while (i < g.inputs.size() &&
+           (seeded[i] || g.inputs[i]->sizes != imported->sizes))
+      ++i;
+    if (i == g.inputs.size()) {
+      std::cerr << file << ": no input of the same sizes\n";
+      continue;
+    }
+    for (int dim = 0; dim < imported->numDims; ++dim)
+      g.inputs[i]->sparsities[dim] = imported->sparsities[dim];
+    seeded[i] = true;
+  }
+}
+
+Graph load_graph(const std::string &file_path, const double sparsity) {
+  if (is_snapshot(file_path)) {
+    try {
+      return read_graph_snapshot(file_path);
+    } catch (const std::runtime_error &e) {
+      std::cerr << e.what() << "\n";
+      return Graph();
+    }
+  }
   auto benchmark = read_einsum_benchmark(file_path);
 
   if (benchmark.path.empty() || benchmark.strings.empty() ||
       benchmark.sizes.empty()) {
     std::cerr << "Could not parse einsum benchmark.\n";
-    return;
+    return Graph();
   }
-  const auto buildStart = begin();
   auto g =
       build_tree(benchmark.sizes, benchmark.strings, benchmark.path, sparsity);
+  // SPA_IMPORT seeds inputs with the exact vectors of real tensors
+  if (const char *files = std::getenv("SPA_IMPORT"))
+    import_sparsities(g, files);
+  return g;
+}
+
+void write_snapshot(const std::string &file_path, const double sparsity,
+                    const bool propagate, const std::string &snapshot_path) {
+  const auto buildStart = begin();
+  auto g = load_graph(file_path, sparsity);
+  if (g.nodes.empty())
+    return;
+  end(buildStart, "create graph = ");
+  if (propagate) {
+    const auto startPropagation = begin();
+    g.run_propagation();
+    end(startPropagation, "analysis = ");
+  }
+  const auto startWrite = begin();
+  write_graph_snapshot(g, snapshot_path);
+  end(startWrite, "write snapshot = ");
+  std::cout << "ratio = " << g.get_sparsity_ratio() << std::endl;
+}
+
+void run(const std::string &file_path, const bool propagate,
+         const double sparsity, const bool sparse, const bool compute = true) {
+
+  const auto buildStart = begin();
+  auto g = load_graph(file_path, sparsity);
+  if (g.nodes.empty())
+    return;
   end(buildStart, "create graph = ");
 
   g.run_propagation(FORWARD);
   std::cout << "ratio before = " << g.get_sparsity_ratio() << std::endl;
   if (propagate) {
+    // SPA_ANALYSIS_CACHE names a directory of converged results to reuse
+    const char *cacheDirectory = std::getenv("SPA_ANALYSIS_CACHE");
     const auto startPropagation = begin();
-    g.run_propagation();
-    end(startPropagation, "analysis = ");
+    PropagationStats stats;
+    if (cacheDirectory) {
+      AnalysisCache cache(cacheDirectory);
+      stats = cache.run_propagation(g);
+      end(startPropagation, "analysis = ");
+      std::cout << "cache hits = " << cache.counters().hits << std::endl;
+      std::cout << "cache misses = " << cache.counters().misses << std::endl;
+    } else {
+      stats = g.run_propagation();
+      end(startPropagation, "analysis = ");
+    }
+    std::cout << "rounds = " << stats.rounds << std::endl;
+    std::cout << "ops visited = " << stats.opsVisited << std::endl;
+    std::cout << "bits cleared = " << stats.bitsCleared << std::endl;
   } else {
     std::cout << "analysis = " << 0 << std::endl;
   }
@@ -32,8 +125,16 @@ void run(const std::string &file_path, const bool propagate,
     t->initialize_data();
   }
 
-  for (auto node : g.nodes)
+  // SPA_PREASSEMBLE allocates the outputs up front, so compute skips TACO's
+  // assembly. The outputs are dense: the vectors only bound a sparse output's
+  // structure, and TACO's compute-only kernels need it exact, so sparse
+  // outputs are not preassembled.
+  const bool preassemble = std::getenv("SPA_PREASSEMBLE") != nullptr;
+  for (auto node : g.nodes) {
     node->output->create_data(generate_modes(node->output->numDims, false));
+    if (preassemble)
+      node->output->assemble_data();
+  }
 
   end(startLoad, "load graph = ");
 
@@ -51,16 +152,10 @@ void run(const std::string &file_path, const bool propagate,
 
 void run_prop(const std::string &file_path, const double sparsity, bool run_fw,
               bool run_lat, bool run_bw) {
-  auto benchmark = read_einsum_benchmark(file_path);
-
-  if (benchmark.path.empty() || benchmark.strings.empty() ||
-      benchmark.sizes.empty()) {
-    std::cerr << "Could not parse einsum benchmark.\n";
-    return;
-  }
   const auto buildStart = begin();
-  auto g =
-      build_tree(benchmark.sizes, benchmark.strings, benchmark.path, sparsity);
+  auto g = load_graph(file_path, sparsity);
+  if (g.nodes.empty())
+    return;
   end(buildStart, "create graph = ");
 
   std::cout << "initial_ratio = " << g.get_sparsity_ratio() << std::endl;
@@ -78,7 +173,124 @@ void run_prop(const std::string &file_path, const double sparsity, bool run_fw,
   }
 }
 
+void run_prop_batch(const std::string &file_path, const double sparsity,
+                    bool run_fw, bool run_lat, bool run_bw, const int n) {
+  auto benchmark = read_einsum_benchmark(file_path);
+
+  if (benchmark.path.empty() || benchmark.strings.empty() ||
+      benchmark.sizes.empty()) {
+    std::cerr << "Could not parse einsum benchmark.\n";
+    return;
+  }
+  const unsigned int seed = SEED;
+  const auto buildStart = begin();
+  auto g =
+      build_tree(benchmark.sizes, benchmark.strings, benchmark.path, sparsity);
+  // the input sparsities of seed + i are those build_tree() draws for it
+  std::vector<std::vector<std::vector<SparsityVector>>> scenarios;
+  for (int i = 0; i < n; ++i) {
+    SEED = seed + i;
+    scenarios.push_back(generate_input_sparsities(benchmark.sizes,
+                                                  benchmark.path, sparsity));
+  }
+  SEED = seed;
+  end(buildStart, "create graph = ");
+
+  // ratios[i]: initial, fw, lat and bw ratio of seed + i
+  std::vector<std::vector<float>> ratios(n);
+  const auto startPropagation = begin();
+  for (int first = 0; first < n; first += PropagationBatch::MAX_SCENARIOS) {
+    PropagationBatch batch(
+        g, std::min<size_t>(n - first, PropagationBatch::MAX_SCENARIOS));
+    for (size_t s = 0; s < batch.size(); ++s)
+      for (size_t k = 0; k < g.inputs.size(); ++k)
+        for (int dim = 0; dim < g.inputs[k]->numDims; ++dim)
+          batch.set_sparsity(s, *g.inputs[k], dim,
+                             scenarios[first + s][k][dim]);
+    auto record = [&]() {
+      auto batchRatios = batch.get_sparsity_ratios();
+      for (size_t s = 0; s < batch.size(); ++s)
+        ratios[first + s].push_back(batchRatios[s]);
+    };
+    record();
+    if (run_fw) {
+      batch.run_propagation(FORWARD);
+      record();
+    }
+    if (run_lat) {
+      batch.run_propagation(INTRA);
+      record();
+    }
+    if (run_bw) {
+      batch.run_propagation(BACKWARD);
+      record();
+    }
+  }
+  end(startPropagation, "analysis = ");
+
+  // one line per seed, then the means under the keys run_prop() prints
+  std::vector<std::string> keys{"initial_ratio"};
+  if (run_fw)
+    keys.push_back("fw_ratio");
+  if (run_lat)
+    keys.push_back("lat_ratio");
+  if (run_bw)
+    keys.push_back("bw_ratio");
+  std::vector<double> means(keys.size(), 0);
+  for (int i = 0; i < n; ++i) {
+    std::cout << "seed " << seed + i << ":";
+    for (size_t k = 0; k < keys.size(); ++k) {
+      std::cout << " " << ratios[i][k];
+      means[k] += ratios[i][k] / n;
+    }
+    std::cout << std::endl;
+  }
+  for (size_t k = 0; k < keys.size(); ++k)
+    std::cout << keys[k] << " = " << means[k] << std::endl;
+}
+
+/// Parses every instance of \p directory at once, printing "ok <file>" for
+/// each instance that parses and the error of each one that does not.
+/// scripts/run_einsum.py sweeps the instances listed as ok.
+void check_dataset(const std::string &directory) {
+  const auto startParse = begin();
+  auto entries = read_einsum_dataset(directory);
+  end(startParse, "parse dataset = ");
+  for (auto &entry : entries) {
+    if (entry.error.empty())
+      std::cout << "ok " << entry.path.substr(directory.size() + 1) << "\n";
+    else
+      std::cerr << entry.error << "\n";
+  }
+}
+
 int benchmark_einsum(int argc, char *argv[]) {
+  if (argc == 4 && std::string(argv[2]) == "dataset") {
+    check_dataset(argv[3]);
+    return 0;
+  }
+  if (argc == 10 && std::string(argv[2]) == "prop-batch") {
+    int param = 2;
+    const std::string file_path = argv[++param];
+    const double sparsity = std::stod(argv[++param]);
+    const bool run_fw = std::stoi(argv[++param]);
+    const bool run_lat = std::stoi(argv[++param]);
+    const bool run_bw = std::stoi(argv[++param]);
+    SEED = std::stoi(argv[++param]);
+    const int n = std::stoi(argv[++param]);
+    run_prop_batch(file_path, sparsity, run_fw, run_lat, run_bw, n);
+    return 0;
+  }
+  if (argc == 8 && std::string(argv[2]) == "snapshot") {
+    int param = 2;
+    const std::string file_path = argv[++param];
+    const double sparsity = std::stod(argv[++param]);
+    SEED = std::stoi(argv[++param]);
+    const bool propagate = std::stoi(argv[++param]);
+    const std::string snapshot_path = argv[++param];
+    write_snapshot(file_path, sparsity, propagate, snapshot_path);
+    return 0;
+  }
   if (argc != 8 && argc != 9) {
     std::cerr << "Usage for runtime/memory: " << argv[0]
               << " einsum <file_path> <sparsity> "
@@ -86,6 +298,22 @@ int benchmark_einsum(int argc, char *argv[]) {
     std::cerr << "Usage for analysis: " << argv[0]
               << " einsum prop <file_path> <sparsity> "
                  "<run_fw> <run_lat> <run_bw> <random_seed>\n ";
+    std::cerr << "Usage for batched analysis: " << argv[0]
+              << " einsum prop-batch <file_path> <sparsity> "
+                 "<run_fw> <run_lat> <run_bw> <first_seed> <num_seeds>\n ";
+    std::cerr << "Usage for checking a dataset: " << argv[0]
+              << " einsum dataset <directory>\n ";
+    std::cerr << "Usage for snapshots: " << argv[0]
+              << " einsum snapshot <file_path> <sparsity> <random_seed> "
+                 "<propagate> <snapshot_path>\n"
+                 "  A <file_path> ending in .snap is loaded as a snapshot, "
+                 "with the vectors it was saved with.\n"
+                 "  Set SPA_ANALYSIS_CACHE to a directory to reuse converged "
+                 "analysis results across runs.\n"
+                 "  Set SPA_PREASSEMBLE to allocate the (dense) outputs "
+                 "before computing them.\n"
+                 "  Set SPA_IMPORT to comma-separated .tns/.mtx files to seed "
+                 "the inputs of the same sizes with their sparsity.\n ";
     return 1;
   }
 
@@ -7,4 +7,10 @@ void run(const std::string &file_path, const bool propagate,
 void run_prop(const std::string &file_path, const double sparsity, bool run_fw,
               bool run_lat, bool run_bw);
 
+void run_prop_batch(const std::string &file_path, const double sparsity,
+                    bool run_fw, bool run_lat, bool run_bw, const int n);
+
+void write_snapshot(const std::string &file_path, const double sparsity,
+                    const bool propagate, const std::string &snapshot_path);
+
 int benchmark_einsum(int argc, char *argv[]);
@@ -1,11 +1,22 @@
+#include "../include/bit_kernels.hpp"
 #include "../include/graph.hpp"
 #include "../include/node.hpp"
 #include "../include/tensor.hpp"
 #include "../include/utils.hpp"
 #include <cassert>
 
-void benchmark_proptime() {
-  int size = MAX_SIZE;
+int benchmark_proptime(int argc, char *argv[]) {
+  if (argc > 4) {
+    std::cerr << "Usage: " << argv[0]
+              << " proptime [size] [scalar|avx2|avx512]\n ";
+    return 1;
+  }
+  int size = argc >= 3 ? std::stoi(argv[2]) : 2048;
+  if (argc == 4 && !set_bit_kernels(argv[3])) {
+    std::cerr << "Error: bit kernels '" << argv[3]
+              << "' are not supported on this CPU" << std::endl;
+    return 1;
+  }
   double sparsity{0.5}; // arbitrary: static analysis runtime doesn't change
 
   auto A = std::make_shared<Tensor>(
@@ -34,6 +45,8 @@ void benchmark_proptime() {
   auto g = Graph::build_graph({A, B}, C, {matmul});
   auto startLoad = begin();
   g.run_propagation();
-  std::cout << MAX_SIZE << std::endl;
+  std::cout << size << std::endl;
+  std::cout << "kernels = " << bit_kernels().name << std::endl;
   end(startLoad, "proptime = ");
+  return 0;
 }
@@ -1 +1 @@
-void benchmark_proptime();
+int benchmark_proptime(int argc, char *argv[]);
@@ -0,0 +1,85 @@
+/**
+ * @file analysis_cache.hpp
+ * @brief A persistent, content-addressed cache of converged analysis results.
+ */
+
+#pragma once
+#include "graph.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Keeps the fixed point of Graph::run_propagation() on disk, keyed by a
+ * hash of the graph's structure, expressions, sizes and the sparsity vectors
+ * the analysis starts from.
+ *
+ * Each entry is one file in the cache directory. An entry also records a
+ * second, independent hash of the same key material and a checksum of its
+ * words; a file failing either check counts as corrupt, is deleted, and is
+ * treated as a miss. Once the entries exceed the byte budget, the least
+ * recently used ones are deleted. Processes may share a directory: entries
+ * are written to a temporary file and renamed into place.
+ */
+class AnalysisCache {
+public:
+  /// @brief The identity of a graph and its current vectors.
+  struct Key {
+    /// @brief Names the entry file.
+    uint64_t name;
+    /// @brief An independent hash stored in the entry, guarding against
+    /// collisions of `name`.
+    uint64_t check;
+  };
+
+  /// @brief Lookup outcomes since construction.
+  struct Counters {
+    size_t hits{0};
+    size_t misses{0};
+    /// @brief Entries rejected by a check, included in `misses`.
+    size_t corrupt{0};
+    size_t evictions{0};
+  };
+
+  /**
+   * @brief Opens (and creates, if needed) the cache in \p directory.
+   * @param maxBytes The budget for all entries together.
+   */
+  explicit AnalysisCache(std::string directory,
+                         uint64_t maxBytes = uint64_t{1} << 30);
+
+  /// @brief The key of \p g with its current vectors.
+  static Key key(const Graph &g);
+
+  /**
+   * @brief Replaces the vectors of \p g with the entry of \p k, if there is a
+   * valid one.
+   * @return True on a hit; \p g is unchanged on a miss.
+   */
+  bool load(const Key &k, Graph &g);
+
+  /// @brief Saves the current vectors of \p g as the entry of \p k, then
+  /// evicts entries over the budget.
+  void store(const Key &k, const Graph &g);
+
+  /**
+   * @brief Graph::run_propagation(\p options) through the cache: a hit skips
+   * propagation entirely, a miss runs it and stores the result if it
+   * converged.
+   */
+  PropagationStats run_propagation(Graph &g,
+                                   const PropagationOptions &options = {});
+
+  /// @brief Lookup outcomes since construction.
+  const Counters &counters() const { return stats; }
+
+  /// @brief The file holding the entry of \p k, whether or not it exists.
+  std::string entry_path(const Key &k) const;
+
+private:
+  void evict();
+
+  std::string directory;
+  uint64_t maxBytes;
+  Counters stats;
+};
@@ -0,0 +1,88 @@
+/**
+ * @file bit_kernels.hpp
+ * @brief Word-level bitvector kernels used on the propagation hot path.
+ *
+ * The kernels operate on raw arrays of 64-bit words so they can be shared by
+ * SparsityVector and by any other packed layout of the abstract domain. Each
+ * kernel has a scalar implementation and, on x86-64, AVX2 and AVX-512
+ * implementations. The variant is chosen once at runtime from the features
+ * reported by the CPU, and can be overridden with the `SPA_BIT_KERNELS`
+ * environment variable ("scalar", "avx2" or "avx512") or set_bit_kernels().
+ */
+
+#pragma once
+#include "sparsity_vector.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Table of word-level kernels for one instruction set.
+ *
+ * All functions process \p n words. Bits past the logical end of a vector are
+ * expected to be clear, so no masking is done by the kernels.
+ */
+struct BitKernels {
+  /// @brief Name of the instruction set ("scalar", "avx2" or "avx512").
+  const char *name;
+  /// @brief dst[i] &= src[i].
+  void (*and_words)(uint64_t *dst, const uint64_t *src, size_t n);
+  /// @brief dst[i] |= src[i].
+  void (*or_words)(uint64_t *dst, const uint64_t *src, size_t n);
+  /// @brief dst[i] &= src[i]; returns true if any bit of dst was cleared.
+  bool (*and_changed_words)(uint64_t *dst, const uint64_t *src, size_t n);
+  /// @brief Returns the number of set bits in src[0, n).
+  size_t (*popcount_words)(const uint64_t *src, size_t n);
+  /// @brief Returns the number of set bits in a[i] & b[i], without storing the
+  /// intersection.
+  size_t (*and_popcount_words)(const uint64_t *a, const uint64_t *b, size_t n);
+};
+
+/// @brief Returns the kernels selected for this process.
+const BitKernels &bit_kernels();
+
+/**
+ * @brief Overrides the kernels selected for this process.
+ *
+ * Safe to call while other threads run kernels: each call they make uses
+ * either the old or the new table.
+ * @param name "scalar", "avx2" or "avx512".
+ * @return false if \p name is unknown or not supported by the CPU, in which
+ * case the selection is left unchanged.
+ */
+bool set_bit_kernels(const std::string &name);
+
+/// @brief Returns the names of the kernel variants supported by the CPU.
+std::vector<std::string> available_bit_kernels();
+
+// --- SparsityVector-level operations built on the selected kernels ---
+
+/**
+ * @brief N-ary intersection: dst &= srcs[0] & srcs[1] & ...
+ *
+ * Operands shorter than \p dst clear the bits of \p dst they do not cover.
+ */
+void and_all(SparsityVector &dst,
+             const std::vector<const SparsityVector *> &srcs);
+
+/**
+ * @brief N-ary union: dst |= srcs[0] | srcs[1] | ...
+ *
+ * \p dst grows to the length of its longest operand.
+ */
+void or_all(SparsityVector &dst,
+            const std::vector<const SparsityVector *> &srcs);
+
+/**
+ * @brief Intersects \p dst with \p src and reports whether \p dst changed.
+ *
+ * Since SPA only ever clears bits, this is the "did the fixed point move?"
+ * test used by iterative solvers.
+ */
+bool and_changed(SparsityVector &dst, const SparsityVector &src);
+
+/**
+ * @brief Counts the set bits of \p a & \p b without materializing the
+ * intersection.
+ */
+size_t and_count(const SparsityVector &a, const SparsityVector &b);
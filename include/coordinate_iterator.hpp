@@ -0,0 +1,45 @@
+/**
+ * @file coordinate_iterator.hpp
+ * @brief Streams the nonzero coordinates SPA allows in a tensor.
+ */
+
+#pragma once
+#include "sparsity_vector.hpp"
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Walks the Cartesian product of the set bits of one Sparsity Vector
+ * per dimension, in lexicographic order, like an odometer.
+ *
+ * Only the current coordinate is kept, so memory is O(rank) whatever the
+ * number of coordinates, and advancing never allocates. The vectors must
+ * outlive the iterator and stay unchanged while it is in use.
+ *
+ * @code
+ * for (CoordinateIterator it(tensor.sparsities); it.valid(); it.next())
+ *   use(it.coordinate());
+ * @endcode
+ */
+class CoordinateIterator {
+public:
+  /// @brief Positions the iterator on the first coordinate, if there is one.
+  explicit CoordinateIterator(const std::vector<SparsityVector> &sparsities);
+
+  /// @brief True until the iterator has moved past the last coordinate.
+  bool valid() const { return !done; }
+
+  /// @brief The current coordinate. Requires valid().
+  const std::vector<int> &coordinate() const { return coord; }
+
+  /// @brief Moves to the next coordinate: the last dimension turns fastest
+  /// and each exhausted dimension carries into the one before it.
+  void next();
+
+private:
+  const std::vector<SparsityVector> &sparsities;
+  /// @brief The first set bit of each dimension, where a carry restarts it.
+  std::vector<int> first;
+  std::vector<int> coord;
+  bool done{false};
+};
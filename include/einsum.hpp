@@ -3,6 +3,7 @@
 #include "../include/graph.hpp"
 #include "../include/utils.hpp"
 #include "taco/format.h"
+#include <cstdint>
 
 /**
  * @brief Represents the data parsed from a benchmark file describing a sequence
@@ -18,12 +19,23 @@ struct EinsumBenchmark {
   /// 2)].
   std::vector<std::pair<int, int>> path;
   /// The Einsum strings for each contraction step, e.g., {"ij,jk->ik",
-  /// "ik,kl->il"}.
+  /// "ik,kl->il"}, or in index-list form, e.g., {"0 1,1 2->0 2"} (see
+  /// EinsumLabels).
   std::vector<std::string> strings;
   /// The dimensions/sizes for the initial set of input tensors.
   std::vector<std::vector<int>> sizes;
 };
 
+/// @brief One instance of a dataset directory, see read_einsum_dataset().
+struct EinsumDatasetEntry {
+  /// The path of the instance file.
+  std::string path;
+  /// The parsed instance; empty if `error` is set.
+  EinsumBenchmark benchmark;
+  /// Why the file could not be read, or empty.
+  std::string error;
+};
+
 /**
  * @brief Parses a contraction path string to extract the sequence of tensor
  * indices to be contracted.
@@ -35,6 +47,7 @@ struct EinsumBenchmark {
  * 3)]".
  * @return A vector of pairs, where each pair (i, j) indicates that the i-th and
  * j-th tensors currently in the stack should be contracted.
+ * @throws std::runtime_error if the line is not a list of pairs.
  */
 std::vector<std::pair<int, int>> get_contraction_path(const std::string &line);
 
@@ -42,12 +55,14 @@ std::vector<std::pair<int, int>> get_contraction_path(const std::string &line);
  * @brief Parses a line to extract the Einsum notation strings for each
  * contraction.
  *
- * These strings (e.g., "ij,jk->ik") define the input dimensions, output
- * dimensions, and reduction dimensions for a binary tensor operation.
+ * These strings (e.g., "ij,jk->ik", or "0 1,1 2->0 2" for networks with more
+ * than 52 index variables) define the input dimensions, output dimensions, and
+ * reduction dimensions for a binary tensor operation.
  *
  * @param line The string containing the list of Einsum strings, typically
  * single-quoted.
  * @return A vector of strings, where each string is an Einsum expression.
+ * @throws std::runtime_error if the line is not a list of quoted strings.
  */
 std::vector<std::string> get_contraction_strings(const std::string &line);
 
@@ -59,6 +74,7 @@ std::vector<std::string> get_contraction_strings(const std::string &line);
  * 4), (4, 5)]".
  * @return A vector of vectors, where each inner vector represents the
  * dimensions of an input tensor.
+ * @throws std::runtime_error if the line is not a list of integer tuples.
  */
 std::vector<std::vector<int>> get_tensor_sizes(const std::string &line);
 
@@ -80,22 +96,22 @@ std::string extract_outputs(std::string const &einsumString);
 std::vector<std::string> extract_inputs(std::string const &einsumString);
 
 /**
- * @brief Constructs a map from a dimension index variable (char) to its size
- * (int).
+ * @brief Constructs a map from a dimension index variable label (see
+ * EinsumLabels) to its size (int).
  *
  * This map is essential for deducing the size of the output tensor in an Einsum
  * operation, as it ensures that shared indices have a consistent size across
  * inputs.
  *
- * @param inputs A vector of strings representing the indices of the input
- * tensors (e.g., {"ij", "jk"}).
+ * @param inputs The index labels of the input tensors (e.g., the labels of
+ * {"ij", "jk"}).
  * @param tensorSizes A vector of vectors containing the actual sizes of the
  * input tensors.
- * @return An unordered map where keys are index variables (e.g., 'i', 'j', 'k')
- * and values are their corresponding dimension sizes.
+ * @return An unordered map where keys are index variable labels (e.g., 'i',
+ * 'j', 'k') and values are their corresponding dimension sizes.
  */
-std::unordered_map<char, int>
-construct_size_map(std::vector<std::string> const &inputs,
+std::unordered_map<int, int>
+construct_size_map(std::vector<std::vector<int>> const &inputs,
                    std::vector<std::vector<int>> const &tensorSizes);
 
 /**
@@ -105,7 +121,8 @@ construct_size_map(std::vector<std::string> const &inputs,
  * Uses the index-to-size map (constructed from inputs) to look up the size for
  * each index variable in the output string.
  *
- * @param einsumString The Einsum string for the operation (e.g., "ij,jk->ik").
+ * @param einsumString The Einsum string for the operation (e.g., "ij,jk->ik"
+ * or "0 1,1 2->0 2").
  * @param sizes1 The dimension sizes of the first input tensor.
  * @param sizes2 The dimension sizes of the second input tensor.
  * @return A vector of integers representing the dimension sizes of the output
@@ -134,18 +151,88 @@ std::vector<int> deduceOutputDims(std::string const &einsumString,
 std::vector<taco::ModeFormatPack> generate_modes(int order,
                                                  bool sparse = false);
 
+/**
+ * @brief Parses the text of a benchmark file in a single pass.
+ *
+ * The text holds three lines, each a Python list literal: the contraction path
+ * (pairs), the Einsum strings (quoted), and the tensor sizes (tuples).
+ *
+ * @param text The contents of the benchmark file.
+ * @param source The name used in error messages, usually the file path.
+ * @return An EinsumBenchmark structure populated with the parsed data.
+ * @throws std::runtime_error naming "source:line:column" and what was expected
+ * when the text is malformed, or when the path and the strings disagree in
+ * length.
+ */
+EinsumBenchmark parse_einsum_benchmark(const std::string &text,
+                                       const std::string &source = "<input>");
+
 /**
  * @brief Reads a benchmark file containing Einsum specifications and parses its
  * components.
  *
  * The file is expected to contain three lines: contraction path, Einsum
- * strings, and tensor sizes.
+ * strings, and tensor sizes. Errors are printed, and leave the result empty.
  *
  * @param filename The path to the benchmark file.
  * @return An EinsumBenchmark structure populated with the parsed data.
  */
 EinsumBenchmark read_einsum_benchmark(const std::string &filename);
 
+/**
+ * @brief Reads every `.txt` instance of a dataset directory, parsing the files
+ * concurrently.
+ *
+ * @param directory The dataset directory, e.g. einsum-dataset/.
+ * @param numThreads Threads parsing files; 0 means one per hardware thread.
+ * @return One entry per instance, sorted by path. A file that fails to parse
+ * keeps its error message instead of aborting the others.
+ */
+std::vector<EinsumDatasetEntry>
+read_einsum_dataset(const std::string &directory, size_t numThreads = 0);
+
+/// @brief The version written by write_graph_snapshot(). Readers reject other
+/// versions.
+constexpr uint32_t GRAPH_SNAPSHOT_VERSION = 1;
+
+/**
+ * @brief Writes \p g as a binary snapshot: every tensor with its sizes and
+ * current sparsity vectors, every op with its kind, Einsum expression and
+ * operands, and the graph's inputs and output.
+ *
+ * The file is a fixed header followed by flat, 8-byte aligned arrays, so
+ * read_graph_snapshot() maps it and rebuilds the graph without parsing.
+ * Concrete TACO data is not saved. The layout is the host's byte order;
+ * the header records it and readers on other hosts reject the file.
+ *
+ * @throws std::runtime_error if the file cannot be written.
+ */
+void write_graph_snapshot(const Graph &g, const std::string &filename);
+
+/**
+ * @brief Loads a snapshot written by write_graph_snapshot() with mmap and
+ * rebuilds the graph, with the sparsity vectors as they were saved.
+ *
+ * @throws std::runtime_error if the file cannot be mapped, has another magic,
+ * version or byte order, or is truncated or inconsistent.
+ */
+Graph read_graph_snapshot(const std::string &filename);
+
+/**
+ * @brief The sparsity vectors build_tree() gives its inputs under the current
+ * SEED, without building the graph.
+ *
+ * Each contraction prunes its first operand that is still an input to
+ * generate_sparsity_vector(\p sparsity, ...) per dimension; the inputs no
+ * contraction prunes stay dense.
+ *
+ * @return One vector per dimension of every input, in input order.
+ */
+std::vector<std::vector<SparsityVector>>
+generate_input_sparsities(const std::vector<std::vector<int>> &tensorSizes,
+                          const std::vector<std::pair<int, int>> &contractionInds,
+                          const double sparsity);
+
 /**
  * @brief Constructs the computational graph (expression tree) for a sequence of
  * Einsum operations.
@@ -1,6 +1,57 @@
 #pragma once
 
 #include "../include/node.hpp"
+#include "../include/thread_pool.hpp"
+#include <memory>
+
+/// @brief Limits for the fixed-point solver of Graph::run_propagation().
+struct PropagationOptions {
+  /// @brief Maximum number of rounds (one FORWARD, INTRA and BACKWARD sweep
+  /// over the pending ops each); 0 means no limit. Ops are only requeued when
+  /// a bit is cleared, so the solver terminates without a limit too.
+  size_t maxRounds{0};
+  /// @brief Threads used by the solver, the caller included; 0 means one per
+  /// hardware thread. With more than one thread, the ops of each topological
+  /// level are propagated in parallel (see PropagationSchedule::levels).
+  size_t threads{1};
+};
+
+/// @brief Convergence statistics reported by Graph::run_propagation().
+struct PropagationStats {
+  /// @brief Number of rounds run.
+  size_t rounds{0};
+  /// @brief Number of transfer functions evaluated (op x direction).
+  size_t opsVisited{0};
+  /// @brief Number of sparsity bits cleared over all tensors.
+  size_t bitsCleared{0};
+  /// @brief False if maxRounds stopped the solver before the fixed point.
+  bool converged{false};
+};
+
+/**
+ * @brief Traversal orders of a Graph, computed once by Graph::build_graph().
+ *
+ * Ops are referred to by their position in Graph::nodes, tensors by their
+ * position in Graph::tensors.
+ */
+struct PropagationSchedule {
+  /// @brief Topological order: every op comes after the producers of its
+  /// inputs. Used by FORWARD.
+  std::vector<size_t> forward;
+  /// @brief Reverse topological order. Used by INTRA and BACKWARD.
+  std::vector<size_t> backward;
+  /// @brief Ops grouped by topological level: an op's level is the length of
+  /// the longest chain of producers leading to it, so the ops of one level
+  /// never feed each other.
+  std::vector<std::vector<size_t>> levels;
+  /// @brief Number of input slots of each op filled by another op of the
+  /// graph.
+  std::vector<size_t> numProducers;
+  /// @brief Number of input slots of other ops fed by each op's output.
+  std::vector<size_t> numConsumers;
+  /// @brief For each tensor, the ops whose transfer functions read it.
+  std::vector<std::vector<size_t>> readers;
+};
 
 /**
  * @brief Represents the computational graph for tensor operations, serving as
@@ -14,19 +65,40 @@
 class Graph {
 
 public:
-  /// @brief A list of all operation nodes (e.g., Einsum) in the graph.
+  /// @brief A list of all operation nodes (e.g., Einsum) in the graph. An
+  /// op's position is its id in `links`.
   std::vector<OpNodePtr> nodes;
   /// @brief The initial input tensors to the computational graph.
   std::vector<TensorPtr> inputs;
   /// @brief The final output tensor of the entire computation.
   TensorPtr output;
+  /// @brief Every distinct tensor of the graph: inputs, op operands and
+  /// outputs. A tensor's position is its id in `links`. Filled with `links`.
+  std::vector<TensorPtr> tensors;
+  /// @brief The edges between `nodes` and `tensors` as ids, filled by
+  /// build_schedule(). Held by pointer so the ops can keep referring to it
+  /// when the graph moves.
+  std::unique_ptr<GraphLinks> links;
+  /// @brief Cached traversal orders, filled by build_graph().
+  PropagationSchedule schedule;
+  /// @brief Contiguous storage for the sparsity vectors of every tensor in the
+  /// graph, filled by build_graph().
+  SparsityArenaPtr arena;
+  /// @brief The analysis lowered to bit operations, filled by build_graph().
+  PropagationProgram program;
+  /// @brief The vector every slot of `program` held when it was lowered: the
+  /// starting point update_sparsity() replays the analysis from.
+  std::vector<SparsityVector> seeds;
 
   /**
    * @brief Factory method to construct and initialize the computational graph.
    *
    * This method establishes the connections (edges) between Tensors and
-   * OpNodes, setting up the `inputOps` and `outputOp` pointers for traversal
-   * during SPA.
+   * OpNodes: it numbers the tensors and ops and records the edges between them
+   * in `links` for traversal during SPA.
+   *
+   * The dense sparsity vectors of all tensors are then moved into a single
+   * SparsityArena, so propagation walks one contiguous block of memory.
    *
    * @param inputs The set of initial tensors.
    * @param out The final result tensor.
@@ -37,8 +109,132 @@ public:
   static Graph build_graph(std::vector<TensorPtr> inputs, TensorPtr out,
                            const std::vector<OpNodePtr> &ops);
 
-  /// @brief Default destructor.
-  ~Graph() = default;
+  Graph() = default;
+  /// @brief Graphs own their ops, so they move but do not copy.
+  Graph(Graph &&) = default;
+  Graph(const Graph &) = delete;
+  Graph &operator=(const Graph &) = delete;
+  Graph &operator=(Graph &&) = delete;
+
+  /**
+   * @brief Detaches the ops of `nodes` from `links`. Tensors and ops refer to
+   * each other only through the graph, so once it is gone they are freed as
+   * soon as the caller drops its handles.
+   */
+  ~Graph();
+
+  /**
+   * @brief Rebuilds `tensors` and `links`, then computes `schedule`, from the
+   * current `nodes`. Called by build_graph() and by the edits; call it again
+   * after editing `nodes` by hand, while the ops taken out are still alive.
+   */
+  void build_schedule();
+
+  /**
+   * @brief Moves the dense sparsity vectors of all tensors in the graph into a
+   * freshly sized `arena`. Called by build_graph().
+   */
+  void bind_sparsities();
+
+  /**
+   * @brief Lowers the transfer functions of every op into `program`, following
+   * the sweep orders of `schedule`. Called by build_graph(); call it again
+   * after editing `nodes` or replacing a tensor. The current vectors become
+   * the `seeds`.
+   */
+  void lower_propagation();
+
+  /**
+   * @brief Replaces the sparsity vectors of \p tensor and brings the analysis
+   * back to its fixed point, revisiting only the vectors that depend on them.
+   *
+   * The graph must be at a fixed point (see run_propagation()), and the
+   * result is the fixed point a full analysis would reach from the `seeds`
+   * with \p sparsities in place of the tensor's seeds. If the new vectors only
+   * clear bits of the old seeds, they are ANDed in and the solver resumes from
+   * the readers of \p tensor. If they set a bit, every vector reachable from
+   * \p tensor through `program` is reset to its seed and its instructions are
+   * replayed; vectors outside that cone keep their values.
+   * Either way the work is proportional to the affected region, not to the
+   * graph.
+   *
+   * @param tensor A tensor of the graph, usually an input.
+   * @param sparsities One vector per dimension, of the tensor's sizes.
+   * @param options `maxRounds` caps the rounds; `threads` does not apply.
+   * @return Convergence statistics; `opsVisited` counts instructions.
+   */
+  PropagationStats update_sparsity(const TensorPtr &tensor,
+                                   const std::vector<SparsityVector> &sparsities,
+                                   const PropagationOptions &options = {});
+
+  /**
+   * @brief Resets every vector reachable from \p tensors through `program` to
+   * its seed and replays the instructions writing them, bringing an analysed
+   * graph back to its fixed point after the transfer functions reading or
+   * writing \p tensors changed. Used by the graph edits below.
+   * @return Convergence statistics; `opsVisited` counts instructions.
+   */
+  PropagationStats repropagate(const std::vector<TensorPtr> &tensors,
+                               const PropagationOptions &options = {});
+
+  // --- Structural edits. Each one rewires the ops, refreshes `links`,
+  // `schedule` and `program`, and re-propagates only the vectors whose
+  // transfer functions changed (see repropagate()). Existing vectors stay in
+  // place; the vectors of new tensors are not moved into `arena`. The graph
+  // must be at a fixed point before an edit. ---
+
+  /**
+   * @brief Adds \p op, whose inputs are tensors of the graph or new inputs.
+   * New inputs are not added to `inputs`; do so by hand if needed.
+   */
+  PropagationStats add_op(const OpNodePtr &op,
+                          const PropagationOptions &options = {});
+
+  /**
+   * @brief Removes \p op. Its output stays in the graph if other ops read it,
+   * as a tensor without producer.
+   *
+   * \p op must not produce `output`: the graph would be left without a
+   * computed result. Rewire or replace the output first.
+   */
+  PropagationStats remove_op(const OpNodePtr &op,
+                             const PropagationOptions &options = {});
+
+  /**
+   * @brief Makes input \p inputInd of \p op read \p tensor, which must have the
+   * sizes of the tensor it replaces.
+   */
+  PropagationStats rewire_input(const OpNodePtr &op, size_t inputInd,
+                                const TensorPtr &tensor,
+                                const PropagationOptions &options = {});
+
+  /**
+   * @brief Substitutes \p newTensor for \p oldTensor everywhere: as an op
+   * input, as an op output, in `inputs` and as `output`. The tensors must
+   * have the same sizes.
+   */
+  PropagationStats replace_tensor(const TensorPtr &oldTensor,
+                                  const TensorPtr &newTensor,
+                                  const PropagationOptions &options = {});
+
+  /**
+   * @brief Runs one sweep of `program` in direction \p dir: the same result as
+   * run_propagation(Direction), without any map lookup or type dispatch.
+   * @return True if any bit was cleared.
+   */
+  bool run_program(Direction dir);
+
+  /**
+   * @brief Runs `program` to the fixed point of run_propagation().
+   *
+   * Meant for repeated analyses of one graph: set new input sparsities, then
+   * call this. Each round sweeps FORWARD, INTRA and BACKWARD until a round
+   * clears no bit.
+   *
+   * @param options `maxRounds` caps the rounds; `threads` does not apply.
+   * @return Convergence statistics; `opsVisited` counts instructions.
+   */
+  PropagationStats run_program(const PropagationOptions &options = {});
 
   /**
    * @brief Executes the complete Sparsity Propagation Analysis (SPA) by running
@@ -46,15 +242,64 @@ public:
    * Backward.
    *
    * The analysis is performed iteratively until a fixed point is reached for
-   * the sparsity vectors across all tensors.
+   * the sparsity vectors across all tensors. A worklist keeps track of the ops
+   * whose transfer functions read a vector that changed, so each round only
+   * revisits those ops.
+   *
+   * @param options Iteration caps for the solver.
+   * @return Convergence statistics.
    */
-  void run_propagation();
+  PropagationStats run_propagation(const PropagationOptions &options = {});
+
+  /**
+   * @brief Level-synchronous parallel version of run_propagation().
+   *
+   * Each sweep walks the topological levels in order (FORWARD) or in reverse
+   * (INTRA, BACKWARD) and runs the pending ops of a level on \p pool. FORWARD
+   * writes in place, since the ops of a level have distinct outputs. INTRA and
+   * BACKWARD first compute every op's OpNode::compute_updates() and then AND
+   * the updates into each input tensor, so ops narrowing the same input never
+   * race. The result is the same fixed point as the sequential solver.
+   *
+   * @param options Iteration caps; `threads` is ignored in favor of \p pool.
+   * @param pool The threads to run on.
+   * @return Convergence statistics.
+   */
+  PropagationStats run_propagation(const PropagationOptions &options,
+                                   ThreadPool &pool);
+
+  /**
+   * @brief Asynchronous (chaotic) version of run_propagation().
+   *
+   * SPA is monotone: bits only go from 1 to 0. Threads can therefore run the
+   * instructions of `program` with PropagationProgram::run_instruction_atomic()
+   * in any order and without barriers. An instruction that clears bits queues
+   * the readers of its destination again. Instructions are spread over
+   * per-thread work-stealing deques, so irregular, deep graphs keep every
+   * thread busy. A thread may load a word while another narrows it; either
+   * value is a sound over-approximation, and the reader is queued again if
+   * the word changes after the load. The result is the same fixed point as
+   * the sequential solver.
+   *
+   * Vectors are decompressed for the run and re-optimized afterwards.
+   *
+   * @param options `threads` sets the number of threads; `maxRounds` does not
+   * apply, and `rounds` is reported as 0.
+   * @return Convergence statistics; `opsVisited` counts instructions.
+   */
+  PropagationStats run_propagation_async(const PropagationOptions &options);
+
+  /// @brief Returns `tensors`: every distinct tensor of the graph, inputs, op
+  /// operands and outputs.
+  std::vector<TensorPtr> get_tensors() const;
 
   /**
    * @brief Executes sparsity propagation in a specific direction.
    *
    * This method implements the transfer functions (propagation logic) defined
    * in the `OpNode`s for the specified direction, which are the core of SPA.
+   * FORWARD visits every op once in topological order; INTRA and BACKWARD
+   * visit every op once in reverse topological order.
    *
    * @param dir The direction of propagation: Direction::FORWARD,
    * Direction::INTRA (Lateral), or Direction::BACKWARD.
@@ -110,4 +355,23 @@ public:
    * graph in megabytes.
    */
   void get_tensor_sizes();
+
+private:
+  /**
+   * @brief Worklist solver over single instructions of `program`, started
+   * from the slots in \p changed. With \p reset, the cone of \p changed is
+   * reset to its seeds first; otherwise the seeds of \p changed are ANDed
+   * into the current vectors.
+   */
+  PropagationStats resume_propagation(const std::vector<uint32_t> &changed,
+                                      bool reset,
+                                      const PropagationOptions &options);
+
+  /// @brief Numbers `tensors` and fills `links` from `nodes`.
+  void link();
+
+  /// @brief Relowers `program` after an edit and re-propagates the vectors of
+  /// \p touched. The edit has refreshed `links` and `schedule` already.
+  PropagationStats finish_edit(const std::vector<TensorPtr> &touched,
+                               const PropagationOptions &options);
 };
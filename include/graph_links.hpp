@@ -0,0 +1,86 @@
+/**
+ * @file graph_links.hpp
+ * @brief The edges of a Graph, stored as 32-bit indices into its arenas.
+ *
+ * A Graph owns its tensors (Graph::tensors) and ops (Graph::nodes) and refers
+ * to them by position. The edges between them live in flat index arrays
+ * instead of pointers stored in the tensors, so a tensor or op never holds a
+ * reference to its neighbours and walking the graph touches a few compact
+ * arrays.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+class OpNode;
+class Tensor;
+
+/**
+ * @brief The producer/consumer links of a Graph. Tensors are numbered by
+ * their position in Graph::tensors, ops by their position in Graph::nodes.
+ *
+ * Filled by Graph::build_schedule(), and rebuilt in place by every structural
+ * edit, so ops may keep a pointer to it.
+ */
+struct GraphLinks {
+  /// @brief The id of no op or tensor, e.g. the producer of a graph input.
+  static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+  /// @brief A run of ids, a view into one of the arrays below.
+  class Range {
+  public:
+    Range(const uint32_t *first, const uint32_t *last)
+        : first(first), last(last) {}
+    const uint32_t *begin() const { return first; }
+    const uint32_t *end() const { return last; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+    uint32_t operator[](size_t i) const { return first[i]; }
+
+  private:
+    const uint32_t *first;
+    const uint32_t *last;
+  };
+
+  /// @brief ops[o] is Graph::nodes[o]; non-owning.
+  std::vector<OpNode *> ops;
+  /// @brief The tensor id of every input slot of op o lives in
+  /// inputIds[inputOffsets[o], inputOffsets[o + 1]).
+  std::vector<uint32_t> inputOffsets{0};
+  std::vector<uint32_t> inputIds;
+  /// @brief The tensor id of the output of each op.
+  std::vector<uint32_t> outputIds;
+  /// @brief The op producing each tensor, or NONE.
+  std::vector<uint32_t> producers;
+  /// @brief The ops reading tensor t, one entry per input slot, live in
+  /// consumerIds[consumerOffsets[t], consumerOffsets[t + 1]).
+  std::vector<uint32_t> consumerOffsets{0};
+  std::vector<uint32_t> consumerIds;
+  /// @brief The id of each tensor, for lookups by pointer.
+  std::unordered_map<const Tensor *, uint32_t> tensorIds;
+
+  /// @brief The number of ops.
+  size_t num_ops() const { return ops.size(); }
+  /// @brief The number of tensors.
+  size_t num_tensors() const { return producers.size(); }
+
+  /// @brief The tensor ids of the input slots of op \p op.
+  Range inputs(uint32_t op) const {
+    return Range(inputIds.data() + inputOffsets[op],
+                 inputIds.data() + inputOffsets[op + 1]);
+  }
+  /// @brief The ops reading tensor \p tensor, one entry per input slot.
+  Range consumers(uint32_t tensor) const {
+    return Range(consumerIds.data() + consumerOffsets[tensor],
+                 consumerIds.data() + consumerOffsets[tensor + 1]);
+  }
+  /// @brief The id of \p tensor, or NONE if it is not part of the graph.
+  uint32_t tensor_id(const Tensor *tensor) const {
+    auto it = tensorIds.find(tensor);
+    return it == tensorIds.end() ? NONE : it->second;
+  }
+};
@@ -0,0 +1,24 @@
+/**
+ * @file mapped_file.hpp
+ * @brief Read-only memory mapping of whole files, for zero-copy readers.
+ */
+
+#pragma once
+#include <cstddef>
+#include <string>
+
+/// @brief A read-only private mapping of a whole file.
+class MappedFile {
+public:
+  /// @brief Maps \p filename; throws std::runtime_error if it cannot.
+  explicit MappedFile(const std::string &filename);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  /// @brief The first byte of the file, or null for an empty file.
+  const char *bytes{nullptr};
+  /// @brief The length of the file in bytes.
+  size_t length{0};
+};
@@ -1,9 +1,35 @@
 #pragma once
 
+#include "../include/graph_links.hpp"
+#include "../include/propagation_program.hpp"
 #include "../include/tensor.hpp"
-#include <typeinfo> // Used in the implementation for type checking
+#include <utility>
 #include <vector>
 
+/**
+ * @brief A narrowing of one dimension of a tensor computed by a transfer
+ * function but not applied yet: `tensor->sparsities[dim] &= mask`.
+ */
+struct SparsityUpdate {
+  Tensor *tensor;
+  int dim;
+  SparsityVector mask;
+};
+
+/**
+ * @brief The concrete type of an OpNode. Transfer functions that look at other
+ * ops dispatch on this tag through tables indexed by it rather than through
+ * RTTI, so a new op kind adds an enumerator and a row to each table.
+ */
+enum OpKind {
+  /// @brief An Add node.
+  OP_ADD,
+  /// @brief An Einsum node.
+  OP_EINSUM,
+  /// @brief The number of op kinds, the size of every dispatch table.
+  NUM_OP_KINDS
+};
+
 /**
  * @brief Represents an abstract base class for a node (operator) in the
  * computational graph.
@@ -15,10 +41,22 @@
  */
 class OpNode {
 public:
+  /// @brief The concrete type of this operation, fixed at construction.
+  const OpKind kind;
   /// @brief The input tensors to this operation.
   std::vector<TensorPtr> inputs;
   /// @brief The output tensor produced by this operation.
   TensorPtr output;
+  /// @brief The links of the Graph this op belongs to, set with `id` when the
+  /// graph links its ops and reset when it drops them; null outside a graph.
+  /// An op belongs to at most one live graph at a time.
+  const GraphLinks *links{nullptr};
+  /// @brief The position of this op in Graph::nodes and in `links`.
+  uint32_t id{GraphLinks::NONE};
+
+  /// @brief The ops of the graph reading input \p inputInd, as positions in
+  /// `links`, one entry per input slot; empty outside a graph.
+  GraphLinks::Range input_consumers(size_t inputInd) const;
 
   /**
    * @brief Abstract method to set up the concrete TACO tensor expression.
@@ -40,6 +78,22 @@ public:
    */
   virtual void propagate(Direction dir) = 0;
 
+  /**
+   * @brief Computes what propagate() would write in direction \p dir, without
+   * writing to any tensor.
+   *
+   * Parallel propagation runs this on several ops at once and merges the
+   * updates of ops that narrow the same tensor with AND. FORWARD updates
+   * target the output; INTRA and BACKWARD updates target the inputs.
+   */
+  virtual std::vector<SparsityUpdate> compute_updates(Direction dir) = 0;
+
+  /**
+   * @brief Appends the instructions equivalent to propagate(\p dir) to
+   * \p program, in the order propagate() applies its updates.
+   */
+  virtual void lower(Direction dir, PropagationProgram &program) = 0;
+
   /// @brief Abstract method to print the operation in the graph.
   virtual void print() = 0;
 
@@ -51,11 +105,16 @@ public:
   /// "Einsum").
   virtual std::string op_type() const = 0;
 
-  /// @brief Abstract method to perform the actual tensor computation.
+  /// @brief Abstract method to perform the actual tensor computation. Skips
+  /// TACO's assembly when the output is already `assembled`.
   virtual void compute() = 0;
 
   /// @brief Default destructor.
   virtual ~OpNode() = default;
+
+protected:
+  /// @brief Tags the node with the \p kind of the derived class.
+  explicit OpNode(OpKind kind) : kind(kind) {}
 };
 
 /// @brief Type alias for a shared pointer to an OpNode.
@@ -82,13 +141,15 @@ public:
    * all inputs.
    *
    * @param inputDim The dimension index.
-   * @return A vector of shared pointers to the Sparsity Vectors.
+   * @return Non-owning pointers to the Sparsity Vectors, valid while the
+   * inputs are alive.
    */
-  std::vector<std::shared_ptr<SparsityVector>>
-  get_input_sparsity_vectors(int inputDim);
+  std::vector<const SparsityVector *> get_input_sparsity_vectors(int inputDim);
 
   void set_expression() override;
   void propagate(Direction dir) override;
+  std::vector<SparsityUpdate> compute_updates(Direction dir) override;
+  void lower(Direction dir, PropagationProgram &program) override;
   void print() override;
   void print_sparsity() override;
   std::string op_type() const override;
@@ -97,6 +158,80 @@ public:
   ~Add() = default;
 };
 
+/**
+ * @brief A flat (CSR) table from dense index-variable IDs to the (input index,
+ * input dimension) pairs each variable labels. The pairs of variable `v` are
+ * stored contiguously, in the order they were added.
+ */
+class IndexVarTable {
+public:
+  /// @brief An (input index, input dimension) pair.
+  using Entry = std::pair<int, int>;
+
+  /// @brief The pairs of one variable, a view into the table.
+  class Range {
+  public:
+    Range(const Entry *first, const Entry *last) : first(first), last(last) {}
+    const Entry *begin() const { return first; }
+    const Entry *end() const { return last; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+    const Entry &operator[](size_t i) const { return first[i]; }
+
+  private:
+    const Entry *first;
+    const Entry *last;
+  };
+
+  IndexVarTable() = default;
+
+  /// @brief Flattens \p lists, where lists[v] holds the pairs of variable v.
+  explicit IndexVarTable(const std::vector<std::vector<Entry>> &lists);
+
+  /// @brief The number of variables, including those without pairs.
+  size_t num_vars() const { return offsets.size() - 1; }
+
+  /// @brief The pairs of variable \p var; empty for IDs outside the table.
+  Range operator[](int var) const {
+    if (var < 0 || var >= static_cast<int>(num_vars()))
+      return Range(nullptr, nullptr);
+    return Range(entries.data() + offsets[var],
+                 entries.data() + offsets[var + 1]);
+  }
+  /// @brief Variables are looked up by ID; see Einsum::index_var_id().
+  Range operator[](char) const = delete;
+
+private:
+  /// @brief Pairs of variable v live in entries[offsets[v], offsets[v + 1]).
+  std::vector<uint32_t> offsets{0};
+  std::vector<Entry> entries;
+};
+
+/**
+ * @brief The index labels of an einsum expression, one per dimension of each
+ * operand.
+ *
+ * Expressions come in two forms. The letter form uses one character per index
+ * ("ij,jk->ik"), and a letter is labelled by its character code. The
+ * index-list form writes each operand as whitespace-separated non-negative
+ * integers ("0 1,1 2->0 2") and is used by networks that need more index
+ * variables than there are letters. An expression containing a digit is in
+ * index-list form.
+ */
+struct EinsumLabels {
+  /// @brief The labels of each input operand.
+  std::vector<std::vector<int>> inputs;
+  /// @brief The labels of the output.
+  std::vector<int> output;
+};
+
+/**
+ * @brief Parses the labels of \p expression in either form.
+ * @throws std::invalid_argument if the expression has no "->" or an index-list
+ * operand holds something other than non-negative integers.
+ */
+EinsumLabels parse_einsum_labels(const std::string &expression);
+
 /**
  * @brief Represents an Einsum (Einstein Summation) operation.
  *
@@ -107,72 +242,89 @@ public:
 class Einsum : public OpNode {
 public:
   /// @brief The string representation of the Einsum expression (e.g.,
-  /// "ij,jk->ik").
+  /// "ij,jk->ik" or "0 1,1 2->0 2"), see EinsumLabels.
   std::string expression;
-  /// @brief The output index variables (e.g., "ik").
-  std::string outputInds;
-  /// @brief The index variables for each input tensor (e.g., {"ij", "jk"}).
-  std::vector<std::string> tensorIndicesVector;
+  /// @brief The labels of the output index variables (e.g., "ik").
+  std::vector<int> outputInds;
+  /// @brief The labels of the index variables of each input tensor (e.g.,
+  /// {"ij", "jk"}).
+  std::vector<std::vector<int>> tensorIndicesVector;
   /**
-   * @brief Map of output index char to (input index, input dimension) pairs.
+   * @brief The index variables interned by the constructor: indexVars[v] is
+   * the label of ID v. The output variables come first, then the remaining
+   * ones in order of first appearance in the inputs.
+   */
+  std::vector<int> indexVars;
+  /// @brief The variable ID of each output dimension.
+  std::vector<int> outputVarIds;
+  /// @brief The variable ID of each dimension of each input.
+  std::vector<std::vector<int>> inputVarIds;
+  /**
+   * @brief Output variable ID to (input index, input dimension) pairs.
    * Used for Forward and Backward propagation across output dimensions ($Od$).
    */
-  std::unordered_map<char, std::vector<std::pair<int, int>>> outputDims;
+  IndexVarTable outputDims;
   /**
-   * @brief Map of reduction index char to (input index, input dimension) pairs.
+   * @brief Reduction variable ID to (input index, input dimension) pairs.
    * Used for Intra-Op/Lateral propagation across reduction dimensions ($Rd$).
    */
-  std::unordered_map<char, std::vector<std::pair<int, int>>> reductionDims;
+  IndexVarTable reductionDims;
 
   /**
    * @brief Constructs an Einsum node, parsing the index variables and setting
-   * up the internal index maps (`outputDims` and `reductionDims`).
+   * up the internal index tables (`outputDims` and `reductionDims`).
    * @param inputs The input tensors.
    * @param Out The output tensor.
-   * @param expression The Einsum string.
+   * @param expression The Einsum string, in either form of EinsumLabels.
    */
   Einsum(std::vector<TensorPtr> inputs, TensorPtr Out, std::string expression);
 
   /// @brief Default destructor.
   ~Einsum() = default;
 
+  /**
+   * @brief The ID of the index variable labelled \p indexVar (a character
+   * for letter expressions), or -1 if the expression does not use it.
+   */
+  int index_var_id(int indexVar) const;
+
   /**
    * @brief Retrieves the Sparsity Vectors for all dimensions involved in a
    * specific reduction index variable.
-   * @param indexVar The reduction index character (e.g., 'j' in 'ij,jk->ik').
-   * @return A vector of shared pointers to the relevant Sparsity Vectors.
+   * @param indexVar The reduction index label (e.g., 'j' in 'ij,jk->ik').
+   * @return Non-owning pointers to the relevant Sparsity Vectors.
    */
-  std::vector<std::shared_ptr<SparsityVector>>
-  get_reduction_sparsity_vectors(char indexVar);
+  std::vector<const SparsityVector *>
+  get_reduction_sparsity_vectors(int indexVar);
 
   /**
    * @brief Retrieves the Sparsity Vectors for all dimensions corresponding to a
    * specific output index variable.
-   * @param indexVar The output index character (e.g., 'i' or 'k' in
+   * @param indexVar The output index label (e.g., 'i' or 'k' in
    * 'ij,jk->ik').
-   * @return A vector of shared pointers to the relevant Sparsity Vectors.
+   * @return Non-owning pointers to the relevant Sparsity Vectors.
    */
-  std::vector<std::shared_ptr<SparsityVector>>
-  get_output_sparsity_vectors(char indexVar);
+  std::vector<const SparsityVector *>
+  get_output_sparsity_vectors(int indexVar);
 
   /**
-   * @brief Gets the index variable character corresponding to a tensor's
+   * @brief Gets the index variable label corresponding to a tensor's
    * dimension.
    * @param tensor The tensor (must be one of the inputs).
    * @param indDimension The dimension index (0-based) in the tensor.
-   * @return The index character (e.g., 'j').
+   * @return The index label (e.g., 'j').
    */
-  char get_tensor_ind_var(TensorPtr tensor, int indDimension);
+  int get_tensor_ind_var(TensorPtr tensor, int indDimension);
 
   /**
    * @brief Gets the output dimension index (0-based) corresponding to an index
    * variable.
    * @param tensor The output tensor.
-   * @param indexVar The index character (e.g., 'k').
-   * @return The output dimension index, or -1 if the char is not an output
+   * @param indexVar The index label (e.g., 'k').
+   * @return The output dimension index, or -1 if the label is not an output
    * index.
    */
-  int get_tensor_char_ind(TensorPtr tensor, char indexVar);
+  int get_tensor_char_ind(TensorPtr tensor, int indexVar);
 
   /**
    * @brief Implements the logical OR ($\bigvee$) for Add operations (part of
@@ -189,53 +341,6 @@ public:
    */
   SparsityVector or_all_operands_add(Add *op, int inputInd, int inputDim);
 
-  /**
-   * @brief Implements the logical AND ($\bigwedge$) for Einsum operations (part
-   * of the multi-op SPA).
-   *
-   * This is part of the **Intra-Op/Lateral Propagation** rule: $S_i = S_{out}
-   * \land \bigwedge_{j \ne i} S_j$. It calculates the $\bigwedge_{j \ne i} S_j$
-   * component.
-   *
-   * @param einsumOp Pointer to the Einsum operation where propagation occurs.
-   * @param inputInd Index of the tensor being propagated in this Einsum's
-   * inputs.
-   * @param inputDim Dimension index of the tensor being propagated.
-   * @return The resulting Sparsity Vector after the AND operation.
-   */
-  SparsityVector and_all_operands_einsum(Einsum *einsumOp, int inputInd,
-                                         int inputDim);
-
-  /**
-   * @brief Retrieves the output sparsity component ($S_{out}$) for an Einsum
-   * transfer function.
-   *
-   * This is part of the **Intra-Op/Lateral Propagation** rule.
-   *
-   * @param einsumOp Pointer to the Einsum operation.
-   * @param inputInd Index of the tensor being propagated.
-   * @param inputDim Dimension index of the tensor being propagated.
-   * @return The output Sparsity Vector $S_{out}$ if the dimension is an output
-   * dimension ($Od$), otherwise an empty set.
-   */
-  SparsityVector op_output_sparsity_einsum(Einsum *einsumOp, int inputInd,
-                                           int inputDim);
-
-  /**
-   * @brief General method to propagate sparsity for a dimension during intra-op
-   * analysis, considering a tensor that might be the output of an Add or Einsum
-   * op.
-   *
-   * @param op Pointer to the operation (Add or Einsum) that produced the
-   * tensor.
-   * @param inputInd Index of the tensor being propagated in this Einsum's
-   * inputs.
-   * @param inputDim Dimension index of the tensor being propagated.
-   * @return The propagated Sparsity Vector.
-   */
-  SparsityVector propagate_intra_multiop(OpNodePtr op, int inputInd,
-                                         int inputDim);
-
   /**
    * @brief Calculates the sparsity contribution from a single dimension during
    * propagation.
@@ -245,11 +350,11 @@ public:
    *
    * @param inputInd Index of the input tensor in the current Einsum.
    * @param inputDim Dimension index of the input tensor.
-   * @param indexChar The index variable character (e.g., 'i').
+   * @param indexChar The index variable label (e.g., 'i').
    * @return The resulting Sparsity Vector for the dimension.
    */
   SparsityVector propagate_intra_dimension(int inputInd, int inputDim,
-                                           char indexChar);
+                                           int indexChar);
 
   /**
    * @brief Computes the sparsity vector for an input dimension when propagating
@@ -267,12 +372,34 @@ public:
 
   /**
    * @brief Dispatches to the correct multi-op sparsity computation function
-   * based on operator type.
+   * based on the kind of \p opPtr. Kinds without a rule contribute nothing.
    */
   SparsityVector compute_multiop_sparsity(OpNode *opPtr, int inputInd,
                                           int inputDim);
 
+  /**
+   * @brief Lowers compute_multiop_add_sparsity() as one group of \p program.
+   */
+  void lower_multiop_add_sparsity(Add *opPtr, int inputInd, int inputDim,
+                                  PropagationProgram &program);
+
+  /**
+   * @brief Lowers compute_multiop_einsum_sparsity() as one group of
+   * \p program.
+   */
+  void lower_multiop_einsum_sparsity(Einsum *opPtr, int inputInd, int inputDim,
+                                     PropagationProgram &program);
+
+  /**
+   * @brief Lowers propagate_intra_dimension() for one input dimension: one
+   * instruction with a group per consumer of the input.
+   */
+  void lower_intra_dimension(int inputInd, int inputDim, Direction dir,
+                             PropagationProgram &program);
+
   void propagate(Direction dir) override;
+  std::vector<SparsityUpdate> compute_updates(Direction dir) override;
+  void lower(Direction dir, PropagationProgram &program) override;
   /**
    * @brief Implements the **Forward Propagation** transfer function for Einsum.
    *
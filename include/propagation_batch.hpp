@@ -0,0 +1,76 @@
+/**
+ * @file propagation_batch.hpp
+ * @brief Runs many sparsity scenarios through one graph at once.
+ *
+ * Sweeps over seeds and sparsity ratios analyse the same graph again and again
+ * with different input sparsities. A PropagationBatch keeps up to 64 such
+ * scenarios bit-sliced: for every vector of the graph it stores one word per
+ * bit, holding that bit for all scenarios. The graph's PropagationProgram then
+ * runs over the slices, so each word operation advances every scenario.
+ */
+
+#pragma once
+#include "graph.hpp"
+
+/**
+ * @brief Up to MAX_SCENARIOS independent analyses of one Graph, each with its
+ * own copy of every sparsity vector. The graph's tensors are left untouched.
+ */
+class PropagationBatch {
+public:
+  /// @brief Scenarios held by one batch: one per bit of a word.
+  static constexpr size_t MAX_SCENARIOS = SparsityVector::WORD_BITS;
+
+  /**
+   * @brief Starts every scenario from the current sparsity vectors of
+   * \p graph.
+   * @param graph The graph; its `program` must be lowered and outlive the
+   * batch.
+   * @param numScenarios Number of scenarios, at most MAX_SCENARIOS.
+   */
+  PropagationBatch(const Graph &graph, size_t numScenarios);
+
+  /// @brief Number of scenarios.
+  size_t size() const { return numScenarios; }
+
+  /**
+   * @brief Replaces `tensor.sparsities[dim]` in one scenario.
+   * @param sparsity Must have the length of the graph's vector.
+   */
+  void set_sparsity(size_t scenario, const Tensor &tensor, int dim,
+                    const SparsityVector &sparsity);
+
+  /// @brief Returns `tensor.sparsities[dim]` as seen by one scenario.
+  SparsityVector get_sparsity(size_t scenario, const Tensor &tensor,
+                              int dim) const;
+
+  /**
+   * @brief Runs one sweep in direction \p dir for every scenario, like
+   * Graph::run_propagation(Direction).
+   * @return True if a bit was cleared in any scenario.
+   */
+  bool run_propagation(Direction dir);
+
+  /**
+   * @brief Runs every scenario to the fixed point of Graph::run_propagation().
+   * @param options `maxRounds` caps the rounds; `threads` does not apply.
+   * @return Convergence statistics summed over the scenarios; `opsVisited`
+   * counts instructions.
+   */
+  PropagationStats run_propagation(const PropagationOptions &options = {});
+
+  /// @brief Graph::get_sparsity_ratio() of every scenario.
+  std::vector<float> get_sparsity_ratios() const;
+
+private:
+  /// @brief Set bits of `tensor.sparsities[dim]` in every scenario.
+  std::vector<int> scenario_bits(const Tensor &tensor, int dim) const;
+
+  /// @brief Set bits over all slots and scenarios.
+  size_t count_all() const;
+
+  const Graph &graph;
+  size_t numScenarios;
+  /// @brief slices[slot][j]: bit j of the slot, scenario s in bit s.
+  std::vector<std::vector<SparsityVector::Word>> slices;
+};
@@ -0,0 +1,168 @@
+/**
+ * @file propagation_program.hpp
+ * @brief The sparsity analysis of a graph lowered to a flat instruction list.
+ *
+ * Every transfer function of SPA has the shape
+ *
+ *     dst &= (a0 & a1 & ...) | (b0 & b1 & ...) | ...
+ *
+ * over sparsity vectors, called slots here. Lowering a Graph once into such
+ * instructions removes the per-run index-map lookups, operand searches and
+ * type dispatch of OpNode::propagate(): running the program only does the bit
+ * operations.
+ */
+
+#pragma once
+#include "sparsity_vector.hpp"
+#include "utils.hpp"
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class Tensor;
+
+/**
+ * @brief A lowered sparsity analysis: one instruction list per direction.
+ *
+ * Operands follow the semantics of the transfer functions: an operand shorter
+ * than the destination is zero-extended, a longer one is truncated, and a
+ * group without operands stands for a vector of ones.
+ */
+class PropagationProgram {
+public:
+  /// @brief Removes every instruction and slot.
+  void clear();
+
+  /// @brief Starts the instruction `tensor->sparsities[dim] &= ...` in
+  /// direction \p dir. Groups and sources added next belong to it.
+  void begin_instruction(Direction dir, Tensor *tensor, int dim);
+
+  /// @brief Starts a new AND group, ORed with the other groups of the
+  /// current instruction.
+  void begin_group();
+
+  /// @brief Adds `tensor->sparsities[dim]` to the current AND group.
+  void add_source(Tensor *tensor, int dim);
+
+  /// @brief Number of instructions lowered for \p dir.
+  size_t size(Direction dir) const { return code[dir].size(); }
+
+  /// @brief Number of distinct vectors the program reads or writes.
+  size_t num_slots() const { return slots.size(); }
+
+  /**
+   * @brief Runs the instructions of \p dir in order, with the same effect as
+   * one Graph::run_propagation(Direction) sweep.
+   * @return True if any bit was cleared.
+   */
+  bool run(Direction dir) const;
+
+  /**
+   * @brief Runs the instructions of \p dir over bit-sliced vectors instead of
+   * the tensors' own.
+   *
+   * `slices[slot][j]` holds bit j of the slot for up to 64 independent
+   * analyses, analysis s in bit s, so every word operation advances all of
+   * them at once. A slice has one word per bit of the slot's vector.
+   *
+   * @return True if any bit of any analysis was cleared.
+   */
+  bool run_sliced(Direction dir,
+                  std::vector<std::vector<SparsityVector::Word>> &slices) const;
+
+  /// @brief The slot of `tensor->sparsities[dim]`, or -1 if the program does
+  /// not use it.
+  int find_slot(const Tensor *tensor, int dim) const;
+
+  /// @brief The tensor dimension held by \p slot.
+  const std::pair<Tensor *, int> &slot_vector(size_t slot) const {
+    return slots[slot];
+  }
+
+  /// @brief The vector held by \p slot.
+  SparsityVector &sparsity(uint32_t slot) const;
+
+  // --- single instructions, for solvers that only revisit part of the
+  // program. Instructions are numbered FORWARD first, then INTRA, then
+  // BACKWARD, each in sweep order. ---
+
+  /// @brief Total number of instructions.
+  size_t num_instructions() const {
+    return code[FORWARD].size() + code[INTRA].size() + code[BACKWARD].size();
+  }
+
+  /// @brief Runs instruction \p id. @return True if a bit was cleared.
+  bool run_instruction(size_t id) const;
+
+  /**
+   * @brief Runs instruction \p id while other threads run instructions too.
+   *
+   * Sources are read with relaxed atomic loads and the destination is
+   * narrowed with one atomic fetch_and per word that loses bits, so
+   * concurrent runs never race. Every slot must be dense; \p acc and \p term
+   * are scratch buffers.
+   *
+   * @return The number of bits cleared.
+   */
+  size_t run_instruction_atomic(size_t id,
+                                std::vector<SparsityVector::Word> &acc,
+                                std::vector<SparsityVector::Word> &term) const;
+
+  /// @brief The slot written by instruction \p id.
+  uint32_t destination(size_t id) const { return instruction(id).dst; }
+
+  /// @brief The instructions reading \p slot, in increasing order. The
+  /// first call after lowering builds an index, so it must not race with
+  /// other calls.
+  const std::vector<size_t> &readers(uint32_t slot) const;
+
+  /// @brief The instructions writing \p slot, in increasing order.
+  const std::vector<size_t> &writers(uint32_t slot) const;
+
+private:
+  struct Group {
+    uint32_t begin; ///< first index into `sources`
+    uint32_t end;
+  };
+  struct Instruction {
+    uint32_t dst;        ///< slot written
+    uint32_t groupBegin; ///< first index into `groups`
+    uint32_t groupEnd;
+  };
+
+  uint32_t slot(Tensor *tensor, int dim);
+
+  /// @brief True if a group of \p ins has no source, which makes the
+  /// instruction a no-op.
+  bool has_empty_group(const Instruction &ins) const;
+
+  const Instruction &instruction(size_t id) const;
+
+  /// @brief Fills `readerIndex` and `writerIndex` if they are stale.
+  void index_slots() const;
+
+  /// @brief Runs one instruction; \p acc and \p term are scratch buffers.
+  bool execute(const Instruction &ins, std::vector<SparsityVector::Word> &acc,
+               std::vector<SparsityVector::Word> &term) const;
+
+  /// @brief Runs one instruction on raw words; `operand(slot)` returns the
+  /// words of a source and their number.
+  template <class Operand>
+  bool execute_words(const Instruction &ins, SparsityVector::Word *dst,
+                     size_t n, Operand operand,
+                     std::vector<SparsityVector::Word> &acc,
+                     std::vector<SparsityVector::Word> &term) const;
+
+  std::vector<std::pair<Tensor *, int>> slots;
+  std::unordered_map<const Tensor *, std::vector<uint32_t>> slotOf;
+  std::vector<uint32_t> sources;
+  std::vector<Group> groups;
+  std::vector<Instruction> code[3];
+  /// @brief Direction of the instruction being lowered.
+  Direction currentDir{FORWARD};
+  /// @brief Per slot, the instructions reading and writing it; built on first
+  /// use and dropped whenever instructions are added.
+  mutable std::vector<std::vector<size_t>> readerIndex;
+  mutable std::vector<std::vector<size_t>> writerIndex;
+};
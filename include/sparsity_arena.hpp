@@ -0,0 +1,76 @@
+/**
+ * @file sparsity_arena.hpp
+ * @brief Contiguous storage for the sparsity vectors of a graph.
+ *
+ * Propagation touches the vectors of every tensor of a graph on each pass.
+ * Keeping their words in one cache-aligned slab, instead of one heap block per
+ * vector, keeps that working set compact and lets Graph hand out non-owning
+ * pointers instead of copies.
+ */
+
+#pragma once
+#include "sparsity_vector.hpp"
+#include <cstddef>
+#include <memory>
+
+/**
+ * @brief A bump allocator of SparsityVector words backed by a single slab.
+ *
+ * Every slot starts on a cache line, so two vectors never share one and the
+ * SIMD kernels always see aligned operands. Slots are only released together,
+ * when the arena is destroyed.
+ */
+class SparsityArena {
+public:
+  using Word = SparsityVector::Word;
+  /// @brief Alignment of the slab and of every slot, in bytes.
+  static constexpr size_t ALIGNMENT = 64;
+
+  /**
+   * @brief Allocates a slab able to hold \p words words.
+   * @param words Capacity in words; use slot_words() to size it.
+   */
+  explicit SparsityArena(size_t words);
+  ~SparsityArena();
+
+  SparsityArena(const SparsityArena &) = delete;
+  SparsityArena &operator=(const SparsityArena &) = delete;
+
+  /// @brief Words taken by a slot of \p words words, padding included.
+  static size_t slot_words(size_t words);
+
+  /**
+   * @brief Carves a zeroed slot of \p words words out of the slab.
+   * @return The start of the slot, or nullptr if the slab is full.
+   */
+  Word *allocate(size_t words);
+
+  /**
+   * @brief Moves \p vector into a new slot (see SparsityVector::bind()).
+   *
+   * Compressed vectors are left alone: their runs are already compact, and
+   * binding would force them back to the dense form.
+   *
+   * @return True if the vector was bound.
+   */
+  bool bind(SparsityVector &vector);
+
+  /// @brief Capacity of the slab in words.
+  size_t capacity() const { return capacityWords; }
+
+  /// @brief Words handed out so far, padding included.
+  size_t used() const { return usedWords; }
+
+  /// @brief True if \p ptr points into the slab.
+  bool contains(const Word *ptr) const {
+    return ptr >= slab && ptr < slab + capacityWords;
+  }
+
+private:
+  Word *slab{nullptr};
+  size_t capacityWords{0};
+  size_t usedWords{0};
+};
+
+/// @brief Type alias for a shared pointer to a SparsityArena.
+using SparsityArenaPtr = std::shared_ptr<SparsityArena>;
@@ -0,0 +1,247 @@
+/**
+ * @file sparsity_vector.hpp
+ * @brief Runtime-sized bitvector used as the abstract domain of the Sparsity
+ * Propagation Analysis (SPA).
+ *
+ * A SparsityVector stores one bit per slice of a tensor dimension. Its length
+ * is chosen when the vector is created, so memory and propagation time scale
+ * with the real extent of each dimension instead of a compile-time maximum.
+ *
+ * Vectors are kept either as dense 64-bit words or, for very large dimensions
+ * whose set bits are clustered, as a sorted list of runs of set bits. The
+ * representation is picked per vector from its measured number of runs and
+ * is invisible to callers, except for data(), which needs the dense form.
+ *
+ * A dense vector can also be bound to external storage (see bind()), which is
+ * how Graph packs the vectors of all its tensors into a single arena.
+ */
+
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The core abstract domain element: a bitvector representing the
+ * sparsity of the slices of one tensor dimension.
+ *
+ * Each bit corresponds to a coordinate along one dimension. A set bit ('1')
+ * means the corresponding slice *may* contain non-zero elements. A clear bit
+ * ('0') means the corresponding slice is *structurally zero*.
+ *
+ * Binary operations accept operands of different lengths. Bits past the end of
+ * a vector are treated as '0', matching the zero-extension of `std::bitset`:
+ * `|=` grows the left operand to the longer length, while `&=` keeps the left
+ * operand's length and clears its bits that the right operand does not cover.
+ */
+class SparsityVector {
+public:
+  /// @brief Storage unit of the bitvector.
+  using Word = uint64_t;
+  /// @brief Number of bits held by a single Word.
+  static constexpr size_t WORD_BITS = 64;
+  /// @brief Vectors shorter than this are always dense: their words fit in a
+  /// few cache lines and the run bookkeeping would only add overhead.
+  static constexpr size_t COMPRESSION_MIN_BITS = size_t{1} << 16;
+
+  /// @brief A half-open range [begin, end) of set bits.
+  struct Run {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  /// @brief Constructs an empty (zero-length) vector.
+  SparsityVector() = default;
+
+  /// @brief Copies always own their storage, even when \p other is a view.
+  SparsityVector(const SparsityVector &other);
+
+  /// @brief Moving keeps a view bound to the same storage.
+  SparsityVector(SparsityVector &&other) noexcept;
+
+  /**
+   * @brief Assigns the bits of \p other. A view keeps its binding and
+   * receives the bits in place, decompressed; it cannot change length.
+   */
+  SparsityVector &operator=(const SparsityVector &other);
+
+  SparsityVector &operator=(SparsityVector &&other) noexcept;
+
+  /**
+   * @brief Constructs a vector of \p size bits, all set to \p value.
+   * @param size The extent of the dimension.
+   * @param value The initial value of every bit.
+   */
+  explicit SparsityVector(size_t size, bool value = false);
+
+  /**
+   * @brief Constructs a vector of \p size bits from their dense form.
+   *
+   * Reads num_words_for(\p size) words from \p words, ignoring the bits past
+   * \p size, then picks the representation with optimize(). Use this rather
+   * than writing through data(): vectors of COMPRESSION_MIN_BITS or more
+   * start out compressed.
+   */
+  SparsityVector(size_t size, const Word *words);
+
+  /**
+   * @brief Constructs a vector from a string of '0'/'1' characters.
+   *
+   * Follows the `std::bitset` convention: the last character is bit 0, so
+   * `SparsityVector("01")` has bit 0 set and bit 1 clear.
+   *
+   * @param bits The textual representation; its length is the vector size.
+   */
+  explicit SparsityVector(const std::string &bits);
+
+  /// @brief The number of bits (the extent of the dimension).
+  size_t size() const { return numBits; }
+
+  /// @brief The number of 64-bit words backing the dense form.
+  size_t num_words() const { return num_words_for(numBits); }
+
+  /// @brief The number of words backing the dense form of \p bits bits.
+  static size_t num_words_for(size_t bits) {
+    return (bits + WORD_BITS - 1) / WORD_BITS;
+  }
+
+  /// @brief Read-only access to the backing words. Requires !is_compressed(),
+  /// which does not hold for long vectors fresh from the size constructor.
+  const Word *data() const {
+    assert(!compressed && "data() needs the dense representation");
+    return wordData;
+  }
+
+  /// @brief Mutable access to the backing words. Requires !is_compressed().
+  /// Callers must keep the bits past size() clear.
+  Word *data() {
+    assert(!compressed && "data() needs the dense representation");
+    return wordData;
+  }
+
+  /**
+   * @brief Moves the bits into external storage and makes the vector a view
+   * of it.
+   *
+   * The vector is decompressed first; views always stay dense so their slot
+   * keeps a fixed size. \p storage must hold num_words() words and outlive
+   * every use of the vector.
+   */
+  void bind(Word *storage);
+
+  /// @brief True if the bits live in external storage (see bind()).
+  bool is_view() const { return view; }
+
+  /// @brief True if the vector is currently stored as runs.
+  bool is_compressed() const { return compressed; }
+
+  /// @brief The runs of set bits. Requires is_compressed().
+  const std::vector<Run> &runs() const { return runList; }
+
+  /// @brief Switches to the run representation.
+  void compress();
+
+  /// @brief Switches to the dense representation.
+  void decompress();
+
+  /**
+   * @brief Picks the cheaper representation from the measured number of runs.
+   *
+   * Called after every bulk operation; a no-op for views and for vectors
+   * shorter than COMPRESSION_MIN_BITS.
+   */
+  void optimize();
+
+  /// @brief Bytes used by the current representation.
+  size_t memory_bytes() const;
+
+  /// @brief Returns the value of the bit at \p pos.
+  bool test(size_t pos) const {
+    if (compressed)
+      return test_runs(pos);
+    return (wordData[pos / WORD_BITS] >> (pos % WORD_BITS)) & 1;
+  }
+
+  /// @brief Returns the value of the bit at \p pos.
+  bool operator[](size_t pos) const { return test(pos); }
+
+  /// @brief Sets every bit to '1'.
+  SparsityVector &set();
+
+  /// @brief Sets the bit at \p pos to \p value. Point updates work on the
+  /// dense form, so a compressed vector is decompressed first.
+  SparsityVector &set(size_t pos, bool value = true);
+
+  /// @brief Clears every bit.
+  SparsityVector &reset();
+
+  /// @brief Clears the bit at \p pos.
+  SparsityVector &reset(size_t pos);
+
+  /**
+   * @brief Changes the length of the vector.
+   * @param size The new number of bits.
+   * @param value The value of the bits added when growing.
+   */
+  void resize(size_t size, bool value = false);
+
+  /// @brief Returns the number of set bits.
+  size_t count() const;
+
+  /// @brief Returns the first set bit at or after \p pos, or size() if there
+  /// is none.
+  size_t find_next(size_t pos) const;
+
+  /// @brief Returns true if at least one bit is set.
+  bool any() const;
+
+  /// @brief Returns true if no bit is set.
+  bool none() const { return !any(); }
+
+  /// @brief Returns true if every bit is set.
+  bool all() const { return count() == numBits; }
+
+  SparsityVector &operator&=(const SparsityVector &other);
+  SparsityVector &operator|=(const SparsityVector &other);
+
+  bool operator==(const SparsityVector &other) const;
+  bool operator!=(const SparsityVector &other) const {
+    return !(*this == other);
+  }
+
+  /// @brief Returns the textual representation, with bit 0 as the last
+  /// character (the inverse of the string constructor).
+  std::string to_string() const;
+
+private:
+  /// @brief Clears the unused bits of the last word.
+  void clear_padding();
+
+  /// @brief Binary search for \p pos in runList.
+  bool test_runs(size_t pos) const;
+
+  /// @brief The runs of the vector, whatever its representation.
+  std::vector<Run> to_runs() const;
+
+  /// @brief Copies a view's bits into owned storage and drops the binding.
+  void detach();
+
+  /// @brief Writes the bits of \p other, of the same length, into a view.
+  void assign_in_place(const SparsityVector &other);
+
+  size_t numBits{0};
+  bool compressed{false};
+  bool view{false};
+  /// @brief Dense words: words.data() for owned vectors, the bound storage for
+  /// views, and null while compressed.
+  Word *wordData{nullptr};
+  /// @brief Owned dense storage; empty while compressed or bound.
+  std::vector<Word> words;
+  /// @brief Run form, sorted and non-adjacent; empty while dense.
+  std::vector<Run> runList;
+};
+
+SparsityVector operator&(SparsityVector lhs, const SparsityVector &rhs);
+SparsityVector operator|(SparsityVector lhs, const SparsityVector &rhs);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../include/utils.hpp"
+#include "sparsity_arena.hpp"
 #include "taco.h"
 #include <memory>
 #include <string>
@@ -10,8 +11,54 @@
 class OpNode;
 using OpNodePtr = std::shared_ptr<OpNode>;
 
-// Assume SparsityVector is defined in utils.hpp, likely as a std::bitset or
-// similar structure used for the abstract domain (sparsity bitmaps).
+// SparsityVector (include/sparsity_vector.hpp) is the runtime-sized bitvector
+// used for the abstract domain (sparsity bitmaps).
+
+/**
+ * @brief The TACO level arrays of a tensor whose nonzeros are the Cartesian
+ * product of the set bits of its Sparsity Vectors, in storage (level) order.
+ */
+struct StorageLayout {
+  /// @brief The pos array of each Sparse level; empty for Dense levels.
+  std::vector<std::vector<int>> pos;
+  /// @brief The crd array of each Sparse level; empty for Dense levels.
+  std::vector<std::vector<int>> crd;
+  /// @brief One flag per stored value: 1 if its coordinate is nonzero, 0 for
+  /// the explicit zeros Dense levels store.
+  std::vector<char> nonzero;
+};
+
+/**
+ * @brief Installs \p layout as the storage of \p data, with values
+ * counter_uniform(\p key, linear coordinate) at its nonzeros and 0 at the
+ * explicit zeros of Dense levels.
+ *
+ * The values are written in parallel over disjoint subtrees of the storage,
+ * split at the first level with enough of them to keep every thread busy, so
+ * the result is bit-identical for any \p threads.
+ *
+ * @param data A tensor whose format \p layout was computed for.
+ * @param sizes The dimension sizes of \p data.
+ * @param threads 0 means one per hardware thread. Small layouts are filled
+ * inline.
+ */
+void fill_layout(taco::Tensor<float> &data, const std::vector<int> &sizes,
+                 const StorageLayout &layout, uint64_t key, size_t threads = 0);
+
+/**
+ * @brief The Sparsity Vectors of packed TACO data: bit i of dimension d is set
+ * iff a stored nonzero value has coordinate i along d.
+ *
+ * Walks the level arrays directly (every slot of a Dense level, the pos/crd
+ * ranges of a Sparse one), so the cost is linear in the stored values rather
+ * than in the entries of TACO's generic iterator.
+ *
+ * @param data A packed tensor.
+ * @param threads Threads walking the children of the top level; 0 means one
+ * per hardware thread. Small tensors are walked inline.
+ */
+std::vector<SparsityVector> data_sparsities(const taco::Tensor<float> &data,
+                                            size_t threads = 0);
 
 /**
  * @brief Represents a tensor in the computational graph, encapsulating both its
@@ -31,9 +78,13 @@ public:
   /**
    * @brief The core of the abstract state: A vector of **Sparsity Vectors**
    * (bitmaps), one for each dimension. SparsityVector[i][j] = 0 means the j-th
-   * slice along dimension i is structurally zero (or potentially zero).
+   * slice along dimension i is structurally zero (or potentially zero). Each
+   * vector holds exactly sizes[i] bits.
    */
   std::vector<SparsityVector> sparsities;
+  /// @brief The arena the dense sparsity vectors are bound to once the tensor
+  /// joins a Graph. Held here so the vectors stay valid as long as the tensor.
+  SparsityArenaPtr sparsityArena;
   /// @brief The unique name of the tensor (e.g., "T1", "O1").
   const std::string name;
   /// @brief The size of each dimension.
@@ -44,13 +95,9 @@ public:
   /// @brief Flag indicating if this tensor is an intermediate or final output
   /// tensor in the graph.
   bool outputTensor = false;
-
-  /// @brief A list of operations (OpNodes) for which this tensor is an input.
-  /// Used for Backward and Intra-Op propagation.
-  std::vector<OpNodePtr> inputOps;
-  /// @brief The operation (OpNode) that produces this tensor as its output.
-  /// Used for propagation.
-  OpNodePtr outputOp;
+  /// @brief Set by assemble_data(): the structure of `data` is already
+  /// allocated, so computing it skips TACO's assembly.
+  bool assembled = false;
 
   /**
    * @brief Constructor for abstract tensors, primarily used for intermediate or
@@ -96,6 +143,17 @@ public:
          const std::string &n = "",
          taco::Format format = {taco::Dense, taco::Dense});
 
+  /**
+   * @brief Constructor for an input tensor wrapping existing packed data,
+   * with the exact Sparsity Vectors of its nonzeros.
+   *
+   * @param data The packed TACO tensor; its name and dimensions are taken
+   * over.
+   * @param threads As for data_sparsities().
+   */
+  explicit Tensor(std::shared_ptr<taco::Tensor<float>> data,
+                  size_t threads = 0);
+
   /**
    * @brief Creates the concrete TACO tensor data structure based on the current
    * Sparsity Vectors.
@@ -119,21 +177,41 @@ public:
   void create_data(taco::Format format);
 
   /**
-   * @brief Initializes the concrete tensor data by inserting non-zero values
-   * only for entries where all corresponding dimension slices are marked as
+   * @brief Initializes the concrete tensor data with random values exactly at
+   * the entries where all corresponding dimension slices are marked as
    * non-zero in the `sparsities` vectors (i.e., where all bits are '1').
+   *
+   * The storage is written directly from storage_layout(), in time linear in
+   * the number of stored values, instead of inserting and packing every
+   * coordinate. Each value is counter_uniform() of the tensor's random_key()
+   * and its linear coordinate, so the result is bit-identical for any
+   * \p threads and storage format.
+   *
+   * @param threads Threads filling the values, see fill_layout(); 0 means one
+   * per hardware thread. Small tensors are filled inline.
+   */
+  void initialize_data(size_t threads = 0);
+
+  /**
+   * @brief Computes the level arrays of the concrete data in \p format in
+   * closed form from the Sparsity Vectors.
+   *
+   * A Sparse level holds the set bits of its dimension below every parent
+   * whose coordinates are all set; a Dense level holds every coordinate.
    */
-  void initialize_data();
+  StorageLayout storage_layout(const taco::Format &format) const;
 
   /**
-   * @brief Recursively generates coordinates (indices) for non-zero elements
-   * based on the current state of the Sparsity Vectors.
+   * @brief Allocates the structure of the concrete data from the Sparsity
+   * Vectors, with all values zero, and marks the tensor `assembled`.
+   *
+   * Valid for an output only when its vectors describe the exact structure
+   * TACO's assembly would produce, which always holds for Dense modes.
    */
-  void gen_coord(size_t d, std::vector<std::vector<int>> &indices,
-                 std::vector<int> &positions);
+  void assemble_data();
 
   /// @brief Fills the concrete tensor with random values at the non-zero
-  /// coordinates.
+  /// coordinates; the same as initialize_data() with the default threads.
   void fill_tensor();
 
   /// @brief Prints the tensor's contents as a matrix (only for 2D tensors).
@@ -154,6 +232,13 @@ public:
    */
   float get_sparsity_ratio();
 
+  /**
+   * @brief The ratio get_sparsity_ratio() reports for a tensor of extents
+   * \p sizes whose Sparsity Vectors have \p setBits bits set.
+   */
+  static float get_sparsity_ratio(const std::vector<int> &sizes,
+                                  const std::vector<int> &setBits);
+
   /**
    * @brief Calculates the maximum possible number of non-zero (NNZ) elements
    * based on the intersection of the Sparsity Vectors.
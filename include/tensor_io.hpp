@@ -0,0 +1,49 @@
+/**
+ * @file tensor_io.hpp
+ * @brief Readers for real sparse tensors: FROSTT (.tns) and MatrixMarket
+ * (.mtx) coordinate files.
+ *
+ * The files are memory mapped and split at line boundaries into chunks that
+ * are parsed in parallel, without building a std::string per line. The same
+ * pass records which slices of every dimension hold an entry, so the result
+ * enters SPA with exact Sparsity Vectors instead of synthetic ones.
+ */
+
+#pragma once
+#include "tensor.hpp"
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Reads a FROSTT tensor: one entry per line, a 1-based index per
+ * dimension followed by the value. Lines starting with '#' are comments.
+ *
+ * The rank comes from the first entry and each dimension is as large as its
+ * largest index. Repeated coordinates are summed.
+ *
+ * @param filename The .tns file.
+ * @param format The TACO format of the tensor data; its order must match the
+ * file. An empty format stores every level Sparse.
+ * @param numThreads Parsing threads; 0 means one per hardware thread.
+ * @return A tensor named after the file, with `data` packed and `sparsities`
+ * set to the occupied slices.
+ * @throws std::runtime_error naming the file and line of the first error.
+ */
+TensorPtr read_tns(const std::string &filename,
+                   const taco::Format &format = taco::Format(),
+                   size_t numThreads = 0);
+
+/**
+ * @brief Reads a MatrixMarket coordinate matrix (real, integer or pattern;
+ * general, symmetric or skew-symmetric), as read_tns() does.
+ *
+ * Pattern entries get the value 1; symmetric matrices store both triangles.
+ */
+TensorPtr read_mtx(const std::string &filename,
+                   const taco::Format &format = taco::Format(),
+                   size_t numThreads = 0);
+
+/// @brief read_mtx() for names ending in ".mtx", read_tns() otherwise.
+TensorPtr read_tensor_file(const std::string &filename,
+                           const taco::Format &format = taco::Format(),
+                           size_t numThreads = 0);
@@ -12,5 +12,28 @@ void compare_taco_einsum();
 void test_get_sparsity_ratio();
 void test_init_data();
 void test_einsum_utils();
+void test_einsum_index_lists();
+void test_einsum_parser();
+void test_einsum_dataset();
+void test_graph_snapshot();
+void test_analysis_cache();
+void test_storage_layout();
+void test_coordinate_iterator();
+void test_parallel_fill();
+void test_random_sparse_tensor();
+void test_tensor_io();
+void test_data_sparsities();
 void test_count_bits();
 void test_scalar_computation();
+void test_sparsity_vector();
+void test_bit_kernels();
+void test_compressed_sparsity_vector();
+void test_sparsity_arena();
+void test_fixed_point();
+void test_schedule();
+void test_parallel_propagation();
+void test_propagation_program();
+void test_propagation_batch();
+void test_incremental_propagation();
+void test_graph_edits();
+void test_graph_ownership();
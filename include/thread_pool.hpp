@@ -0,0 +1,58 @@
+/**
+ * @file thread_pool.hpp
+ * @brief A minimal fork-join thread pool for data-parallel loops.
+ */
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A fixed set of worker threads that run parallel_for() loops.
+ *
+ * The calling thread takes part in every loop, so a pool of size 1 has no
+ * workers and runs everything inline. Loops must not be nested.
+ */
+class ThreadPool {
+public:
+  /**
+   * @brief Starts the worker threads.
+   * @param numThreads Threads taking part in each loop, the caller included;
+   * 0 means one per hardware thread.
+   */
+  explicit ThreadPool(size_t numThreads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /// @brief Number of threads taking part in each loop, the caller included.
+  size_t size() const { return workers.size() + 1; }
+
+  /**
+   * @brief Calls \p body(i) for every i in [0, \p n) and waits for all calls
+   * to finish. Iterations are handed out one at a time, so uneven iterations
+   * balance across threads.
+   */
+  void parallel_for(size_t n, const std::function<void(size_t)> &body);
+
+private:
+  void worker_loop();
+  void run_iterations();
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(size_t)> *task{nullptr};
+  size_t taskSize{0};
+  std::atomic<size_t> next{0};
+  size_t active{0};
+  size_t generation{0};
+  bool stopping{false};
+};
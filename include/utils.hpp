@@ -9,33 +9,18 @@
  */
 
 #pragma once
+#include "sparsity_vector.hpp"
 #include "taco.h"
-#include <bitset>
+#include <algorithm>
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
 #include <string>
+#include <utility>
 #include <vector>
 
-// Maximum size for any tensor dimension, used to define the bitset size.
-// Should be a large enough constant to cover all dimensions in the target
-// application.
-#ifndef SIZE_MACRO
-#define SIZE_MACRO 4096
-#endif
-/// @brief The maximum size (extent) for any dimension, setting the length of a
-/// SparsityVector.
-constexpr int MAX_SIZE = SIZE_MACRO;
-
-/**
- * @brief The core abstract domain element: a fixed-size bitset representing the
- * sparsity of a tensor slice.
- *
- * Each bit corresponds to a coordinate along one dimension. A set bit ('1')
- * means the corresponding slice *may* contain non-zero elements. A clear bit
- * ('0') means the corresponding slice is *structurally zero*.
- */
-using SparsityVector = std::bitset<MAX_SIZE>;
-
 /// @brief Defines the direction of sparsity propagation through the
 /// computational graph.
 enum Direction {
@@ -52,16 +37,38 @@ enum Direction {
 /**
  * @brief Counts the number of set bits (non-zero slices) up to a specific
  * position.
- * @param A The SparsityVector (bitset) to check.
- * @param pos The number of elements (up to MAX_SIZE) to check.
+ * @param A The SparsityVector to check.
+ * @param pos The number of elements (up to A.size()) to check.
  * @return The count of set bits (non-zero slices).
  */
-size_t count_bits(SparsityVector A, int pos);
+size_t count_bits(const SparsityVector &A, int pos);
 
 /// @brief Global random seed used for all randomization/shuffling operations
 /// (e.g., for data initialization).
 extern unsigned int SEED;
 
+/**
+ * @brief The key of a counter-based random stream: SEED mixed with a hash of
+ * \p stream (e.g. a tensor name), so equally shaped tensors differ.
+ */
+uint64_t random_key(const std::string &stream);
+
+/**
+ * @brief A counter-based random value in (0, 1], never zero.
+ *
+ * The value is a SplitMix64 hash of \p key and \p counter (e.g. the linear
+ * coordinate of an element), so it does not depend on the order of calls or
+ * on which thread makes them.
+ */
+inline float counter_uniform(uint64_t key, uint64_t counter) {
+  uint64_t z = key + (counter + 1) * 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  // the top 24 bits fill a float mantissa exactly
+  return static_cast<float>((z >> 40) + 1) * (1.0f / (1 << 24));
+}
+
 // --- Tensor Initialization and Filling Functions ---
 
 /**
@@ -114,7 +121,7 @@ std::vector<int> get_indices(std::vector<int> dimSizes, int numElement);
  * @brief Generates a SparsityVector where a given percentage of bits are
  * randomly set to '0' (structurally zero).
  * @param sparsity The ratio of zeroed slices (0.0 to 1.0).
- * @param length The number of elements in the vector (must be <= MAX_SIZE).
+ * @param length The number of elements in the vector.
  * @return The newly created SparsityVector.
  */
 SparsityVector generate_sparsity_vector(double sparsity, int length);
@@ -197,12 +204,136 @@ bool randomBool(double probability = 0.5);
  */
 std::vector<taco::ModeFormatPack> generate_modes(int order, bool sparse);
 
+/**
+ * @brief Replaces the storage of \p data with prebuilt level arrays, skipping
+ * insert() and pack().
+ * @param sizes The dimension sizes of \p data.
+ * @param pos The pos array of each Sparse level, in level order; ignored for
+ * Dense levels.
+ * @param crd The crd array of each Sparse level, in level order.
+ * @param values \p numValues values allocated with malloc; \p data takes
+ * ownership.
+ */
+void set_level_storage(taco::Tensor<float> &data, const std::vector<int> &sizes,
+                       const std::vector<std::vector<int>> &pos,
+                       const std::vector<std::vector<int>> &crd, float *values,
+                       size_t numValues);
+
+/**
+ * @brief Streams elements, sorted in storage order, into the level arrays of a
+ * TACO format, then hands them to the tensor.
+ *
+ * Dense levels keep explicit zeros; repeated coordinates are summed. The pos,
+ * crd and value arrays are malloc'd buffers that TACO takes over as they are,
+ * so memory is that of the packed result and nothing is copied. TACO indexes
+ * them with int32: append() and finish() throw std::runtime_error once a
+ * position or the number of stored values would exceed INT_MAX.
+ */
+class LevelArrayBuilder {
+public:
+  /**
+   * @param sizes The dimension sizes of the tensor.
+   * @param format Its storage format.
+   * @param nnzHint The expected number of elements, used to reserve memory.
+   */
+  LevelArrayBuilder(const std::vector<int> &sizes, const taco::Format &format,
+                    size_t nnzHint = 0);
+
+  /// @brief Adds \p value at \p coord, one coordinate per dimension. The
+  /// element must not precede the previous one in storage order.
+  void append(const int *coord, float value);
+
+  /// @brief Installs the arrays as the storage of \p data, which has the
+  /// builder's sizes and format, and empties the builder. \p data takes
+  /// ownership of the arrays.
+  void finish(taco::Tensor<float> &data);
+
+private:
+  /// @brief A malloc'd array growing by doubling, released to TACO as is.
+  template <typename T> class Buffer {
+  public:
+    Buffer() = default;
+    Buffer(Buffer &&other) noexcept
+        : items(other.items), count(other.count), capacity(other.capacity) {
+      other.items = nullptr;
+      other.count = other.capacity = 0;
+    }
+    Buffer &operator=(Buffer &&other) noexcept {
+      std::swap(items, other.items);
+      std::swap(count, other.count);
+      std::swap(capacity, other.capacity);
+      return *this;
+    }
+    ~Buffer() { std::free(items); }
+
+    size_t size() const { return count; }
+    T &operator[](size_t i) { return items[i]; }
+    T &back() { return items[count - 1]; }
+
+    void reserve(size_t n) {
+      if (n <= capacity)
+        return;
+      T *grown = static_cast<T *>(std::realloc(items, n * sizeof(T)));
+      if (!grown)
+        throw std::bad_alloc();
+      items = grown;
+      capacity = n;
+    }
+    void push_back(T value) {
+      if (count == capacity)
+        reserve(std::max<size_t>(2 * capacity, 16));
+      items[count++] = value;
+    }
+    void resize(size_t n, T value) {
+      if (n > capacity)
+        reserve(std::max(n, 2 * capacity));
+      for (; count < n; ++count)
+        items[count] = value;
+      count = std::min(count, n);
+    }
+
+    /// @brief Gives the array, at least one element long, to the caller.
+    T *release() {
+      reserve(1);
+      T *released = items;
+      items = nullptr;
+      count = capacity = 0;
+      return released;
+    }
+
+  private:
+    T *items{nullptr};
+    size_t count{0};
+    size_t capacity{0};
+  };
+
+  std::vector<int> sizes;
+  std::vector<taco::ModeFormat> modes;
+  std::vector<int> ordering;
+  std::vector<Buffer<int>> pos;
+  std::vector<Buffer<int>> crd;
+  Buffer<float> values;
+  /// @brief The coordinate and position of the previous element per level.
+  std::vector<int> coord;
+  std::vector<uint64_t> position;
+  bool empty{true};
+};
+
 /**
  * @brief Generates a random tensor for a given format and sparsity level.
+ *
+ * The nonzeros are a uniform random subset of the elements, drawn in storage
+ * order by sequential sampling (Vitter's Method D), so coordinates come out
+ * sorted and unique without any rejection or set of seen keys. They are
+ * streamed straight into the level arrays of \p format by a
+ * LevelArrayBuilder.
+ *
  * @param dims The vector of dimension sizes.
  * @param sparsity The sparsity level.
  * @param format The TACO level format (e.g., CSR/CSC).
  * @return A packed TACO tensor.
+ * @throws std::runtime_error If the tensor would store more than INT_MAX
+ * nonzeros or values, the limit of TACO's int32 indices.
  */
 taco::Tensor<float> create_random_sparse_tensor(const std::vector<int> &dims,
                                                 const double sparsity,
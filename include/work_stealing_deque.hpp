@@ -0,0 +1,47 @@
+/**
+ * @file work_stealing_deque.hpp
+ * @brief Lock-free work-stealing deque of task indices.
+ */
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief A fixed-capacity Chase-Lev deque.
+ *
+ * The owning thread pushes and pops at the bottom; any other thread may steal
+ * from the top. No operation blocks. The capacity is fixed, which is enough
+ * for schedulers where every task sits in at most one deque at a time.
+ */
+class WorkStealingDeque {
+public:
+  /// @brief Creates a deque holding up to \p capacity items.
+  explicit WorkStealingDeque(size_t capacity);
+
+  WorkStealingDeque(const WorkStealingDeque &) = delete;
+  WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+  /// @brief Adds \p item at the bottom. Owner only.
+  void push(size_t item);
+
+  /// @brief Takes the most recently pushed item. Owner only.
+  /// @return False if the deque was empty.
+  bool pop(size_t &item);
+
+  /// @brief Takes the oldest item. Any thread.
+  /// @return False if the deque was empty or another thread won the race.
+  bool steal(size_t &item);
+
+private:
+  std::vector<std::atomic<size_t>> buffer;
+  size_t mask;
+  // top is written by thieves and bottom by the owner: keep them on separate
+  // cache lines
+  char padTop[64];
+  std::atomic<int64_t> top{0};
+  char padBottom[64];
+  std::atomic<int64_t> bottom{0};
+};
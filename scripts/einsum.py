@@ -4,27 +4,25 @@ import einsum_benchmark
 import opt_einsum as oe
 
 def convert_einsum_string(einsum_string):
+    """Renames the index variables to a-z, A-Z in order of appearance.
+
+    Expressions with more index variables than letters are written in
+    index-list form instead, e.g. '0 1,1 2->0 2', which Einsum also reads.
+    """
     char_mapping = {}
-    new_string = []
-    valid_chars = [chr(c) for c in range(ord('a'), ord('z') + 1)] \
-            + [chr(c) for c in range(ord('A'), ord('Z') + 1)] + [',', '-', '>']
-    new_char = ord('a')
     for c in einsum_string:
         assert c != ' '
-        if c == ',' or c == '-' or c == '>':
-            new_string.append(c)
-            continue
-        if c in char_mapping:
-            new_string.append(char_mapping[c])
-            continue
-        char_mapping[c] = chr(new_char)
-        new_string.append(char_mapping[c])
-        new_char += 1
-        if new_char == ord('z') + 1:
-            new_char = ord('A')
-        elif new_char == ord('Z') + 1:
-            assert all([ c in valid_chars for c in new_string]), "This expression has too many index variables!"
-    return ''.join(new_string)
+        if c not in ',->' and c not in char_mapping:
+            char_mapping[c] = len(char_mapping)
+    letters = [chr(c) for c in range(ord('a'), ord('z') + 1)] \
+            + [chr(c) for c in range(ord('A'), ord('Z') + 1)]
+    if len(char_mapping) <= len(letters):
+        return ''.join(c if c in ',->' else letters[char_mapping[c]]
+                       for c in einsum_string)
+    lhs, rhs = einsum_string.split('->')
+    def index_list(operand):
+        return ' '.join(str(char_mapping[c]) for c in operand)
+    return ','.join(index_list(op) for op in lhs.split(',')) + '->' + index_list(rhs)
 
 def generate_lists(einsum_string, tensors):
     _, path_info = oe.contract_path(einsum_string, *tensors, optimize='auto')
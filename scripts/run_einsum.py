@@ -38,8 +38,17 @@ def parse_output(output):
             metrics["initial_ratio"] = float(line.split("=")[-1].strip())
     return metrics
 
+def dataset_files():
+    # the instances that parse, read by the benchmark in one process; the
+    # malformed ones are reported and left out of the sweep
+    cmd = [BIN_PATH, "einsum", "dataset", EINSUM_DATASET]
+    result = subprocess.run(cmd, capture_output=True, text=True)
+    for error in result.stderr.strip().splitlines():
+        print(f"skipping {error}")
+    return [line[3:] for line in result.stdout.splitlines() if line.startswith("ok ")]
+
 def run(result_dir: str, sparsity: float, seed: int, n: int, compute: int = 1):
-    files = os.listdir(EINSUM_DATASET)
+    files = dataset_files()
     errors = []
     with open(f"{result_dir}/einsum_result_{sparsity}_{seed}_{n}.csv", "wt") as result_file:
         result_file.write('file_name,format,sparsity,propagate,ratio_before,ratio_after,analysis,load_time,compilation_time,runtime, overall_memory, tensors-size\n')
@@ -73,7 +82,7 @@ def run(result_dir: str, sparsity: float, seed: int, n: int, compute: int = 1):
         error_file.write("\n".join(errors))
 
 def run_prop(result_dir: str, sparsity: float, seed: int, n: int):
-    files = os.listdir(EINSUM_DATASET)
+    files = dataset_files()
     errors = []
     run_fw = 1
     with open(f"{result_dir}/einsum_result_prop_{sparsity}_{seed}_{n}.csv", "wt") as result_file:
@@ -105,6 +114,34 @@ def run_prop(result_dir: str, sparsity: float, seed: int, n: int):
     with open("errors.txt", "wt") as error_file:
         error_file.write("\n".join(errors))
 
+def run_prop_batch(result_dir: str, sparsity: float, seed: int, n: int):
+    # same results as run_prop, with all n seeds analysed by one process
+    files = dataset_files()
+    errors = []
+    run_fw = 1
+    with open(f"{result_dir}/einsum_result_prop_{sparsity}_{seed}_{n}.csv", "wt") as result_file:
+        result_file.write('file_name,sparsity,run_fw,run_lat,run_bw,initial_ratio,fw_ratio,lat_ratio,bw_ratio\n')
+        for idx, file in enumerate(files):
+            file_path = f"{EINSUM_DATASET}/{file}"
+            for run_lat in [0, 1]:
+                for run_bw in [0, 1]:
+                    print(f"[running {idx + 1}/{len(files)}]: {file} - run_fw={run_fw}, run_lat={run_lat}, run_bw={run_bw}")
+                    try:
+                        cmd = [BIN_PATH, "einsum", "prop-batch", file_path, str(sparsity), str(run_fw), str(run_lat), str(run_bw), str(seed), str(n)]
+                        process = subprocess.Popen(cmd, text=True, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+                        process.wait()
+                        metrics = parse_output(process.stdout.read())
+                        mean_metrics = {k: metrics.get(k, 0.0) for k in ["initial_ratio", "fw_ratio", "lat_ratio", "bw_ratio"]}
+                        result_line = f'{file},{sparsity},{run_fw},{run_lat},{run_bw},{mean_metrics["initial_ratio"]},{mean_metrics["fw_ratio"]},{mean_metrics["lat_ratio"]},{mean_metrics["bw_ratio"]}'
+                        result_file.write(result_line + "\n")
+                        result_file.flush()
+                    except Exception as e:
+                        errors.append(file)
+                        print(f"Error running {file_path}: {str(e)}")
+
+    with open("errors.txt", "wt") as error_file:
+        error_file.write("\n".join(errors))
+
 def run_for_sparsities(result_dir: str, seed: int, n: int, compute: int = 1):
     sparsities = [0.9, 0.7, 0.5, 0.3]
     for sparsity in sparsities:
@@ -149,7 +186,7 @@ def run_benchmark_12(result_dir: str, sparsity: float, seed: int, n: int):
 
 def run_with_timeout(result_dir: str, sparsity: float, seed: int, timeout_seconds: int):
     print("Testing benchmarks...")
-    files = os.listdir(EINSUM_DATASET)
+    files = dataset_files()
     propagate = 0
     with open("filter.txt", "wt") as result_file:
         for idx, file in enumerate(files):
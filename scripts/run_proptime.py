@@ -17,16 +17,7 @@ def parse_output(output):
             metrics["proptime"] = float(line.split("=")[-1].strip())
     return metrics
 
-def recompile_spa_size(root_dir: str, build_dir: str, size: int):
-    cmd = ["cmake", "-S" + root_dir, "-B" + build_dir, "-G", "Ninja", f"-DSIZE_MACRO={size}"]
-    process = subprocess.Popen(cmd, text=True, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
-    process.wait()
-    cmd = ["cmake", "--build", build_dir]
-    process = subprocess.Popen(cmd, text=True, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
-    process.wait()
-
 def run_spa(result_dir: str, size: int, n: int):
-    recompile_spa_size(SPA_ROOT, BUILD_DIR, size)
     errors = []
     with open(f"{result_dir}/proptime_spa_result_{size}.csv", "wt") as result_file:
         result_file.write('size,proptime\n')
@@ -34,7 +25,7 @@ def run_spa(result_dir: str, size: int, n: int):
         print(f"[running proptime for SPA size {size}]")
         try:
             for i in range(n):
-                cmd = [BIN_PATH, "proptime"]
+                cmd = [BIN_PATH, "proptime", str(size)]
                 print(f"iteration {i + 1}/{n}",  end="\r")
                 process = subprocess.Popen(cmd, text=True, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
                 process.wait()
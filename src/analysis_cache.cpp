@@ -0,0 +1,323 @@
+#include "../include/analysis_cache.hpp"
+#include "../include/node.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const char ENTRY_MAGIC[8] = {'A', 'D', 'L', 'E', 'T', 'S', 'P', 'A'};
+const uint32_t ENTRY_VERSION = 1;
+const char ENTRY_SUFFIX[] = ".spa";
+
+/// Entry layout: EntryHeader, the size of every vector (uint32_t, padded to
+/// 8 bytes), then the dense words of every vector.
+struct EntryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t numVectors;
+  uint64_t check;
+  uint64_t numWords;
+  uint64_t checksum;
+};
+
+/// A 64-bit hash that only depends on the values added, in order.
+class StableHash {
+public:
+  explicit StableHash(uint64_t seed) : state(mix(seed)) {}
+
+  void add(uint64_t value) {
+    state = (state ^ mix(value)) * 0x100000001b3ULL;
+  }
+
+  void add(const std::string &text) {
+    add(text.size());
+    for (size_t i = 0; i < text.size(); i += 8) {
+      uint64_t chunk = 0;
+      std::memcpy(&chunk, text.data() + i, std::min<size_t>(8, text.size() - i));
+      add(chunk);
+    }
+  }
+
+  void add(const SparsityVector::Word *words, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+      add(words[i]);
+  }
+
+  uint64_t value() const { return mix(state); }
+
+private:
+  // SplitMix64 finalizer
+  static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  uint64_t state;
+};
+
+/// \p sparsity as a dense vector, copying only compressed ones.
+const SparsityVector &dense(const SparsityVector &sparsity,
+                            SparsityVector &scratch) {
+  if (!sparsity.is_compressed())
+    return sparsity;
+  scratch = sparsity;
+  scratch.decompress();
+  return scratch;
+}
+
+size_t sizes_bytes(size_t numVectors) {
+  return (numVectors * sizeof(uint32_t) + 7) & ~size_t{7};
+}
+} // namespace
+
+AnalysisCache::AnalysisCache(std::string directory, uint64_t maxBytes)
+    : directory(std::move(directory)), maxBytes(maxBytes) {
+  mkdir(this->directory.c_str(), 0755);
+}
+
+AnalysisCache::Key AnalysisCache::key(const Graph &g) {
+  StableHash name(1), check(2);
+  auto add = [&](uint64_t value) {
+    name.add(value);
+    check.add(value);
+  };
+  auto tensors = g.get_tensors();
+  std::unordered_map<const Tensor *, uint64_t> index;
+  for (size_t t = 0; t < tensors.size(); ++t)
+    index[tensors[t].get()] = t;
+
+  add(tensors.size());
+  SparsityVector scratch;
+  for (auto &tensor : tensors) {
+    add(tensor->numDims);
+    for (int dim = 0; dim < tensor->numDims; ++dim) {
+      const SparsityVector &sparsity = dense(tensor->sparsities[dim], scratch);
+      add(sparsity.size());
+      name.add(sparsity.data(), sparsity.num_words());
+      check.add(sparsity.data(), sparsity.num_words());
+    }
+  }
+  add(g.nodes.size());
+  for (auto &op : g.nodes) {
+    add(op->kind);
+    if (op->kind == OP_EINSUM) {
+      const std::string &expression =
+          static_cast<const Einsum &>(*op).expression;
+      name.add(expression);
+      check.add(expression);
+    }
+    add(op->inputs.size());
+    for (auto &input : op->inputs)
+      add(index.at(input.get()));
+    add(index.at(op->output.get()));
+  }
+  return {name.value(), check.value()};
+}
+
+std::string AnalysisCache::entry_path(const Key &k) const {
+  char name[17];
+  std::snprintf(name, sizeof(name), "%016llx",
+                static_cast<unsigned long long>(k.name));
+  return directory + "/" + name + ENTRY_SUFFIX;
+}
+
+bool AnalysisCache::load(const Key &k, Graph &g) {
+  const std::string path = entry_path(k);
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    ++stats.misses;
+    return false;
+  }
+  std::string bytes((std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+  file.close();
+
+  auto tensors = g.get_tensors();
+  size_t numVectors = 0;
+  for (auto &tensor : tensors)
+    numVectors += tensor->numDims;
+
+  // every check has to pass before the graph is touched
+  auto corrupt = [&]() {
+    ++stats.corrupt;
+    ++stats.misses;
+    std::remove(path.c_str());
+    return false;
+  };
+  EntryHeader header;
+  if (bytes.size() < sizeof(header))
+    return corrupt();
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  if (!std::equal(std::begin(ENTRY_MAGIC), std::end(ENTRY_MAGIC),
+                  header.magic) ||
+      header.version != ENTRY_VERSION || header.check != k.check ||
+      header.numVectors != numVectors ||
+      header.numWords > bytes.size() / sizeof(SparsityVector::Word) ||
+      bytes.size() != sizeof(header) + sizes_bytes(numVectors) +
+                          header.numWords * sizeof(SparsityVector::Word))
+    return corrupt();
+  const char *sizes = bytes.data() + sizeof(header);
+  const char *wordBytes = sizes + sizes_bytes(numVectors);
+  std::vector<SparsityVector::Word> words(header.numWords);
+  std::memcpy(words.data(), wordBytes,
+              words.size() * sizeof(SparsityVector::Word));
+  StableHash checksum(3);
+  checksum.add(words.data(), words.size());
+  if (checksum.value() != header.checksum)
+    return corrupt();
+
+  std::vector<SparsityVector> vectors;
+  size_t v = 0, w = 0;
+  for (auto &tensor : tensors) {
+    for (int dim = 0; dim < tensor->numDims; ++dim, ++v) {
+      uint32_t size;
+      std::memcpy(&size, sizes + v * sizeof(uint32_t), sizeof(size));
+      if (size != static_cast<uint32_t>(tensor->sizes[dim]))
+        return corrupt();
+      const size_t numWords = SparsityVector::num_words_for(size);
+      if (numWords > words.size() - w)
+        return corrupt();
+      // long vectors start compressed: build them from their words
+      vectors.emplace_back(size, words.data() + w);
+      w += numWords;
+    }
+  }
+  if (w != words.size())
+    return corrupt();
+
+  v = 0;
+  for (auto &tensor : tensors) {
+    for (int dim = 0; dim < tensor->numDims; ++dim) {
+      tensor->sparsities[dim] = vectors[v++];
+      tensor->sparsities[dim].optimize();
+    }
+  }
+  // mark the entry as recently used
+  utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+  ++stats.hits;
+  return true;
+}
+
+void AnalysisCache::store(const Key &k, const Graph &g) {
+  auto tensors = g.get_tensors();
+  std::vector<uint32_t> sizes;
+  std::vector<SparsityVector::Word> words;
+  SparsityVector scratch;
+  for (auto &tensor : tensors) {
+    for (int dim = 0; dim < tensor->numDims; ++dim) {
+      const SparsityVector &sparsity = dense(tensor->sparsities[dim], scratch);
+      sizes.push_back(sparsity.size());
+      words.insert(words.end(), sparsity.data(),
+                   sparsity.data() + sparsity.num_words());
+    }
+  }
+  EntryHeader header{};
+  std::copy(std::begin(ENTRY_MAGIC), std::end(ENTRY_MAGIC), header.magic);
+  header.version = ENTRY_VERSION;
+  header.numVectors = sizes.size();
+  header.check = k.check;
+  header.numWords = words.size();
+  StableHash checksum(3);
+  checksum.add(words.data(), words.size());
+  header.checksum = checksum.value();
+
+  const std::string path = entry_path(k);
+  std::ostringstream temporary;
+  temporary << path << ".tmp." << getpid();
+  {
+    std::ofstream file(temporary.str(), std::ios::binary | std::ios::trunc);
+    if (!file)
+      return;
+    sizes.resize(sizes_bytes(sizes.size()) / sizeof(uint32_t), 0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(sizes.data()),
+               sizes.size() * sizeof(uint32_t));
+    file.write(reinterpret_cast<const char *>(words.data()),
+               words.size() * sizeof(SparsityVector::Word));
+    if (!file) {
+      file.close();
+      std::remove(temporary.str().c_str());
+      return;
+    }
+  }
+  if (std::rename(temporary.str().c_str(), path.c_str()) != 0) {
+    std::remove(temporary.str().c_str());
+    return;
+  }
+  evict();
+}
+
+void AnalysisCache::evict() {
+  struct Entry {
+    std::string path;
+    uint64_t bytes;
+    struct timespec used;
+  };
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  DIR *dir = opendir(directory.c_str());
+  if (!dir)
+    return;
+  const size_t suffixLength = std::strlen(ENTRY_SUFFIX);
+  while (dirent *item = readdir(dir)) {
+    std::string name = item->d_name;
+    if (name.size() <= suffixLength ||
+        name.compare(name.size() - suffixLength, suffixLength,
+                     ENTRY_SUFFIX) != 0)
+      continue;
+    std::string path = directory + "/" + name;
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+      continue;
+    entries.push_back({path, static_cast<uint64_t>(info.st_size), info.st_mtim});
+    total += info.st_size;
+  }
+  closedir(dir);
+  if (total <= maxBytes)
+    return;
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) {
+              return a.used.tv_sec != b.used.tv_sec
+                         ? a.used.tv_sec < b.used.tv_sec
+                         : a.used.tv_nsec < b.used.tv_nsec;
+            });
+  for (auto &entry : entries) {
+    if (total <= maxBytes)
+      break;
+    if (std::remove(entry.path.c_str()) == 0) {
+      total -= entry.bytes;
+      ++stats.evictions;
+    }
+  }
+}
+
+PropagationStats AnalysisCache::run_propagation(
+    Graph &g, const PropagationOptions &options) {
+  const Key k = key(g);
+  auto tensors = g.get_tensors();
+  size_t before = 0;
+  for (auto &tensor : tensors)
+    for (auto &sparsity : tensor->sparsities)
+      before += sparsity.count();
+  if (load(k, g)) {
+    PropagationStats stats;
+    stats.converged = true;
+    for (auto &tensor : tensors)
+      for (auto &sparsity : tensor->sparsities)
+        stats.bitsCleared += sparsity.count();
+    stats.bitsCleared = before - stats.bitsCleared;
+    return stats;
+  }
+  PropagationStats stats = g.run_propagation(options);
+  if (stats.converged)
+    store(k, g);
+  return stats;
+}
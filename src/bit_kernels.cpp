@@ -0,0 +1,406 @@
+#include "../include/bit_kernels.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPA_X86_KERNELS 1
+#endif
+
+namespace {
+
+// --- scalar ---
+
+void and_words_scalar(uint64_t *dst, const uint64_t *src, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    dst[i] &= src[i];
+}
+
+void or_words_scalar(uint64_t *dst, const uint64_t *src, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    dst[i] |= src[i];
+}
+
+bool and_changed_words_scalar(uint64_t *dst, const uint64_t *src, size_t n) {
+  uint64_t cleared = 0;
+  for (size_t i = 0; i < n; ++i) {
+    cleared |= dst[i] & ~src[i];
+    dst[i] &= src[i];
+  }
+  return cleared != 0;
+}
+
+size_t popcount_words_scalar(const uint64_t *src, size_t n) {
+  size_t bits = 0;
+  for (size_t i = 0; i < n; ++i)
+    bits += __builtin_popcountll(src[i]);
+  return bits;
+}
+
+size_t and_popcount_words_scalar(const uint64_t *a, const uint64_t *b,
+                                 size_t n) {
+  size_t bits = 0;
+  for (size_t i = 0; i < n; ++i)
+    bits += __builtin_popcountll(a[i] & b[i]);
+  return bits;
+}
+
+const BitKernels scalarKernels{"scalar",
+                               and_words_scalar,
+                               or_words_scalar,
+                               and_changed_words_scalar,
+                               popcount_words_scalar,
+                               and_popcount_words_scalar};
+
+#ifdef SPA_X86_KERNELS
+
+// --- AVX2: 4 words per vector ---
+
+#define SPA_AVX2 __attribute__((target("avx2,popcnt")))
+
+SPA_AVX2 void and_words_avx2(uint64_t *dst, const uint64_t *src, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i *>(dst + i));
+    __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                        _mm256_and_si256(d, s));
+  }
+  for (; i < n; ++i)
+    dst[i] &= src[i];
+}
+
+SPA_AVX2 void or_words_avx2(uint64_t *dst, const uint64_t *src, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i *>(dst + i));
+    __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                        _mm256_or_si256(d, s));
+  }
+  for (; i < n; ++i)
+    dst[i] |= src[i];
+}
+
+SPA_AVX2 bool and_changed_words_avx2(uint64_t *dst, const uint64_t *src,
+                                     size_t n) {
+  __m256i cleared = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i *>(dst + i));
+    __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    cleared = _mm256_or_si256(cleared, _mm256_andnot_si256(s, d));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                        _mm256_and_si256(d, s));
+  }
+  uint64_t tail = 0;
+  for (; i < n; ++i) {
+    tail |= dst[i] & ~src[i];
+    dst[i] &= src[i];
+  }
+  return !_mm256_testz_si256(cleared, cleared) || tail != 0;
+}
+
+// Nibble lookup popcount (Mula et al.): per-byte counts are accumulated with
+// vpshufb and folded into 64-bit lanes with vpsadbw.
+SPA_AVX2 inline __m256i popcount_bytes_avx2(__m256i v) {
+  const __m256i lookup =
+      _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1,
+                       2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i lowMask = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_and_si256(v, lowMask);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+  __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                   _mm256_shuffle_epi8(lookup, hi));
+  return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+SPA_AVX2 inline size_t sum_lanes_avx2(__m256i acc) {
+  return _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+         _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+}
+
+SPA_AVX2 size_t popcount_words_avx2(const uint64_t *src, size_t n) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    acc = _mm256_add_epi64(acc, popcount_bytes_avx2(s));
+  }
+  size_t bits = sum_lanes_avx2(acc);
+  for (; i < n; ++i)
+    bits += _mm_popcnt_u64(src[i]);
+  return bits;
+}
+
+SPA_AVX2 size_t and_popcount_words_avx2(const uint64_t *a, const uint64_t *b,
+                                        size_t n) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+    acc = _mm256_add_epi64(acc, popcount_bytes_avx2(_mm256_and_si256(x, y)));
+  }
+  size_t bits = sum_lanes_avx2(acc);
+  for (; i < n; ++i)
+    bits += _mm_popcnt_u64(a[i] & b[i]);
+  return bits;
+}
+
+const BitKernels avx2Kernels{"avx2",
+                             and_words_avx2,
+                             or_words_avx2,
+                             and_changed_words_avx2,
+                             popcount_words_avx2,
+                             and_popcount_words_avx2};
+
+// --- AVX-512: 8 words per vector, masked tails ---
+// GCC defines _mm512_andnot_si512, _mm512_broadcast_i32x4 and
+// _mm512_reduce_add_epi64 on undefined registers, which trips
+// -Wmaybe-uninitialized; the kernels below do without them.
+
+#define SPA_AVX512 __attribute__((target("avx512f,avx512bw,popcnt")))
+
+SPA_AVX512 inline __mmask8 tail_mask(size_t rest) {
+  return static_cast<__mmask8>((1u << rest) - 1);
+}
+
+SPA_AVX512 void and_words_avx512(uint64_t *dst, const uint64_t *src,
+                                 size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i d = _mm512_loadu_si512(dst + i);
+    __m512i s = _mm512_loadu_si512(src + i);
+    _mm512_storeu_si512(dst + i, _mm512_and_si512(d, s));
+  }
+  if (i < n) {
+    __mmask8 m = tail_mask(n - i);
+    __m512i d = _mm512_maskz_loadu_epi64(m, dst + i);
+    __m512i s = _mm512_maskz_loadu_epi64(m, src + i);
+    _mm512_mask_storeu_epi64(dst + i, m, _mm512_and_si512(d, s));
+  }
+}
+
+SPA_AVX512 void or_words_avx512(uint64_t *dst, const uint64_t *src, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i d = _mm512_loadu_si512(dst + i);
+    __m512i s = _mm512_loadu_si512(src + i);
+    _mm512_storeu_si512(dst + i, _mm512_or_si512(d, s));
+  }
+  if (i < n) {
+    __mmask8 m = tail_mask(n - i);
+    __m512i d = _mm512_maskz_loadu_epi64(m, dst + i);
+    __m512i s = _mm512_maskz_loadu_epi64(m, src + i);
+    _mm512_mask_storeu_epi64(dst + i, m, _mm512_or_si512(d, s));
+  }
+}
+
+SPA_AVX512 bool and_changed_words_avx512(uint64_t *dst, const uint64_t *src,
+                                         size_t n) {
+  __m512i cleared = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i d = _mm512_loadu_si512(dst + i);
+    __m512i s = _mm512_loadu_si512(src + i);
+    __m512i r = _mm512_and_si512(d, s);
+    cleared = _mm512_or_si512(cleared, _mm512_xor_si512(d, r));
+    _mm512_storeu_si512(dst + i, r);
+  }
+  if (i < n) {
+    __mmask8 m = tail_mask(n - i);
+    __m512i d = _mm512_maskz_loadu_epi64(m, dst + i);
+    __m512i s = _mm512_maskz_loadu_epi64(m, src + i);
+    __m512i r = _mm512_and_si512(d, s);
+    cleared = _mm512_or_si512(cleared, _mm512_xor_si512(d, r));
+    _mm512_mask_storeu_epi64(dst + i, m, r);
+  }
+  return _mm512_test_epi64_mask(cleared, cleared) != 0;
+}
+
+// AVX-512 without VPOPCNTDQ: same nibble lookup as AVX2 on 64-byte vectors.
+SPA_AVX512 inline __m512i popcount_bytes_avx512(__m512i v) {
+  // bytes 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 in every lane
+  const __m512i lookup =
+      _mm512_set4_epi32(0x04030302, 0x03020201, 0x03020201, 0x02010100);
+  const __m512i lowMask = _mm512_set1_epi8(0x0f);
+  __m512i lo = _mm512_and_si512(v, lowMask);
+  __m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), lowMask);
+  __m512i counts = _mm512_add_epi8(_mm512_shuffle_epi8(lookup, lo),
+                                   _mm512_shuffle_epi8(lookup, hi));
+  return _mm512_sad_epu8(counts, _mm512_setzero_si512());
+}
+
+SPA_AVX512 inline size_t sum_lanes_avx512(__m512i acc) {
+  uint64_t lanes[8];
+  _mm512_storeu_si512(lanes, acc);
+  size_t sum = 0;
+  for (uint64_t lane : lanes)
+    sum += lane;
+  return sum;
+}
+
+SPA_AVX512 size_t popcount_words_avx512(const uint64_t *src, size_t n) {
+  __m512i acc = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    acc = _mm512_add_epi64(acc,
+                           popcount_bytes_avx512(_mm512_loadu_si512(src + i)));
+  if (i < n) {
+    __m512i s = _mm512_maskz_loadu_epi64(tail_mask(n - i), src + i);
+    acc = _mm512_add_epi64(acc, popcount_bytes_avx512(s));
+  }
+  return sum_lanes_avx512(acc);
+}
+
+SPA_AVX512 size_t and_popcount_words_avx512(const uint64_t *a,
+                                            const uint64_t *b, size_t n) {
+  __m512i acc = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i x = _mm512_loadu_si512(a + i);
+    __m512i y = _mm512_loadu_si512(b + i);
+    acc = _mm512_add_epi64(acc, popcount_bytes_avx512(_mm512_and_si512(x, y)));
+  }
+  if (i < n) {
+    __mmask8 m = tail_mask(n - i);
+    __m512i x = _mm512_maskz_loadu_epi64(m, a + i);
+    __m512i y = _mm512_maskz_loadu_epi64(m, b + i);
+    acc = _mm512_add_epi64(acc, popcount_bytes_avx512(_mm512_and_si512(x, y)));
+  }
+  return sum_lanes_avx512(acc);
+}
+
+const BitKernels avx512Kernels{"avx512",
+                               and_words_avx512,
+                               or_words_avx512,
+                               and_changed_words_avx512,
+                               popcount_words_avx512,
+                               and_popcount_words_avx512};
+
+#endif // SPA_X86_KERNELS
+
+bool supported(const std::string &name) {
+  if (name == "scalar")
+    return true;
+#ifdef SPA_X86_KERNELS
+  __builtin_cpu_init();
+  if (name == "avx2")
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+  if (name == "avx512")
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw") &&
+           __builtin_cpu_supports("popcnt");
+#endif
+  return false;
+}
+
+const BitKernels *kernels_by_name(const std::string &name) {
+  if (!supported(name))
+    return nullptr;
+  if (name == "scalar")
+    return &scalarKernels;
+#ifdef SPA_X86_KERNELS
+  if (name == "avx2")
+    return &avx2Kernels;
+  if (name == "avx512")
+    return &avx512Kernels;
+#endif
+  return nullptr;
+}
+
+const BitKernels *select_kernels() {
+  if (const char *forced = std::getenv("SPA_BIT_KERNELS"))
+    if (const BitKernels *k = kernels_by_name(forced))
+      return k;
+  for (const char *name : {"avx512", "avx2"})
+    if (const BitKernels *k = kernels_by_name(name))
+      return k;
+  return &scalarKernels;
+}
+
+// Read by every propagation thread, so the pointer is atomic. The tables it
+// points to are constant, so relaxed ordering is enough.
+std::atomic<const BitKernels *> &current_kernels() {
+  static std::atomic<const BitKernels *> kernels{select_kernels()};
+  return kernels;
+}
+
+} // namespace
+
+const BitKernels &bit_kernels() {
+  return *current_kernels().load(std::memory_order_relaxed);
+}
+
+bool set_bit_kernels(const std::string &name) {
+  const BitKernels *k = kernels_by_name(name);
+  if (!k)
+    return false;
+  current_kernels().store(k, std::memory_order_relaxed);
+  return true;
+}
+
+std::vector<std::string> available_bit_kernels() {
+  std::vector<std::string> names;
+  for (const char *name : {"scalar", "avx2", "avx512"})
+    if (supported(name))
+      names.push_back(name);
+  return names;
+}
+
+void and_all(SparsityVector &dst,
+             const std::vector<const SparsityVector *> &srcs) {
+  const BitKernels &k = bit_kernels();
+  for (const SparsityVector *src : srcs) {
+    if (dst.is_compressed() || src->is_compressed()) {
+      dst &= *src;
+      continue;
+    }
+    size_t common = std::min(dst.num_words(), src->num_words());
+    k.and_words(dst.data(), src->data(), common);
+    std::fill(dst.data() + common, dst.data() + dst.num_words(), 0);
+  }
+  dst.optimize();
+}
+
+void or_all(SparsityVector &dst,
+            const std::vector<const SparsityVector *> &srcs) {
+  const BitKernels &k = bit_kernels();
+  for (const SparsityVector *src : srcs) {
+    if (src->size() > dst.size())
+      dst.resize(src->size());
+    if (dst.is_compressed() || src->is_compressed()) {
+      dst |= *src;
+      continue;
+    }
+    k.or_words(dst.data(), src->data(), src->num_words());
+  }
+  dst.optimize();
+}
+
+bool and_changed(SparsityVector &dst, const SparsityVector &src) {
+  if (dst.is_compressed() || src.is_compressed()) {
+    // bits are only ever cleared, so a change shows up in the count
+    size_t before = dst.count();
+    dst &= src;
+    return dst.count() != before;
+  }
+  const BitKernels &k = bit_kernels();
+  size_t common = std::min(dst.num_words(), src.num_words());
+  bool changed = k.and_changed_words(dst.data(), src.data(), common);
+  for (size_t i = common; i < dst.num_words(); ++i) {
+    changed |= dst.data()[i] != 0;
+    dst.data()[i] = 0;
+  }
+  dst.optimize();
+  return changed;
+}
+
+size_t and_count(const SparsityVector &a, const SparsityVector &b) {
+  if (a.is_compressed() || b.is_compressed())
+    return (a & b).count();
+  return bit_kernels().and_popcount_words(
+      a.data(), b.data(), std::min(a.num_words(), b.num_words()));
+}
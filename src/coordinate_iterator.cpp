@@ -0,0 +1,26 @@
+#include "../include/coordinate_iterator.hpp"
+#include <algorithm>
+
+CoordinateIterator::CoordinateIterator(
+    const std::vector<SparsityVector> &sparsities)
+    : sparsities(sparsities), first(sparsities.size()) {
+  for (size_t dim = 0; dim < sparsities.size(); ++dim) {
+    size_t bit = sparsities[dim].find_next(0);
+    if (bit == sparsities[dim].size())
+      done = true;
+    first[dim] = static_cast<int>(bit);
+  }
+  coord = first;
+}
+
+void CoordinateIterator::next() {
+  for (size_t dim = coord.size(); dim-- > 0;) {
+    size_t bit = sparsities[dim].find_next(coord[dim] + 1);
+    if (bit < sparsities[dim].size()) {
+      coord[dim] = static_cast<int>(bit);
+      std::copy(first.begin() + dim + 1, first.end(), coord.begin() + dim + 1);
+      return;
+    }
+  }
+  done = true;
+}
@@ -1,62 +1,211 @@
 #include "../include/einsum.hpp"
 #include "../include/graph.hpp"
+#include "../include/mapped_file.hpp"
 #include "../include/node.hpp"
 #include "../include/tensor.hpp"
+#include "../include/thread_pool.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <dirent.h>
 #include <fstream>
-#include <regex>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 
 #include "taco/format.h"
 
-std::vector<std::pair<int, int>> get_contraction_path(const std::string &line) {
-  std::vector<std::pair<int, int>> result;
+namespace {
+/**
+ * Single-pass reader over the text of a dataset file. Each line holds a Python
+ * list literal; errors report the position as "source:line:column".
+ */
+class DatasetCursor {
+public:
+  DatasetCursor(const char *begin, const char *end, const std::string &source)
+      : pos(begin), end(end), lineStart(begin), source(source) {}
 
-  size_t pos = 0;
-  while ((pos = line.find('(', pos)) != std::string::npos) {
-    size_t comma = line.find(',', pos);
-    size_t close = line.find(')', pos);
+  [[noreturn]] void fail(const std::string &what) const {
+    std::ostringstream message;
+    message << source << ":" << line << ":" << (pos - lineStart + 1) << ": "
+            << what;
+    throw std::runtime_error(message.str());
+  }
 
-    int first = std::stoi(line.substr(pos + 1, comma - pos - 1));
-    int second = std::stoi(line.substr(comma + 1, close - comma - 1));
-    result.emplace_back(first, second);
-    pos = close + 1;
+  void skip_spaces() {
+    while (pos != end && (*pos == ' ' || *pos == '\t'))
+      ++pos;
+  }
+
+  /// Skips spaces, then consumes \p c if it is next.
+  bool accept(char c) {
+    skip_spaces();
+    if (pos == end || *pos != c)
+      return false;
+    ++pos;
+    return true;
+  }
+
+  void expect(char c) {
+    if (!accept(c))
+      fail(std::string("expected '") + c + "'" + found());
+  }
+
+  int read_int() {
+    skip_spaces();
+    if (pos == end || *pos < '0' || *pos > '9')
+      fail("expected a non-negative integer" + found());
+    long long value = 0;
+    while (pos != end && *pos >= '0' && *pos <= '9') {
+      value = value * 10 + (*pos++ - '0');
+      if (value > std::numeric_limits<int>::max())
+        fail("integer out of range");
+    }
+    return static_cast<int>(value);
+  }
+
+  std::string read_quoted() {
+    skip_spaces();
+    if (pos == end || (*pos != '\'' && *pos != '"'))
+      fail("expected a quoted einsum string" + found());
+    const char quote = *pos++;
+    const char *first = pos;
+    while (pos != end && *pos != quote && *pos != '\n')
+      ++pos;
+    if (pos == end || *pos != quote)
+      fail("unterminated string");
+    return std::string(first, pos++);
   }
+
+  /// Parses "[item, item, ...]" with an optional trailing comma.
+  template <typename Item> void read_list(Item item) {
+    expect('[');
+    while (!accept(']')) {
+      item();
+      if (!accept(',')) {
+        expect(']');
+        break;
+      }
+    }
+  }
+
+  /// Consumes the rest of the line, which may only hold whitespace.
+  void end_line() {
+    skip_spaces();
+    if (pos != end && *pos == '\r')
+      ++pos;
+    if (pos == end)
+      return;
+    if (*pos != '\n')
+      fail("unexpected" + found());
+    ++pos;
+    ++line;
+    lineStart = pos;
+  }
+
+  bool at_end() {
+    while (pos != end && std::isspace(static_cast<unsigned char>(*pos)))
+      ++pos;
+    return pos == end;
+  }
+
+private:
+  std::string found() const {
+    if (pos == end)
+      return ", found end of input";
+    if (*pos == '\n' || *pos == '\r')
+      return ", found end of line";
+    return std::string(", found '") + *pos + "'";
+  }
+
+  const char *pos;
+  const char *end;
+  const char *lineStart;
+  const std::string &source;
+  int line{1};
+};
+
+std::vector<std::pair<int, int>> read_contraction_path(DatasetCursor &cursor) {
+  std::vector<std::pair<int, int>> result;
+  cursor.read_list([&] {
+    cursor.expect('(');
+    int first = cursor.read_int();
+    cursor.expect(',');
+    int second = cursor.read_int();
+    cursor.expect(')');
+    result.emplace_back(first, second);
+  });
   return result;
 }
 
-std::vector<std::string> get_contraction_strings(const std::string &line) {
+std::vector<std::string> read_contraction_strings(DatasetCursor &cursor) {
   std::vector<std::string> result;
-
-  size_t pos = 0;
-  while ((pos = line.find('\'', pos)) != std::string::npos) {
-    size_t close = line.find('\'', pos + 1);
-    std::string einsumString = line.substr(pos + 1, close - pos - 1);
-    result.emplace_back(einsumString);
-    pos = close + 1;
-  }
+  cursor.read_list([&] { result.push_back(cursor.read_quoted()); });
   return result;
 }
 
-std::vector<std::vector<int>> get_tensor_sizes(const std::string &line) {
+std::vector<std::vector<int>> read_tensor_sizes(DatasetCursor &cursor) {
   std::vector<std::vector<int>> result;
-  std::regex tupleRegex(R"(\(([^()]*)\))");
-  std::string s = line;
-
-  std::smatch match;
-  while (std::regex_search(s, match, tupleRegex)) {
-    std::string content = match[1].str();
+  cursor.read_list([&] {
+    // Python tuples: "()", "(5,)", "(3, 4)"
     std::vector<int> sizes;
-    std::stringstream ss(content);
-    std::string number;
-
-    while (std::getline(ss, number, ',')) {
-      number.erase(remove_if(number.begin(), number.end(), isspace),
-                   number.end());
-      sizes.push_back(std::stoi(number));
+    cursor.expect('(');
+    while (!cursor.accept(')')) {
+      sizes.push_back(cursor.read_int());
+      if (!cursor.accept(',')) {
+        cursor.expect(')');
+        break;
+      }
     }
+    result.push_back(std::move(sizes));
+  });
+  return result;
+}
 
-    result.push_back(sizes);
-    s = match.suffix();
-  }
+/// Runs \p read over a whole line.
+template <typename Read> auto read_line(const std::string &line, Read read) {
+  const std::string source = "<line>";
+  DatasetCursor cursor(line.data(), line.data() + line.size(), source);
+  auto result = read(cursor);
+  cursor.end_line();
+  if (!cursor.at_end())
+    cursor.fail("unexpected text after the list");
+  return result;
+}
+} // namespace
+
+std::vector<std::pair<int, int>> get_contraction_path(const std::string &line) {
+  return read_line(line, read_contraction_path);
+}
+
+std::vector<std::string> get_contraction_strings(const std::string &line) {
+  return read_line(line, read_contraction_strings);
+}
+
+std::vector<std::vector<int>> get_tensor_sizes(const std::string &line) {
+  return read_line(line, read_tensor_sizes);
+}
+
+EinsumBenchmark parse_einsum_benchmark(const std::string &text,
+                                       const std::string &source) {
+  DatasetCursor cursor(text.data(), text.data() + text.size(), source);
+  EinsumBenchmark result;
+  result.path = read_contraction_path(cursor);
+  cursor.end_line();
+  result.strings = read_contraction_strings(cursor);
+  cursor.end_line();
+  result.sizes = read_tensor_sizes(cursor);
+  cursor.end_line();
+  if (!cursor.at_end())
+    cursor.fail("unexpected text after the tensor sizes");
+  if (result.path.size() != result.strings.size())
+    throw std::runtime_error(source + ": " +
+                             std::to_string(result.path.size()) +
+                             " contractions but " +
+                             std::to_string(result.strings.size()) +
+                             " einsum strings");
   return result;
 }
 
@@ -78,10 +227,10 @@ std::vector<std::string> extract_inputs(std::string const &einsumString) {
   return inputs;
 }
 
-std::unordered_map<char, int>
-construct_size_map(std::vector<std::string> const &inputs,
+std::unordered_map<int, int>
+construct_size_map(std::vector<std::vector<int>> const &inputs,
                    std::vector<std::vector<int>> const &tensorSizes) {
-  std::unordered_map<char, int> sizeMap;
+  std::unordered_map<int, int> sizeMap;
 
   for (int i = 0; i < tensorSizes.size(); ++i) {
     for (int j = 0; j < tensorSizes[i].size(); ++j) {
@@ -96,13 +245,12 @@ construct_size_map(std::vector<std::string> const &inputs,
 std::vector<int> deduceOutputDims(std::string const &einsumString,
                                   std::vector<int> const &sizes1,
                                   std::vector<int> const &sizes2) {
-  std::string output = extract_outputs(einsumString);
-  std::vector<std::string> inputs = extract_inputs(einsumString);
-  std::unordered_map<char, int> sizeMap =
-      construct_size_map(inputs, {sizes2, sizes1});
+  EinsumLabels labels = parse_einsum_labels(einsumString);
+  std::unordered_map<int, int> sizeMap =
+      construct_size_map(labels.inputs, {sizes2, sizes1});
   std::vector<int> outputSizes;
 
-  for (auto indVar : output)
+  for (auto indVar : labels.output)
     outputSizes.push_back(sizeMap[indVar]);
 
   return outputSizes;
@@ -124,6 +272,37 @@ generate_modes(int order, std::vector<int> sizes,
   return modes;
 }
 
+std::vector<std::vector<SparsityVector>>
+generate_input_sparsities(const std::vector<std::vector<int>> &tensorSizes,
+                          const std::vector<std::pair<int, int>> &contractionInds,
+                          const double sparsity) {
+  // every input starts dense; each contraction prunes its first operand that
+  // is an input, or else its second
+  std::vector<std::vector<SparsityVector>> sparsities;
+  for (auto &dims : tensorSizes) {
+    sparsities.emplace_back();
+    for (int dim : dims)
+      sparsities.back().push_back(SparsityVector(dim, true));
+  }
+  // the input held at each stack position, or -1 for an op output
+  std::vector<int> stack(tensorSizes.size());
+  std::iota(stack.begin(), stack.end(), 0);
+  for (auto &contraction : contractionInds) {
+    int ind1 = std::min(contraction.first, contraction.second);
+    int ind2 = std::max(contraction.first, contraction.second);
+    const int pruned = stack[ind1] != -1 ? stack[ind1] : stack[ind2];
+    if (pruned != -1) {
+      sparsities[pruned].clear();
+      for (int dim : tensorSizes[pruned])
+        sparsities[pruned].push_back(generate_sparsity_vector(sparsity, dim));
+    }
+    stack.erase(stack.begin() + ind2);
+    stack.erase(stack.begin() + ind1);
+    stack.push_back(-1);
+  }
+  return sparsities;
+}
+
 Graph build_tree(const std::vector<std::vector<int>> &tensorSizes,
                  const std::vector<std::string> &contractionStrings,
                  const std::vector<std::pair<int, int>> &contractionInds,
@@ -132,10 +311,13 @@ Graph build_tree(const std::vector<std::vector<int>> &tensorSizes,
   std::vector<TensorPtr> tensorStack;
   std::vector<OpNodePtr> ops;
   // construct tensors based on tensorSizes
+  auto inputSparsities =
+      generate_input_sparsities(tensorSizes, contractionInds, sparsity);
   int ind = 1;
-  for (auto dims : tensorSizes) {
-    auto newTensor =
-        std::make_shared<Tensor>(dims, "T" + std::to_string(ind++));
+  for (size_t k = 0; k < tensorSizes.size(); ++k) {
+    auto newTensor = std::make_shared<Tensor>(tensorSizes[k],
+                                              std::move(inputSparsities[k]),
+                                              "T" + std::to_string(ind++));
     inputTensors.push_back(newTensor);
     tensorStack.push_back(newTensor);
   }
@@ -148,24 +330,6 @@ Graph build_tree(const std::vector<std::vector<int>> &tensorSizes,
     int ind2 = contractionInds[i].first > contractionInds[i].second
                    ? contractionInds[i].first
                    : contractionInds[i].second;
-    auto t1 = tensorStack[ind1];
-    auto t2 = tensorStack[ind2];
-
-    bool prune = false;
-    if (!t1->outputTensor) {
-      std::vector<SparsityVector> sparsityVectors;
-      for (auto dim : t1->sizes) {
-        sparsityVectors.push_back(generate_sparsity_vector(sparsity, dim));
-      }
-      t1->sparsities = sparsityVectors;
-      prune = true;
-    } else if (!t2->outputTensor && !prune) {
-      std::vector<SparsityVector> sparsityVectors;
-      for (auto dim : t2->sizes) {
-        sparsityVectors.push_back(generate_sparsity_vector(sparsity, dim));
-      }
-      t2->sparsities = sparsityVectors;
-    }
 
     std::vector<int> outputDims =
         deduceOutputDims(contractionStrings[i], tensorStack[ind1]->sizes,
@@ -190,26 +354,320 @@ Graph build_tree(const std::vector<std::vector<int>> &tensorSizes,
   return Graph::build_graph(inputTensors, tensorStack[0], ops);
 }
 
+namespace {
+// Snapshot layout: SnapshotHeader, then the arrays below in this order, each
+// starting on an 8-byte boundary: tensors, dims, ops, operands (uint32_t
+// tensor indices), inputs (uint32_t tensor indices), words (uint64_t) and
+// chars (names and expressions).
+const char SNAPSHOT_MAGIC[8] = {'A', 'D', 'L', 'E', 'T', 'S', 'N', 'P'};
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t numTensors;
+  uint32_t numDims;
+  uint32_t numOps;
+  uint32_t numOperands;
+  uint32_t numInputs;
+  /// index of the graph's output tensor
+  uint32_t output;
+  uint64_t numWords;
+  uint64_t numChars;
+};
+
+struct SnapshotTensor {
+  uint32_t nameBegin;
+  uint32_t nameLength;
+  uint32_t firstDim;
+  uint32_t numDims;
+};
+
+struct SnapshotDim {
+  uint64_t firstWord;
+  uint32_t size;
+  uint32_t reserved;
+};
+
+struct SnapshotOp {
+  uint32_t kind;
+  uint32_t expressionBegin;
+  uint32_t expressionLength;
+  uint32_t firstOperand;
+  uint32_t numOperands;
+  uint32_t output;
+};
+
+size_t align8(size_t bytes) { return (bytes + 7) & ~size_t{7}; }
+
+/// Byte offsets of the arrays following the header.
+struct SnapshotLayout {
+  size_t tensors, dims, ops, operands, inputs, words, chars, total;
+
+  explicit SnapshotLayout(const SnapshotHeader &h) {
+    tensors = align8(sizeof(SnapshotHeader));
+    dims = align8(tensors + h.numTensors * sizeof(SnapshotTensor));
+    ops = align8(dims + h.numDims * sizeof(SnapshotDim));
+    operands = align8(ops + h.numOps * sizeof(SnapshotOp));
+    inputs = align8(operands + h.numOperands * sizeof(uint32_t));
+    words = align8(inputs + h.numInputs * sizeof(uint32_t));
+    chars = words + h.numWords * sizeof(uint64_t);
+    total = chars + h.numChars;
+  }
+};
+} // namespace
+
+void write_graph_snapshot(const Graph &g, const std::string &filename) {
+  auto tensors = g.get_tensors();
+  std::unordered_map<const Tensor *, uint32_t> tensorIndex;
+  for (uint32_t i = 0; i < tensors.size(); ++i)
+    tensorIndex[tensors[i].get()] = i;
+
+  SnapshotHeader header{};
+  std::copy(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC),
+            header.magic);
+  header.version = GRAPH_SNAPSHOT_VERSION;
+  header.byteOrder = SNAPSHOT_BYTE_ORDER;
+  header.output = g.output ? tensorIndex.at(g.output.get()) : UINT32_MAX;
+
+  std::vector<SnapshotTensor> tensorRecords;
+  std::vector<SnapshotDim> dims;
+  std::vector<uint64_t> words;
+  std::string chars;
+  for (auto &tensor : tensors) {
+    tensorRecords.push_back({static_cast<uint32_t>(chars.size()),
+                             static_cast<uint32_t>(tensor->name.size()),
+                             static_cast<uint32_t>(dims.size()),
+                             static_cast<uint32_t>(tensor->numDims)});
+    chars += tensor->name;
+    for (int dim = 0; dim < tensor->numDims; ++dim) {
+      SparsityVector dense = tensor->sparsities[dim];
+      dense.decompress();
+      dims.push_back({words.size(), static_cast<uint32_t>(dense.size()), 0});
+      words.insert(words.end(), dense.data(), dense.data() + dense.num_words());
+    }
+  }
+  std::vector<SnapshotOp> ops;
+  std::vector<uint32_t> operands;
+  for (auto &op : g.nodes) {
+    std::string expression;
+    if (op->kind == OP_EINSUM)
+      expression = static_cast<const Einsum &>(*op).expression;
+    ops.push_back({static_cast<uint32_t>(op->kind),
+                   static_cast<uint32_t>(chars.size()),
+                   static_cast<uint32_t>(expression.size()),
+                   static_cast<uint32_t>(operands.size()),
+                   static_cast<uint32_t>(op->inputs.size()),
+                   tensorIndex.at(op->output.get())});
+    chars += expression;
+    for (auto &input : op->inputs)
+      operands.push_back(tensorIndex.at(input.get()));
+  }
+  std::vector<uint32_t> inputs;
+  for (auto &input : g.inputs)
+    inputs.push_back(tensorIndex.at(input.get()));
+
+  header.numTensors = tensorRecords.size();
+  header.numDims = dims.size();
+  header.numOps = ops.size();
+  header.numOperands = operands.size();
+  header.numInputs = inputs.size();
+  header.numWords = words.size();
+  header.numChars = chars.size();
+  SnapshotLayout layout(header);
+
+  std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+  if (!file)
+    throw std::runtime_error(filename + ": cannot open for writing");
+  auto write_at = [&](size_t offset, const void *data, size_t bytes) {
+    static const char zeros[8] = {};
+    file.write(zeros, offset - file.tellp());
+    file.write(static_cast<const char *>(data), bytes);
+  };
+  write_at(0, &header, sizeof(header));
+  write_at(layout.tensors, tensorRecords.data(),
+           tensorRecords.size() * sizeof(SnapshotTensor));
+  write_at(layout.dims, dims.data(), dims.size() * sizeof(SnapshotDim));
+  write_at(layout.ops, ops.data(), ops.size() * sizeof(SnapshotOp));
+  write_at(layout.operands, operands.data(),
+           operands.size() * sizeof(uint32_t));
+  write_at(layout.inputs, inputs.data(), inputs.size() * sizeof(uint32_t));
+  write_at(layout.words, words.data(), words.size() * sizeof(uint64_t));
+  write_at(layout.chars, chars.data(), chars.size());
+  if (!file)
+    throw std::runtime_error(filename + ": write failed");
+}
+
+Graph read_graph_snapshot(const std::string &filename) {
+  MappedFile file(filename);
+  auto fail = [&](const std::string &what) {
+    throw std::runtime_error(filename + ": " + what);
+  };
+  // the arrays below point into the mapping: it stays until the graph is
+  // built, and the graph copies everything it keeps
+  if (file.length < sizeof(SnapshotHeader))
+    fail("truncated header");
+  SnapshotHeader header;
+  std::memcpy(&header, file.bytes, sizeof(header));
+  if (!std::equal(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC),
+                  header.magic))
+    fail("not a graph snapshot");
+  if (header.version != GRAPH_SNAPSHOT_VERSION)
+    fail("snapshot version " + std::to_string(header.version) +
+         ", expected " + std::to_string(GRAPH_SNAPSHOT_VERSION));
+  if (header.byteOrder != SNAPSHOT_BYTE_ORDER)
+    fail("snapshot written with another byte order");
+  if (header.numWords > file.length || header.numChars > file.length)
+    fail("corrupt header");
+  SnapshotLayout layout(header);
+  if (layout.total != file.length)
+    fail("size " + std::to_string(file.length) + ", expected " +
+         std::to_string(layout.total));
+
+  // the arrays are aligned within the page-aligned mapping
+  auto tensorRecords =
+      reinterpret_cast<const SnapshotTensor *>(file.bytes + layout.tensors);
+  auto dims = reinterpret_cast<const SnapshotDim *>(file.bytes + layout.dims);
+  auto ops = reinterpret_cast<const SnapshotOp *>(file.bytes + layout.ops);
+  auto operands =
+      reinterpret_cast<const uint32_t *>(file.bytes + layout.operands);
+  auto inputIndices =
+      reinterpret_cast<const uint32_t *>(file.bytes + layout.inputs);
+  auto words = reinterpret_cast<const uint64_t *>(file.bytes + layout.words);
+  const char *chars = file.bytes + layout.chars;
+  auto text = [&](uint32_t begin, uint32_t length) {
+    if (uint64_t{begin} + length > header.numChars)
+      fail("string out of range");
+    return std::string(chars + begin, length);
+  };
+
+  std::vector<TensorPtr> tensors;
+  tensors.reserve(header.numTensors);
+  for (uint32_t i = 0; i < header.numTensors; ++i) {
+    const SnapshotTensor &record = tensorRecords[i];
+    if (uint64_t{record.firstDim} + record.numDims > header.numDims)
+      fail("tensor dims out of range");
+    std::vector<int> sizes;
+    std::vector<SparsityVector> sparsities;
+    for (uint32_t d = record.firstDim; d < record.firstDim + record.numDims;
+         ++d) {
+      const size_t numWords = SparsityVector::num_words_for(dims[d].size);
+      if (dims[d].firstWord > header.numWords ||
+          numWords > header.numWords - dims[d].firstWord)
+        fail("sparsity vector out of range");
+      const uint64_t *first = words + dims[d].firstWord;
+      const size_t tail = dims[d].size % SparsityVector::WORD_BITS;
+      if (tail && (first[numWords - 1] >> tail))
+        fail("sparsity vector with bits past its end");
+      sizes.push_back(dims[d].size);
+      // long vectors start compressed: build them from their words
+      sparsities.emplace_back(dims[d].size, first);
+    }
+    tensors.push_back(std::make_shared<Tensor>(
+        sizes, std::move(sparsities), text(record.nameBegin, record.nameLength)));
+  }
+  auto tensor = [&](uint32_t index) {
+    if (index >= header.numTensors)
+      fail("tensor index out of range");
+    return tensors[index];
+  };
+
+  std::vector<OpNodePtr> nodes;
+  for (uint32_t i = 0; i < header.numOps; ++i) {
+    const SnapshotOp &record = ops[i];
+    if (uint64_t{record.firstOperand} + record.numOperands >
+        header.numOperands)
+      fail("operands out of range");
+    std::vector<TensorPtr> opInputs;
+    for (uint32_t k = 0; k < record.numOperands; ++k)
+      opInputs.push_back(tensor(operands[record.firstOperand + k]));
+    TensorPtr output = tensor(record.output);
+    switch (record.kind) {
+    case OP_ADD:
+      for (auto &input : opInputs)
+        if (input->sizes != output->sizes)
+          fail("add operands of different sizes");
+      nodes.push_back(std::make_shared<Add>(opInputs, output));
+      break;
+    case OP_EINSUM: {
+      std::string expression =
+          text(record.expressionBegin, record.expressionLength);
+      EinsumLabels labels;
+      try {
+        labels = parse_einsum_labels(expression);
+      } catch (const std::invalid_argument &e) {
+        fail(e.what());
+      }
+      bool matches = labels.inputs.size() == opInputs.size() &&
+                     labels.output.size() == output->numDims;
+      for (size_t k = 0; matches && k < opInputs.size(); ++k)
+        matches = labels.inputs[k].size() == opInputs[k]->numDims;
+      if (!matches)
+        fail("einsum '" + expression + "' does not match its operands");
+      nodes.push_back(std::make_shared<Einsum>(opInputs, output, expression));
+      break;
+    }
+    default:
+      fail("unknown op kind " + std::to_string(record.kind));
+    }
+  }
+  std::vector<TensorPtr> inputs;
+  for (uint32_t i = 0; i < header.numInputs; ++i)
+    inputs.push_back(tensor(inputIndices[i]));
+  TensorPtr output =
+      header.output == UINT32_MAX ? TensorPtr() : tensor(header.output);
+  return Graph::build_graph(inputs, output, nodes);
+}
+
+namespace {
+/// Maps \p filename and parses it; throws std::runtime_error like
+/// parse_einsum_benchmark(), or naming the file if it cannot be read.
+EinsumBenchmark parse_einsum_file(const std::string &filename) {
+  MappedFile file(filename);
+  return parse_einsum_benchmark(std::string(file.bytes, file.length),
+                                filename);
+}
+} // namespace
+
 EinsumBenchmark read_einsum_benchmark(const std::string &filename) {
+  try {
+    return parse_einsum_file(filename);
+  } catch (const std::runtime_error &e) {
+    std::cerr << e.what() << "\n";
+    return EinsumBenchmark();
+  }
+}
 
-  EinsumBenchmark result;
-  std::ifstream file(filename);
-  if (!file) {
-    std::cerr << "Failed to open file.\n";
-    return result;
-  }
-  std::string path;
-  std::string contractions;
-  std::string sizes;
-  std::getline(file, path);
-  std::getline(file, contractions);
-  std::getline(file, sizes);
-  file.close();
-  auto contractionPath = get_contraction_path(path);
-  auto contractionStrings = get_contraction_strings(contractions);
-  auto tensorSizes = get_tensor_sizes(sizes);
-  result.sizes = tensorSizes;
-  result.path = contractionPath;
-  result.strings = contractionStrings;
-  return result;
+std::vector<EinsumDatasetEntry>
+read_einsum_dataset(const std::string &directory, size_t numThreads) {
+  std::vector<EinsumDatasetEntry> entries;
+  DIR *dir = opendir(directory.c_str());
+  if (!dir) {
+    std::cerr << "Failed to open directory " << directory << ".\n";
+    return entries;
+  }
+  while (dirent *item = readdir(dir)) {
+    std::string name = item->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0)
+      entries.push_back({directory + "/" + name, EinsumBenchmark(), ""});
+  }
+  closedir(dir);
+  std::sort(entries.begin(), entries.end(),
+            [](const EinsumDatasetEntry &a, const EinsumDatasetEntry &b) {
+              return a.path < b.path;
+            });
+
+  ThreadPool pool(std::min(numThreads ? numThreads
+                                      : std::thread::hardware_concurrency(),
+                           std::max<size_t>(entries.size(), 1)));
+  pool.parallel_for(entries.size(), [&](size_t i) {
+    auto &entry = entries[i];
+    try {
+      entry.benchmark = parse_einsum_file(entry.path);
+    } catch (const std::runtime_error &e) {
+      entry.error = e.what();
+    }
+  });
+  return entries;
 }
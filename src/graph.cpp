@@ -1,51 +1,710 @@
 #include "../include/graph.hpp"
+#include "../include/bit_kernels.hpp"
+#include "../include/work_stealing_deque.hpp"
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <unordered_set>
+
+constexpr uint32_t GraphLinks::NONE;
+
 Graph Graph::build_graph(std::vector<TensorPtr> inputs, TensorPtr out,
                          const std::vector<OpNodePtr> &ops) {
   Graph g;
   g.inputs = inputs;
   g.output = out;
   g.nodes = ops;
-  for (auto op : ops) {
-    for (auto input : op->inputs) {
-      input->inputOps.push_back(op);
+  g.build_schedule();
+  g.bind_sparsities();
+  g.lower_propagation();
+  return g;
+}
+
+Graph::~Graph() {
+  if (!links)
+    return;
+  for (OpNode *op : links->ops)
+    if (op->links == links.get()) {
+      op->links = nullptr;
+      op->id = GraphLinks::NONE;
+    }
+}
+
+std::vector<TensorPtr> Graph::get_tensors() const { return tensors; }
+
+void Graph::link() {
+  if (!links)
+    links.reset(new GraphLinks());
+  // ops dropped by an edit leave the graph
+  for (OpNode *op : links->ops)
+    if (op->links == links.get()) {
+      op->links = nullptr;
+      op->id = GraphLinks::NONE;
     }
-    op->output->outputOp = op;
+  GraphLinks &l = *links;
+  l = GraphLinks();
+  assert(nodes.size() < GraphLinks::NONE && "too many ops");
+
+  tensors.clear();
+  auto visit = [&](const TensorPtr &tensor) {
+    if (!tensor)
+      return GraphLinks::NONE;
+    auto it = l.tensorIds.emplace(tensor.get(), tensors.size()).first;
+    if (it->second == tensors.size())
+      tensors.push_back(tensor);
+    return it->second;
+  };
+  for (auto &input : inputs)
+    visit(input);
+  for (uint32_t o = 0; o < nodes.size(); ++o) {
+    OpNode *op = nodes[o].get();
+    assert((!op->links || op->links == links.get()) &&
+           "an op belongs to one graph at a time");
+    op->links = links.get();
+    op->id = o;
+    l.ops.push_back(op);
+    for (auto &input : op->inputs)
+      l.inputIds.push_back(visit(input));
+    l.inputOffsets.push_back(l.inputIds.size());
+    l.outputIds.push_back(visit(op->output));
   }
-  return g;
+  visit(output);
+  assert(tensors.size() < GraphLinks::NONE && "too many tensors");
+
+  const size_t numTensors = tensors.size();
+  l.producers.assign(numTensors, GraphLinks::NONE);
+  for (uint32_t o = 0; o < nodes.size(); ++o)
+    l.producers[l.outputIds[o]] = o;
+  // consumers, grouped by tensor with a counting sort over the input slots
+  l.consumerOffsets.assign(numTensors + 1, 0);
+  for (uint32_t t : l.inputIds)
+    ++l.consumerOffsets[t + 1];
+  for (size_t t = 0; t < numTensors; ++t)
+    l.consumerOffsets[t + 1] += l.consumerOffsets[t];
+  l.consumerIds.resize(l.inputIds.size());
+  std::vector<uint32_t> next(l.consumerOffsets.begin(),
+                             l.consumerOffsets.end() - 1);
+  for (uint32_t o = 0; o < nodes.size(); ++o)
+    for (uint32_t t : l.inputs(o))
+      l.consumerIds[next[t]++] = o;
 }
 
-void Graph::run_propagation() {
-  run_propagation(Direction::FORWARD);
-  run_propagation(Direction::INTRA);
-  run_propagation(Direction::BACKWARD);
+void Graph::bind_sparsities() {
+  size_t words = 0;
+  for (auto &tensor : tensors)
+    for (auto &sparsity : tensor->sparsities)
+      if (!sparsity.is_compressed())
+        words += SparsityArena::slot_words(sparsity.num_words());
+  arena = std::make_shared<SparsityArena>(words);
+  for (auto &tensor : tensors) {
+    for (auto &sparsity : tensor->sparsities)
+      arena->bind(sparsity);
+    tensor->sparsityArena = arena;
+  }
 }
 
-void Graph::run_propagation(Direction dir) {
-  if (dir == INTRA || dir == BACKWARD) {
-    std::vector<OpNodePtr> intraStack{output->outputOp};
-    std::unordered_map<TensorPtr, bool> doneProp;
-    while (intraStack.size() > 0) {
-      auto op = intraStack.back();
-      intraStack.pop_back();
-      op->propagate(dir);
-      for (auto input : op->inputs) {
-        doneProp[input] = true;
-
-        if (!input->outputOp)
+void Graph::build_schedule() {
+  link();
+  const GraphLinks &l = *links;
+  const size_t numOps = nodes.size();
+  schedule = PropagationSchedule();
+
+  // producer -> consumer edges, one per input slot
+  std::vector<std::vector<size_t>> consumers(numOps);
+  schedule.numProducers.assign(numOps, 0);
+  for (uint32_t i = 0; i < numOps; ++i) {
+    for (uint32_t input : l.inputs(i)) {
+      uint32_t producer = l.producers[input];
+      if (producer == GraphLinks::NONE)
+        continue;
+      consumers[producer].push_back(i);
+      ++schedule.numProducers[i];
+    }
+  }
+  schedule.numConsumers.resize(numOps);
+  for (size_t i = 0; i < numOps; ++i)
+    schedule.numConsumers[i] = consumers[i].size();
+
+  // Kahn's algorithm; ties go to the op listed first, so an already sorted
+  // `nodes` keeps its order
+  std::vector<size_t> pending = schedule.numProducers;
+  std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> ready;
+  for (size_t i = 0; i < numOps; ++i)
+    if (pending[i] == 0)
+      ready.push(i);
+  while (!ready.empty()) {
+    size_t i = ready.top();
+    ready.pop();
+    schedule.forward.push_back(i);
+    for (size_t consumer : consumers[i])
+      if (--pending[consumer] == 0)
+        ready.push(consumer);
+  }
+  assert(schedule.forward.size() == numOps && "the graph has a cycle");
+  schedule.backward.assign(schedule.forward.rbegin(), schedule.forward.rend());
+
+  // level of an op: length of the longest producer chain leading to it
+  std::vector<size_t> level(numOps, 0);
+  for (size_t i : schedule.forward) {
+    for (size_t consumer : consumers[i])
+      level[consumer] = std::max(level[consumer], level[i] + 1);
+    if (level[i] >= schedule.levels.size())
+      schedule.levels.resize(level[i] + 1);
+    schedule.levels[level[i]].push_back(i);
+  }
+
+  // readers[t]: the ops with a transfer function that reads tensor t. Besides
+  // the op t belongs to, INTRA and BACKWARD of an op look at every other
+  // consumer of its inputs, so those consumers read t as well.
+  schedule.readers.resize(tensors.size());
+  std::vector<size_t> related;
+  for (uint32_t i = 0; i < numOps; ++i) {
+    related.clear();
+    for (uint32_t input : l.inputs(i))
+      for (uint32_t consumer : l.consumers(input))
+        related.push_back(consumer);
+    related.push_back(i);
+    for (uint32_t input : l.inputs(i)) {
+      auto &list = schedule.readers[input];
+      list.insert(list.end(), related.begin(), related.end());
+    }
+    auto &list = schedule.readers[l.outputIds[i]];
+    list.insert(list.end(), related.begin(), related.end());
+  }
+  for (auto &list : schedule.readers) {
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+  }
+}
+
+namespace {
+size_t count_set_bits(const Tensor &tensor) {
+  size_t bits = 0;
+  for (auto &sparsity : tensor.sparsities)
+    bits += sparsity.count();
+  return bits;
+}
+} // namespace
+
+PropagationStats Graph::run_propagation(const PropagationOptions &options) {
+  if (options.threads != 1) {
+    ThreadPool pool(options.threads);
+    return run_propagation(options, pool);
+  }
+  const size_t numOps = nodes.size();
+
+  // One pending flag per (direction, op). FORWARD sweeps the ops in
+  // topological order and the other directions in reverse, so a change
+  // usually reaches the ops it affects within the same sweep.
+  const Direction dirs[] = {FORWARD, INTRA, BACKWARD};
+  std::vector<std::vector<char>> pending(3, std::vector<char>(numOps, 1));
+  size_t numPending = 3 * numOps;
+  PropagationStats stats;
+  std::vector<uint32_t> written;
+  std::vector<size_t> before;
+  while (numPending > 0 &&
+         (options.maxRounds == 0 || stats.rounds < options.maxRounds)) {
+    ++stats.rounds;
+    for (int d = 0; d < 3; ++d) {
+      const auto &order =
+          dirs[d] == FORWARD ? schedule.forward : schedule.backward;
+      for (size_t i : order) {
+        if (!pending[d][i])
+          continue;
+        pending[d][i] = 0;
+        --numPending;
+
+        written.clear();
+        if (dirs[d] == FORWARD)
+          written.push_back(links->outputIds[i]);
+        else
+          for (uint32_t input : links->inputs(i))
+            if (std::find(written.begin(), written.end(), input) ==
+                written.end())
+              written.push_back(input);
+        before.clear();
+        for (uint32_t t : written)
+          before.push_back(count_set_bits(*tensors[t]));
+
+        nodes[i]->propagate(dirs[d]);
+        ++stats.opsVisited;
+
+        // transfer functions only clear bits, so a changed count is the only
+        // way a vector can change
+        for (size_t t = 0; t < written.size(); ++t) {
+          size_t after = count_set_bits(*tensors[written[t]]);
+          if (after == before[t])
+            continue;
+          stats.bitsCleared += before[t] - after;
+          for (size_t reader : schedule.readers[written[t]])
+            for (auto &flags : pending)
+              if (!flags[reader]) {
+                flags[reader] = 1;
+                ++numPending;
+              }
+        }
+      }
+    }
+  }
+  stats.converged = numPending == 0;
+  return stats;
+}
+
+PropagationStats Graph::run_propagation(const PropagationOptions &options,
+                                        ThreadPool &pool) {
+  const size_t numOps = nodes.size();
+  const size_t numLevels = schedule.levels.size();
+  const Direction dirs[] = {FORWARD, INTRA, BACKWARD};
+  std::vector<std::vector<char>> pending(3, std::vector<char>(numOps, 1));
+  size_t numPending = 3 * numOps;
+  PropagationStats stats;
+
+  std::vector<size_t> batch;
+  std::vector<uint32_t> targets;
+  std::vector<size_t> cleared;
+  std::vector<std::vector<SparsityUpdate>> updates;
+  std::vector<std::vector<const SparsityUpdate *>> groups;
+  std::vector<size_t> groupOf(tensors.size(), 0);
+  while (numPending > 0 &&
+         (options.maxRounds == 0 || stats.rounds < options.maxRounds)) {
+    ++stats.rounds;
+    for (int d = 0; d < 3; ++d) {
+      for (size_t step = 0; step < numLevels; ++step) {
+        const auto &level =
+            schedule.levels[dirs[d] == FORWARD ? step : numLevels - 1 - step];
+        batch.clear();
+        for (size_t i : level)
+          if (pending[d][i]) {
+            pending[d][i] = 0;
+            batch.push_back(i);
+          }
+        if (batch.empty())
           continue;
-        bool allDone{false};
-        for (auto otherInput : input->outputOp->inputs) {
-          for (auto otherOp : otherInput->inputOps)
-            allDone |= doneProp[otherOp->output];
+        numPending -= batch.size();
+        stats.opsVisited += batch.size();
+
+        targets.clear();
+        if (dirs[d] == FORWARD) {
+          // ops of one level have distinct outputs and only read tensors of
+          // earlier levels, so they can write in place
+          cleared.assign(batch.size(), 0);
+          pool.parallel_for(batch.size(), [&](size_t k) {
+            auto &op = nodes[batch[k]];
+            size_t before = count_set_bits(*op->output);
+            op->propagate(FORWARD);
+            cleared[k] = before - count_set_bits(*op->output);
+          });
+          for (size_t k = 0; k < batch.size(); ++k)
+            targets.push_back(links->outputIds[batch[k]]);
+        } else {
+          // ops of one level may narrow the same input: compute every op's
+          // updates from the current state, then AND them in per tensor
+          updates.assign(batch.size(), {});
+          pool.parallel_for(batch.size(), [&](size_t k) {
+            updates[k] = nodes[batch[k]]->compute_updates(dirs[d]);
+          });
+          // groupOf[t] is one past the group of tensor t, 0 for none yet
+          groups.clear();
+          for (auto &opUpdates : updates)
+            for (auto &update : opUpdates) {
+              uint32_t t = links->tensor_id(update.tensor);
+              if (groupOf[t] == 0) {
+                targets.push_back(t);
+                groups.emplace_back();
+                groupOf[t] = targets.size();
+              }
+              groups[groupOf[t] - 1].push_back(&update);
+            }
+          for (uint32_t t : targets)
+            groupOf[t] = 0;
+          cleared.assign(targets.size(), 0);
+          pool.parallel_for(targets.size(), [&](size_t k) {
+            Tensor &tensor = *tensors[targets[k]];
+            size_t before = count_set_bits(tensor);
+            for (auto *update : groups[k])
+              tensor.sparsities[update->dim] &= update->mask;
+            cleared[k] = before - count_set_bits(tensor);
+          });
+        }
+
+        for (size_t t = 0; t < targets.size(); ++t) {
+          if (cleared[t] == 0)
+            continue;
+          stats.bitsCleared += cleared[t];
+          for (size_t reader : schedule.readers[targets[t]])
+            for (auto &flags : pending)
+              if (!flags[reader]) {
+                flags[reader] = 1;
+                ++numPending;
+              }
         }
-        if (allDone)
-          intraStack.push_back(input->outputOp);
       }
     }
+  }
+  stats.converged = numPending == 0;
+  return stats;
+}
+
+PropagationStats Graph::run_propagation_async(
+    const PropagationOptions &options) {
+  const size_t numThreads =
+      options.threads != 0
+          ? options.threads
+          : std::max(1u, std::thread::hardware_concurrency());
+
+  // words are narrowed in place, so every vector must be dense for the run
+  for (auto &tensor : tensors)
+    for (auto &sparsity : tensor->sparsities)
+      sparsity.decompress();
+
+  // readers() indexes the program on first use: do that before the threads
+  // share it
+  const size_t numInstructions = program.num_instructions();
+  if (program.num_slots() != 0)
+    program.readers(0);
+
+  std::vector<std::unique_ptr<WorkStealingDeque>> deques;
+  for (size_t t = 0; t < numThreads; ++t)
+    deques.emplace_back(new WorkStealingDeque(numInstructions));
+  // queued[id] is set while instruction id waits in some deque; it is cleared
+  // before the instruction reads, so a write that lands after the read queues
+  // it again
+  std::unique_ptr<std::atomic<bool>[]> queued(
+      new std::atomic<bool>[numInstructions]);
+  // deques pop their newest item first: push in reverse order so each thread
+  // starts with the forward sweep
+  for (size_t id = numInstructions; id-- > 0;) {
+    queued[id] = true;
+    deques[id % numThreads]->push(id);
+  }
+  std::atomic<size_t> outstanding{numInstructions};
+  std::atomic<size_t> opsVisited{0};
+  std::atomic<size_t> bitsCleared{0};
+
+  auto worker = [&](size_t tid) {
+    WorkStealingDeque &own = *deques[tid];
+    std::vector<SparsityVector::Word> acc, term;
+    size_t id;
+    while (true) {
+      bool found = own.pop(id);
+      for (size_t v = 1; !found && v < numThreads; ++v)
+        found = deques[(tid + v) % numThreads]->steal(id);
+      if (!found) {
+        if (outstanding.load() == 0)
+          return;
+        std::this_thread::yield();
+        continue;
+      }
+
+      queued[id].store(false);
+      size_t cleared = program.run_instruction_atomic(id, acc, term);
+      ++opsVisited;
+      if (cleared != 0) {
+        bitsCleared += cleared;
+        for (size_t reader : program.readers(program.destination(id)))
+          if (!queued[reader].exchange(true)) {
+            ++outstanding;
+            own.push(reader);
+          }
+      }
+      --outstanding;
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < numThreads; ++t)
+    threads.emplace_back(worker, t);
+  worker(0);
+  for (auto &thread : threads)
+    thread.join();
+
+  for (auto &tensor : tensors)
+    for (auto &sparsity : tensor->sparsities)
+      sparsity.optimize();
+
+  PropagationStats stats;
+  stats.opsVisited = opsVisited;
+  stats.bitsCleared = bitsCleared;
+  stats.converged = true;
+  return stats;
+}
+
+void Graph::run_propagation(Direction dir) {
+  const auto &order = dir == FORWARD ? schedule.forward : schedule.backward;
+  for (size_t i : order)
+    nodes[i]->propagate(dir);
+}
+
+void Graph::lower_propagation() {
+  // vectors that were lowered before keep their seeds. The old slots must all
+  // still be alive here, or a new tensor could reuse an old address.
+  std::unordered_map<const Tensor *, std::vector<SparsityVector>> kept;
+  for (uint32_t slot = 0; slot < seeds.size(); ++slot) {
+    auto &vector = program.slot_vector(slot);
+    auto &dims = kept[vector.first];
+    dims.resize(vector.first->numDims);
+    dims[vector.second] = std::move(seeds[slot]);
+  }
+  seeds.clear();
+
+  program.clear();
+  for (size_t i : schedule.forward)
+    nodes[i]->lower(FORWARD, program);
+  for (Direction dir : {INTRA, BACKWARD})
+    for (size_t i : schedule.backward)
+      nodes[i]->lower(dir, program);
+
+  for (uint32_t slot = 0; slot < program.num_slots(); ++slot) {
+    auto &vector = program.slot_vector(slot);
+    const SparsityVector &current = program.sparsity(slot);
+    auto it = kept.find(vector.first);
+    if (it != kept.end() && vector.second < it->second.size() &&
+        it->second[vector.second].size() == current.size())
+      seeds.push_back(std::move(it->second[vector.second]));
+    else
+      seeds.push_back(current);
+  }
+}
+
+PropagationStats
+Graph::update_sparsity(const TensorPtr &tensor,
+                       const std::vector<SparsityVector> &sparsities,
+                       const PropagationOptions &options) {
+  assert(sparsities.size() == static_cast<size_t>(tensor->numDims));
+  std::vector<uint32_t> changed;
+  bool widened = false;
+  for (int dim = 0; dim < tensor->numDims; ++dim) {
+    assert(sparsities[dim].size() == tensor->sparsities[dim].size());
+    int slot = program.find_slot(tensor.get(), dim);
+    if (slot == -1) { // not part of the analysis
+      tensor->sparsities[dim] = sparsities[dim];
+      continue;
+    }
+    if (sparsities[dim] == seeds[slot])
+      continue;
+    // below the old seed, the new fixed point is below the current one, so
+    // the solver can resume from here
+    widened |= and_count(sparsities[dim], seeds[slot]) !=
+               sparsities[dim].count();
+    seeds[slot] = sparsities[dim];
+    changed.push_back(slot);
+  }
+
+  return resume_propagation(changed, widened, options);
+}
+
+PropagationStats Graph::repropagate(const std::vector<TensorPtr> &tensors,
+                                    const PropagationOptions &options) {
+  std::vector<uint32_t> slots;
+  for (auto &tensor : tensors)
+    for (int dim = 0; dim < tensor->numDims; ++dim) {
+      int slot = program.find_slot(tensor.get(), dim);
+      if (slot != -1)
+        slots.push_back(slot);
+    }
+  return resume_propagation(slots, true, options);
+}
+
+PropagationStats
+Graph::resume_propagation(const std::vector<uint32_t> &changed, bool reset,
+                          const PropagationOptions &options) {
+  // instructions to run, by id; ids follow the sweep order of a round
+  std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>>
+      thisRound, nextRound;
+  std::unordered_set<size_t> pending;
+  size_t running = 0;
+  bool started = false;
+  auto queue = [&](size_t id) {
+    if (!pending.insert(id).second)
+      return;
+    if (!started || id > running)
+      thisRound.push(id);
+    else
+      nextRound.push(id);
+  };
+
+  PropagationStats stats;
+  if (reset) {
+    // a cleared bit may come back: reset the cone of the changed vectors,
+    // i.e. every vector an instruction derives from them, and replay it
+    std::unordered_set<uint32_t> cone(changed.begin(), changed.end());
+    std::vector<uint32_t> stack(changed.begin(), changed.end());
+    while (!stack.empty()) {
+      uint32_t slot = stack.back();
+      stack.pop_back();
+      for (size_t id : program.readers(slot))
+        if (cone.insert(program.destination(id)).second)
+          stack.push_back(program.destination(id));
+    }
+    for (uint32_t slot : cone) {
+      program.sparsity(slot) = seeds[slot];
+      for (size_t id : program.writers(slot))
+        queue(id);
+    }
   } else {
-    for (auto &op : nodes)
-      op->propagate(dir);
+    for (uint32_t slot : changed) {
+      size_t before = program.sparsity(slot).count();
+      program.sparsity(slot) &= seeds[slot];
+      size_t after = program.sparsity(slot).count();
+      if (after == before)
+        continue;
+      stats.bitsCleared += before - after;
+      for (size_t id : program.readers(slot))
+        queue(id);
+    }
+  }
+
+  started = true;
+  while (!thisRound.empty() &&
+         (options.maxRounds == 0 || stats.rounds < options.maxRounds)) {
+    ++stats.rounds;
+    while (!thisRound.empty()) {
+      running = thisRound.top();
+      thisRound.pop();
+      pending.erase(running);
+      SparsityVector &dst = program.sparsity(program.destination(running));
+      size_t before = dst.count();
+      ++stats.opsVisited;
+      if (!program.run_instruction(running))
+        continue;
+      stats.bitsCleared += before - dst.count();
+      for (size_t id : program.readers(program.destination(running)))
+        queue(id);
+    }
+    std::swap(thisRound, nextRound);
+  }
+  stats.converged = thisRound.empty();
+  return stats;
+}
+
+namespace {
+/// The tensors whose transfer functions depend on the ops reading or
+/// writing \p tensor: an op's INTRA and BACKWARD look at all of its operands.
+void add_neighborhood(const Graph &g, const TensorPtr &tensor,
+                      std::vector<TensorPtr> &touched) {
+  touched.push_back(tensor);
+  const GraphLinks &l = *g.links;
+  uint32_t t = l.tensor_id(tensor.get());
+  std::vector<uint32_t> ops(l.consumers(t).begin(), l.consumers(t).end());
+  if (l.producers[t] != GraphLinks::NONE)
+    ops.push_back(l.producers[t]);
+  for (uint32_t op : ops) {
+    for (uint32_t input : l.inputs(op))
+      touched.push_back(g.tensors[input]);
+    touched.push_back(g.tensors[l.outputIds[op]]);
+  }
+}
+} // namespace
+
+PropagationStats Graph::finish_edit(const std::vector<TensorPtr> &touched,
+                                    const PropagationOptions &options) {
+  lower_propagation();
+  return repropagate(touched, options);
+}
+
+PropagationStats Graph::add_op(const OpNodePtr &op,
+                               const PropagationOptions &options) {
+  assert(std::find(nodes.begin(), nodes.end(), op) == nodes.end());
+  nodes.push_back(op);
+  build_schedule();
+
+  std::vector<TensorPtr> touched(op->inputs);
+  touched.push_back(op->output);
+  return finish_edit(touched, options);
+}
+
+PropagationStats Graph::remove_op(const OpNodePtr &op,
+                                  const PropagationOptions &options) {
+  // hold the op, and with it its tensors, until the program is relowered
+  OpNodePtr removed = op;
+  auto it = std::find(nodes.begin(), nodes.end(), removed);
+  assert(it != nodes.end() && "op is not part of the graph");
+  assert(removed->output != output &&
+         "the op producing the graph output cannot be removed");
+  nodes.erase(it);
+  for (auto &input : removed->inputs)
+    input->numOps--;
+  removed->output->outputTensor = false;
+  build_schedule();
+
+  std::vector<TensorPtr> touched(removed->inputs);
+  touched.push_back(removed->output);
+  return finish_edit(touched, options);
+}
+
+PropagationStats Graph::rewire_input(const OpNodePtr &op, size_t inputInd,
+                                     const TensorPtr &tensor,
+                                     const PropagationOptions &options) {
+  assert(inputInd < op->inputs.size());
+  TensorPtr old = op->inputs[inputInd];
+  assert(old->sizes == tensor->sizes && "rewired inputs must have equal sizes");
+  op->inputs[inputInd] = tensor;
+  old->numOps--;
+  tensor->numOps++;
+  build_schedule();
+
+  std::vector<TensorPtr> touched{old};
+  add_neighborhood(*this, tensor, touched);
+  return finish_edit(touched, options);
+}
+
+PropagationStats Graph::replace_tensor(const TensorPtr &oldTensor,
+                                       const TensorPtr &newTensor,
+                                       const PropagationOptions &options) {
+  assert(oldTensor->sizes == newTensor->sizes &&
+         "replacing tensors must have equal sizes");
+  TensorPtr old = oldTensor; // callers may pass a reference into the graph
+  uint32_t t = links->tensor_id(old.get());
+  if (t != GraphLinks::NONE) {
+    for (uint32_t op : links->consumers(t))
+      for (auto &input : nodes[op]->inputs)
+        if (input == old) {
+          input = newTensor;
+          old->numOps--;
+          newTensor->numOps++;
+        }
+    if (links->producers[t] != GraphLinks::NONE) {
+      nodes[links->producers[t]]->output = newTensor;
+      newTensor->outputTensor = true;
+    }
+  }
+  std::replace(inputs.begin(), inputs.end(), old, newTensor);
+  if (output == old)
+    output = newTensor;
+  build_schedule();
+
+  std::vector<TensorPtr> touched;
+  add_neighborhood(*this, newTensor, touched);
+  return finish_edit(touched, options);
+}
+
+bool Graph::run_program(Direction dir) { return program.run(dir); }
+
+PropagationStats Graph::run_program(const PropagationOptions &options) {
+  size_t before = 0;
+  for (auto &tensor : tensors)
+    before += count_set_bits(*tensor);
+
+  PropagationStats stats;
+  bool changed = true;
+  while (changed &&
+         (options.maxRounds == 0 || stats.rounds < options.maxRounds)) {
+    ++stats.rounds;
+    changed = false;
+    for (Direction dir : {FORWARD, INTRA, BACKWARD}) {
+      changed |= program.run(dir);
+      stats.opsVisited += program.size(dir);
+    }
   }
+  stats.converged = !changed;
+
+  size_t after = 0;
+  for (auto &tensor : tensors)
+    after += count_set_bits(*tensor);
+  stats.bitsCleared = before - after;
+  return stats;
 }
 
 void Graph::assemble_expressions() {
@@ -61,7 +720,8 @@ void Graph::compile() {
 TensorPtr Graph::compute() {
   for (auto &op : nodes)
     op->compute();
-  this->output->data->assemble();
+  if (!this->output->assembled)
+    this->output->data->assemble();
   this->output->data->compute();
   return this->output;
 }
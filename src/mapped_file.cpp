@@ -0,0 +1,32 @@
+#include "../include/mapped_file.hpp"
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error(filename + ": cannot open");
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw std::runtime_error(filename + ": cannot stat");
+  }
+  length = info.st_size;
+  if (length > 0) {
+    void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error(filename + ": cannot map");
+    }
+    bytes = static_cast<const char *>(mapped);
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (bytes)
+    munmap(const_cast<char *>(bytes), length);
+}
@@ -1,8 +1,19 @@
 #include "../include/node.hpp"
+#include "../include/bit_kernels.hpp"
 #include "taco/format.h"
 #include "taco/parser/einsum_parser.h"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+GraphLinks::Range OpNode::input_consumers(size_t inputInd) const {
+  if (!links)
+    return GraphLinks::Range(nullptr, nullptr);
+  return links->consumers(links->inputs(id)[inputInd]);
+}
 
-Add::Add(std::vector<TensorPtr> inputs, TensorPtr &Out) {
+Add::Add(std::vector<TensorPtr> inputs, TensorPtr &Out) : OpNode(OP_ADD) {
   this->inputs = inputs;
   this->output = Out;
   this->output->outputTensor = true;
@@ -20,15 +31,44 @@ void Add::set_expression() {
 void Add::propagate(Direction dir) {
   if (dir == FORWARD) {
     for (int dim = 0; dim < output->numDims; ++dim) {
-      SparsityVector inputSparsity;
-      for (auto input : inputs)
-        inputSparsity |= input->sparsities[dim];
+      std::vector<const SparsityVector *> operands;
+      for (auto &input : inputs)
+        operands.push_back(&input->sparsities[dim]);
+      SparsityVector inputSparsity(output->sizes[dim]);
+      or_all(inputSparsity, operands);
 
       output->sparsities[dim] &= inputSparsity;
     }
   }
 }
 
+std::vector<SparsityUpdate> Add::compute_updates(Direction dir) {
+  std::vector<SparsityUpdate> updates;
+  if (dir != FORWARD)
+    return updates;
+  for (int dim = 0; dim < output->numDims; ++dim) {
+    std::vector<const SparsityVector *> operands;
+    for (auto &input : inputs)
+      operands.push_back(&input->sparsities[dim]);
+    SparsityVector inputSparsity(output->sizes[dim]);
+    or_all(inputSparsity, operands);
+    updates.push_back({output.get(), dim, std::move(inputSparsity)});
+  }
+  return updates;
+}
+
+void Add::lower(Direction dir, PropagationProgram &program) {
+  if (dir != FORWARD)
+    return;
+  for (int dim = 0; dim < output->numDims; ++dim) {
+    program.begin_instruction(dir, output.get(), dim);
+    for (auto &input : inputs) {
+      program.begin_group();
+      program.add_source(input.get(), dim);
+    }
+  }
+}
+
 void Add::print() {
   std::cout << "->Add(";
   for (int i = 0; i < inputs.size(); ++i) {
@@ -39,12 +79,11 @@ void Add::print() {
   std::cout << ", out=" << output->name << ")";
 }
 
-std::vector<std::shared_ptr<SparsityVector>>
+std::vector<const SparsityVector *>
 Add::get_input_sparsity_vectors(int inputDim) {
-  std::vector<std::shared_ptr<SparsityVector>> ret;
-  for (auto input : inputs)
-    ret.push_back(
-        std::make_shared<SparsityVector>(input->sparsities[inputDim]));
+  std::vector<const SparsityVector *> ret;
+  for (auto &input : inputs)
+    ret.push_back(&input->sparsities[inputDim]);
   return ret;
 }
 
@@ -61,12 +100,124 @@ void Add::print_sparsity() {
 std::string Add::op_type() const { return "Add"; }
 
 void Add::compute() {
-  this->output->data->assemble();
+  if (!this->output->assembled)
+    this->output->data->assemble();
   this->output->data->compute();
 }
 
+IndexVarTable::IndexVarTable(const std::vector<std::vector<Entry>> &lists) {
+  offsets.reserve(lists.size() + 1);
+  for (auto &list : lists) {
+    entries.insert(entries.end(), list.begin(), list.end());
+    offsets.push_back(entries.size());
+  }
+}
+
+namespace {
+/// How an Einsum's INTRA/BACKWARD treats another consumer of one of its
+/// inputs, for one kind of consumer. A null entry contributes nothing.
+struct MultiopRule {
+  SparsityVector (*sparsity)(Einsum &self, OpNode *op, int inputInd,
+                             int inputDim);
+  void (*lower)(Einsum &self, OpNode *op, int inputInd, int inputDim,
+                PropagationProgram &program);
+};
+
+/// Indexed by OpKind.
+const MultiopRule multiopRules[NUM_OP_KINDS] = {
+    // OP_ADD
+    {[](Einsum &self, OpNode *op, int inputInd, int inputDim) {
+       return self.compute_multiop_add_sparsity(static_cast<Add *>(op),
+                                                inputInd, inputDim);
+     },
+     [](Einsum &self, OpNode *op, int inputInd, int inputDim,
+        PropagationProgram &program) {
+       self.lower_multiop_add_sparsity(static_cast<Add *>(op), inputInd,
+                                       inputDim, program);
+     }},
+    // OP_EINSUM
+    {[](Einsum &self, OpNode *op, int inputInd, int inputDim) {
+       return self.compute_multiop_einsum_sparsity(static_cast<Einsum *>(op),
+                                                   inputInd, inputDim);
+     },
+     [](Einsum &self, OpNode *op, int inputInd, int inputDim,
+        PropagationProgram &program) {
+       self.lower_multiop_einsum_sparsity(static_cast<Einsum *>(op),
+                                          inputInd, inputDim, program);
+     }},
+};
+static_assert(sizeof(multiopRules) / sizeof(multiopRules[0]) == NUM_OP_KINDS,
+              "multiopRules needs one row per OpKind");
+} // namespace
+
+EinsumLabels parse_einsum_labels(const std::string &expression) {
+  size_t arrowPos = expression.find("->");
+  if (arrowPos == std::string::npos)
+    throw std::invalid_argument("einsum expression without '->': " +
+                                expression);
+  const bool indexLists =
+      expression.find_first_of("0123456789") != std::string::npos;
+  auto parse_operand = [&](const std::string &operand) {
+    std::vector<int> labels;
+    if (!indexLists) {
+      for (char c : operand)
+        labels.push_back(static_cast<unsigned char>(c));
+      return labels;
+    }
+    std::istringstream in(operand);
+    std::string id;
+    while (in >> id) {
+      if (id.find_first_not_of("0123456789") != std::string::npos)
+        throw std::invalid_argument("bad index '" + id +
+                                    "' in einsum expression: " + expression);
+      labels.push_back(std::stoi(id));
+    }
+    return labels;
+  };
+
+  EinsumLabels labels;
+  std::stringstream ss(expression.substr(0, arrowPos));
+  std::string token;
+  while (std::getline(ss, token, ','))
+    labels.inputs.push_back(parse_operand(token));
+  labels.output = parse_operand(expression.substr(arrowPos + 2));
+  return labels;
+}
+
+namespace {
+/// \p expression in letter form, renaming index-list labels to a-z, A-Z in
+/// order of first appearance. TACO's einsum parser only reads letters.
+std::string letter_expression(const std::string &expression) {
+  if (expression.find_first_of("0123456789") == std::string::npos)
+    return expression;
+  static const std::string letters =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  EinsumLabels labels = parse_einsum_labels(expression);
+  std::unordered_map<int, char> renamed;
+  auto rename = [&](const std::vector<int> &operand) {
+    std::string out;
+    for (int label : operand) {
+      auto it = renamed.find(label);
+      if (it == renamed.end()) {
+        if (renamed.size() == letters.size())
+          throw std::invalid_argument(
+              "TACO supports at most 52 index variables: " + expression);
+        it = renamed.emplace(label, letters[renamed.size()]).first;
+      }
+      out.push_back(it->second);
+    }
+    return out;
+  };
+  std::string result;
+  for (size_t i = 0; i < labels.inputs.size(); ++i)
+    result += (i ? "," : "") + rename(labels.inputs[i]);
+  return result + "->" + rename(labels.output);
+}
+} // namespace
+
 Einsum::Einsum(std::vector<TensorPtr> inputs, TensorPtr Out,
-               std::string expression) {
+               std::string expression)
+    : OpNode(OP_EINSUM) {
   this->inputs = inputs;
   for (auto &input : inputs)
     input->numOps++;
@@ -74,80 +225,81 @@ Einsum::Einsum(std::vector<TensorPtr> inputs, TensorPtr Out,
   this->output = Out;
   this->output->outputTensor = true;
 
-  int arrowPos = expression.find("->");
-  std::string lhs = expression.substr(0, arrowPos);
-  outputInds = expression.substr(arrowPos + 2);
-
-  std::stringstream ss(lhs);
-  std::string token;
-
-  while (std::getline(ss, token, ','))
-    tensorIndicesVector.push_back(token);
-
-  for (char c : outputInds) {
-    for (int i = 0; i < tensorIndicesVector.size(); ++i) {
-      int pos = tensorIndicesVector[i].find(c);
-      if (pos != std::string::npos)
-        outputDims[c].push_back(std::make_pair(i, pos));
+  EinsumLabels labels = parse_einsum_labels(expression);
+  outputInds = std::move(labels.output);
+  tensorIndicesVector = std::move(labels.inputs);
+
+  // intern the variables: output variables first, in output order
+  std::unordered_map<int, int> labelIds;
+  auto intern = [&](int label) {
+    const int next = indexVars.size();
+    auto it = labelIds.emplace(label, next).first;
+    if (it->second == next)
+      indexVars.push_back(label);
+    return it->second;
+  };
+  for (int label : outputInds)
+    outputVarIds.push_back(intern(label));
+  const int numOutputVars = indexVars.size();
+  inputVarIds.resize(tensorIndicesVector.size());
+  for (int i = 0; i < tensorIndicesVector.size(); ++i)
+    for (int label : tensorIndicesVector[i])
+      inputVarIds[i].push_back(intern(label));
+
+  // a variable labels the first dimension of each input it appears in
+  std::vector<std::vector<IndexVarTable::Entry>> outputLists(indexVars.size());
+  std::vector<std::vector<IndexVarTable::Entry>> reductionLists(
+      indexVars.size());
+  for (int i = 0; i < inputVarIds.size(); ++i) {
+    for (int pos = 0; pos < inputVarIds[i].size(); ++pos) {
+      int var = inputVarIds[i][pos];
+      auto &list = var < numOutputVars ? outputLists[var] : reductionLists[var];
+      if (list.empty() || list.back().first != i)
+        list.push_back(std::make_pair(i, pos));
     }
   }
+  outputDims = IndexVarTable(outputLists);
+  reductionDims = IndexVarTable(reductionLists);
+}
 
-  for (int i = 0; i < tensorIndicesVector.size(); ++i) {
-    for (int j = 0; j < tensorIndicesVector[i].size(); ++j) {
-      char c = tensorIndicesVector[i][j];
-
-      if (outputDims.find(c) != outputDims.end())
-        continue;
-      if (reductionDims.find(c) != reductionDims.end())
-        continue;
-
-      reductionDims[c].push_back(std::make_pair(i, j));
-
-      for (int k = i + 1; k < tensorIndicesVector.size(); ++k) {
-        int pos = tensorIndicesVector[k].find(c);
-        if (pos != std::string::npos) {
-          reductionDims[c].push_back(std::make_pair(k, pos));
-        }
-      }
-    }
-  }
+int Einsum::index_var_id(int indexVar) const {
+  auto it = std::find(indexVars.begin(), indexVars.end(), indexVar);
+  return it == indexVars.end() ? -1 : static_cast<int>(it - indexVars.begin());
 }
 
-std::vector<std::shared_ptr<SparsityVector>>
-Einsum::get_reduction_sparsity_vectors(char indexVar) {
-  std::vector<std::shared_ptr<SparsityVector>> ret;
-  for (auto tensorLoc : reductionDims[indexVar])
-    ret.push_back(std::make_shared<SparsityVector>(
-        inputs[tensorLoc.first]->sparsities[tensorLoc.second]));
+std::vector<const SparsityVector *>
+Einsum::get_reduction_sparsity_vectors(int indexVar) {
+  std::vector<const SparsityVector *> ret;
+  for (auto &tensorLoc : reductionDims[index_var_id(indexVar)])
+    ret.push_back(&inputs[tensorLoc.first]->sparsities[tensorLoc.second]);
 
   return ret;
 }
 
-std::vector<std::shared_ptr<SparsityVector>>
-Einsum::get_output_sparsity_vectors(char indexVar) {
-  std::vector<std::shared_ptr<SparsityVector>> ret;
-  for (auto tensorLoc : outputDims[indexVar])
-    ret.push_back(std::make_shared<SparsityVector>(
-        inputs[tensorLoc.first]->sparsities[tensorLoc.second]));
+std::vector<const SparsityVector *>
+Einsum::get_output_sparsity_vectors(int indexVar) {
+  std::vector<const SparsityVector *> ret;
+  for (auto &tensorLoc : outputDims[index_var_id(indexVar)])
+    ret.push_back(&inputs[tensorLoc.first]->sparsities[tensorLoc.second]);
 
   return ret;
 }
 
-char Einsum::get_tensor_ind_var(TensorPtr tensor, int indDimension) {
-  char ret{'?'};
+int Einsum::get_tensor_ind_var(TensorPtr tensor, int indDimension) {
+  int ret{-1};
   for (int i = 0; i < inputs.size(); ++i) {
     if (tensor.get() == inputs[i].get()) {
       ret = tensorIndicesVector[i][indDimension];
       break;
     }
   }
-  assert(ret != '?' && "Tensor has to be an input to use this function!");
+  assert(ret != -1 && "Tensor has to be an input to use this function!");
   return ret;
 }
 
-int Einsum::get_tensor_char_ind(TensorPtr tensor, char indexVar) {
+int Einsum::get_tensor_char_ind(TensorPtr tensor, int indexVar) {
   int ind = -1;
-  for (int i = 0; i < outputInds.length(); ++i) {
+  for (int i = 0; i < outputInds.size(); ++i) {
     if (outputInds[i] == indexVar) {
       ind = i;
       break;
@@ -161,7 +313,8 @@ void Einsum::set_expression() {
   for (auto input : inputs)
     tensors.push_back(*input->data);
   taco::Format format{output->data->getStorage().getFormat()};
-  taco::parser::EinsumParser parser(expression, tensors, format,
+  taco::parser::EinsumParser parser(letter_expression(expression), tensors,
+                                    format,
                                     taco::Datatype::Float32);
   parser.parse();
   std::string name = output->data->getName();
@@ -174,44 +327,67 @@ void Einsum::set_expression() {
 void Einsum::propagate_forward() {
   if (output->numDims == 0)
     return;
-  for (int i = 0; i < outputInds.length(); ++i) {
-    SparsityVector inputSparsityVector;
-    inputSparsityVector.set();
+  for (int i = 0; i < outputInds.size(); ++i) {
+    SparsityVector inputSparsityVector(output->sizes[i], true);
 
-    char c = outputInds[i];
-    for (auto p : outputDims[c]) {
+    std::vector<const SparsityVector *> operands;
+    for (auto &p : outputDims[outputVarIds[i]]) {
       int inputInd = p.first;  // which of the inputs
       int inputDim = p.second; // which dimension
-      inputSparsityVector &= inputs[inputInd]->sparsities[inputDim];
+      operands.push_back(&inputs[inputInd]->sparsities[inputDim]);
     }
+    and_all(inputSparsityVector, operands);
     output->sparsities[i] &= inputSparsityVector;
   }
 }
 
 void Einsum::propagate_intra() {
-  for (auto kv : reductionDims) { // iterate over character: pair(inputInd,
-                                  // inputDim) map.
-    for (auto p : kv.second) {
+  for (int var = 0; var < reductionDims.num_vars(); ++var) {
+    for (auto &p : reductionDims[var]) {
       int inputInd = p.first;  // which of the inputs
       int inputDim = p.second; // which dimension
       inputs[inputInd]->sparsities[inputDim] &=
-          propagate_intra_dimension(inputInd, inputDim, kv.first);
+          propagate_intra_dimension(inputInd, inputDim, indexVars[var]);
     }
   }
 }
 
 void Einsum::propagate_backward() {
-  for (auto kv : outputDims) { // iterate over character: pair(inputInd,
-                               // inputDim) map.
-    for (auto p : kv.second) {
+  for (int var = 0; var < outputDims.num_vars(); ++var) {
+    for (auto &p : outputDims[var]) {
       int inputInd = p.first;  // which of the inputs
       int inputDim = p.second; // which dimension
       inputs[inputInd]->sparsities[inputDim] &=
-          propagate_intra_dimension(inputInd, inputDim, kv.first);
+          propagate_intra_dimension(inputInd, inputDim, indexVars[var]);
     }
   }
 }
 
+std::vector<SparsityUpdate> Einsum::compute_updates(Direction dir) {
+  std::vector<SparsityUpdate> updates;
+  if (dir == FORWARD) {
+    for (int i = 0; i < outputInds.size(); ++i) {
+      SparsityVector inputSparsityVector(output->sizes[i], true);
+      std::vector<const SparsityVector *> operands;
+      for (auto &p : outputDims[outputVarIds[i]])
+        operands.push_back(&inputs[p.first]->sparsities[p.second]);
+      and_all(inputSparsityVector, operands);
+      updates.push_back({output.get(), i, std::move(inputSparsityVector)});
+    }
+    return updates;
+  }
+  if (dir == INTRA && inputs.size() < 2)
+    return updates;
+  auto &dims = dir == INTRA ? reductionDims : outputDims;
+  for (int var = 0; var < dims.num_vars(); ++var) {
+    for (auto &p : dims[var])
+      updates.push_back(
+          {inputs[p.first].get(), p.second,
+           propagate_intra_dimension(p.first, p.second, indexVars[var])});
+  }
+  return updates;
+}
+
 void Einsum::propagate(Direction dir) {
   switch (dir) {
   case FORWARD:
@@ -226,12 +402,65 @@ void Einsum::propagate(Direction dir) {
     break;
   }
 }
+void Einsum::lower(Direction dir, PropagationProgram &program) {
+  if (dir == FORWARD) {
+    for (int i = 0; i < outputInds.size(); ++i) {
+      program.begin_instruction(dir, output.get(), i);
+      program.begin_group();
+      for (auto &p : outputDims[outputVarIds[i]])
+        program.add_source(inputs[p.first].get(), p.second);
+    }
+    return;
+  }
+  if (dir == INTRA && inputs.size() < 2)
+    return;
+  // same table, same order as propagate_intra()/propagate_backward()
+  auto &dims = dir == INTRA ? reductionDims : outputDims;
+  for (int var = 0; var < dims.num_vars(); ++var)
+    for (auto &p : dims[var])
+      lower_intra_dimension(p.first, p.second, dir, program);
+}
+
+void Einsum::lower_intra_dimension(int inputInd, int inputDim, Direction dir,
+                                   PropagationProgram &program) {
+  program.begin_instruction(dir, inputs[inputInd].get(), inputDim);
+  // one group per term ORed by propagate_intra_dimension(), mirroring
+  // compute_multiop_sparsity()
+  for (uint32_t consumer : input_consumers(inputInd)) {
+    OpNode *opPtr = links->ops[consumer];
+    auto lower = multiopRules[opPtr->kind].lower;
+    if (lower)
+      lower(*this, opPtr, inputInd, inputDim, program);
+  }
+}
+
+void Einsum::lower_multiop_add_sparsity(Add *opPtr, int inputInd, int inputDim,
+                                        PropagationProgram &program) {
+  program.begin_group();
+  program.add_source(opPtr->output.get(), inputDim);
+}
+
+void Einsum::lower_multiop_einsum_sparsity(Einsum *opPtr, int inputInd,
+                                           int inputDim,
+                                           PropagationProgram &program) {
+  int var = opPtr->inputVarIds[inputInd][inputDim];
+  program.begin_group();
+  int ind = get_tensor_char_ind(opPtr->output, opPtr->indexVars[var]);
+  if (ind != -1) {
+    program.add_source(opPtr->output.get(), ind);
+  } else {
+    assert(!opPtr->reductionDims[var].empty());
+    for (auto &p : opPtr->reductionDims[var])
+      program.add_source(opPtr->inputs[p.first].get(), p.second);
+  }
+}
+
 // op: pointer to Add
 // inputInd: the location of the input propagating to in THIS Einsum
 // inputDim: the dim of the input propagating to in THIS Einsum
 SparsityVector Einsum::or_all_operands_add(Add *op, int inputInd,
                                            int inputDim) {
-  SparsityVector inputSparsityVector;
+  SparsityVector inputSparsityVector(inputs[inputInd]->sizes[inputDim]);
   for (auto input : op->inputs) { // go through ops in the addition and skip
                                   // the current one
     if (input.get() == inputs[inputInd].get())
@@ -242,87 +471,13 @@ SparsityVector Einsum::or_all_operands_add(Add *op, int inputInd,
   return inputSparsityVector;
 }
 
-// inputInd: the location of the input propagating to in THIS Einsum
-// inputDim: the dim of the input propagating to in THIS Einsum
-SparsityVector Einsum::and_all_operands_einsum(Einsum *einsumOp, int inputInd,
-                                               int inputDim) {
-  SparsityVector inputSparsityVector;
-  inputSparsityVector.set();
-  int currInd{};
-  char currChar{};
-  // find the index of this operand in einsumOp, save into currInd
-  // use currInd to get the char IndexVar of this tensor, save to currChar
-  for (int i = 0; i < einsumOp->inputs.size(); ++i) {
-    if (einsumOp->inputs[i].get() != inputs[inputInd].get())
-      continue;
-    currInd = i;
-    currChar = einsumOp->tensorIndicesVector[currInd][inputDim];
-    break;
-  }
-  // iterate all reduction vars corresponding to this char
-  for (auto loc : einsumOp->reductionDims[currChar]) {
-    if (einsumOp->inputs[loc.first].get() == inputs[inputInd].get())
-      continue;
-    // einsumOp->inputs[loc.first]->name << ")" << std::endl;
-    inputSparsityVector &= einsumOp->inputs[loc.first]->sparsities[loc.second];
-  }
-  return inputSparsityVector;
-}
-
-// returns op output sparsity for the corresponding dimension or empty set
-// if not in output
-SparsityVector Einsum::op_output_sparsity_einsum(Einsum *einsumOp, int inputInd,
-                                                 int inputDim) {
-  char outputChar = '?';
-  for (int i = 0; i < einsumOp->inputs.size(); ++i) {
-    auto einsumInputTensor = einsumOp->inputs[i];
-    if (einsumInputTensor.get() != inputs[inputInd].get())
-      continue;
-    outputChar = einsumOp->tensorIndicesVector[i][inputDim];
-  }
-  assert(outputChar != '?');
-  int outputInd = -1;
-  for (int i = 0; i < einsumOp->outputInds.length(); ++i) {
-    if (einsumOp->outputInds[i] == outputChar) {
-      outputInd = i;
-      break;
-    }
-  }
-
-  if (outputInd == -1)
-    return SparsityVector(); // not in the output: return empty bitset
-  return einsumOp->output->sparsities[outputInd];
-}
-
-SparsityVector Einsum::propagate_intra_multiop(OpNodePtr op, int inputInd,
-                                               int inputDim) {
-  SparsityVector inputSparsityVector; // start off 0
-  OpNode *opPtr = op.get();
-  if (typeid(*opPtr) == typeid(Add)) {
-    Add *addPtr = dynamic_cast<Add *>(opPtr);
-    auto addSparsityVectors = addPtr->get_input_sparsity_vectors(inputDim);
-    for (int i = 0; i < addSparsityVectors.size(); ++i) {
-      if (i == inputInd)
-        continue;
-      inputSparsityVector |= *addSparsityVectors[i];
-    }
-  } else if (typeid(*opPtr) == typeid(Einsum)) {
-    Einsum *einsumOp = dynamic_cast<Einsum *>(op.get());
-    inputSparsityVector |=
-        and_all_operands_einsum(einsumOp, inputInd, inputDim);
-    inputSparsityVector |=
-        op_output_sparsity_einsum(einsumOp, inputInd, inputDim);
-  }
-  return inputSparsityVector;
-}
-
 SparsityVector Einsum::propagate_intra_dimension(int inputInd, int inputDim,
-                                                 char indexChar) {
-  SparsityVector inputSparsityVector;
+                                                 int indexChar) {
+  SparsityVector inputSparsityVector(inputs[inputInd]->sizes[inputDim]);
 
-  for (auto op : inputs[inputInd]->inputOps) {
-    auto opPtr = op.get();
-    inputSparsityVector |= compute_multiop_sparsity(opPtr, inputInd, inputDim);
+  for (uint32_t consumer : input_consumers(inputInd)) {
+    inputSparsityVector |=
+        compute_multiop_sparsity(links->ops[consumer], inputInd, inputDim);
   }
 
   return inputSparsityVector;
@@ -331,22 +486,24 @@ SparsityVector Einsum::propagate_intra_dimension(int inputInd, int inputDim,
 SparsityVector Einsum::compute_multiop_einsum_sparsity(Einsum *opPtr,
                                                        int inputInd,
                                                        int inputDim) {
-  char indexVar = opPtr->tensorIndicesVector[inputInd][inputDim];
-  SparsityVector inputSparsityVector;
+  int var = opPtr->inputVarIds[inputInd][inputDim];
+  SparsityVector inputSparsityVector(inputs[inputInd]->sizes[inputDim]);
 
-  if (opPtr->outputDims.find(indexVar) != opPtr->outputDims.end()) {
-    int ind = get_tensor_char_ind(opPtr->output, indexVar);
+  int ind = get_tensor_char_ind(opPtr->output, opPtr->indexVars[var]);
+  if (ind != -1) {
     inputSparsityVector = opPtr->output->sparsities[ind];
   } else {
-    assert(opPtr->reductionDims.find(indexVar) != opPtr->reductionDims.end());
-    auto pairs = opPtr->reductionDims[indexVar];
+    auto pairs = opPtr->reductionDims[var];
+    assert(!pairs.empty());
     inputSparsityVector.set();
-    for (auto p : pairs) {
+    std::vector<const SparsityVector *> operands;
+    for (auto &p : pairs) {
       int otherInputInd = p.first;  // which of the inputs
       int otherInputDim = p.second; // which dimension
-      inputSparsityVector &=
-          opPtr->inputs[otherInputInd]->sparsities[otherInputDim];
+      operands.push_back(
+          &opPtr->inputs[otherInputInd]->sparsities[otherInputDim]);
     }
+    and_all(inputSparsityVector, operands);
   }
 
   return inputSparsityVector;
@@ -360,19 +517,10 @@ SparsityVector Einsum::compute_multiop_add_sparsity(Add *opPtr, int inputInd,
 
 SparsityVector Einsum::compute_multiop_sparsity(OpNode *opPtr, int inputInd,
                                                 int inputDim) {
-  SparsityVector inputSparsityVector;
-
-  if (typeid(*opPtr) == typeid(Add)) {
-    Add *addPtr = dynamic_cast<Add *>(opPtr);
-    inputSparsityVector =
-        compute_multiop_add_sparsity(addPtr, inputInd, inputDim);
-  } else if (typeid(*opPtr) == typeid(Einsum)) {
-    Einsum *einPtr = dynamic_cast<Einsum *>(opPtr);
-    inputSparsityVector =
-        compute_multiop_einsum_sparsity(einPtr, inputInd, inputDim);
-  }
-
-  return inputSparsityVector;
+  auto sparsity = multiopRules[opPtr->kind].sparsity;
+  if (!sparsity)
+    return SparsityVector(inputs[inputInd]->sizes[inputDim]);
+  return sparsity(*this, opPtr, inputInd, inputDim);
 }
 
 void Einsum::print() {
@@ -399,6 +547,7 @@ void Einsum::print_sparsity() {
 std::string Einsum::op_type() const { return "Einsum"; }
 
 void Einsum::compute() {
-  this->output->data->assemble();
+  if (!this->output->assembled)
+    this->output->data->assemble();
   this->output->data->compute();
 }
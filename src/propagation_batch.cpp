@@ -0,0 +1,125 @@
+#include "../include/propagation_batch.hpp"
+#include <cassert>
+
+using Word = SparsityVector::Word;
+
+constexpr size_t PropagationBatch::MAX_SCENARIOS;
+
+PropagationBatch::PropagationBatch(const Graph &graph, size_t numScenarios)
+    : graph(graph), numScenarios(numScenarios) {
+  assert(numScenarios > 0 && numScenarios <= MAX_SCENARIOS);
+  const Word all = numScenarios == MAX_SCENARIOS
+                       ? ~Word{0}
+                       : (Word{1} << numScenarios) - 1;
+  const PropagationProgram &program = graph.program;
+  slices.resize(program.num_slots());
+  for (size_t slot = 0; slot < slices.size(); ++slot) {
+    auto &vector = program.slot_vector(slot);
+    const SparsityVector &sparsity = vector.first->sparsities[vector.second];
+    slices[slot].resize(sparsity.size());
+    for (size_t j = 0; j < sparsity.size(); ++j)
+      slices[slot][j] = sparsity.test(j) ? all : 0;
+  }
+}
+
+void PropagationBatch::set_sparsity(size_t scenario, const Tensor &tensor,
+                                    int dim, const SparsityVector &sparsity) {
+  assert(scenario < numScenarios);
+  int slot = graph.program.find_slot(&tensor, dim);
+  assert(slot != -1 && "the graph's analysis does not use this vector");
+  auto &slice = slices[slot];
+  assert(sparsity.size() == slice.size());
+  const Word bit = Word{1} << scenario;
+  for (size_t j = 0; j < slice.size(); ++j)
+    slice[j] = sparsity.test(j) ? slice[j] | bit : slice[j] & ~bit;
+}
+
+SparsityVector PropagationBatch::get_sparsity(size_t scenario,
+                                              const Tensor &tensor,
+                                              int dim) const {
+  assert(scenario < numScenarios);
+  int slot = graph.program.find_slot(&tensor, dim);
+  if (slot == -1)
+    return tensor.sparsities[dim];
+  auto &slice = slices[slot];
+  SparsityVector sparsity(slice.size());
+  for (size_t j = 0; j < slice.size(); ++j)
+    if ((slice[j] >> scenario) & 1)
+      sparsity.set(j);
+  sparsity.optimize();
+  return sparsity;
+}
+
+bool PropagationBatch::run_propagation(Direction dir) {
+  return graph.program.run_sliced(dir, slices);
+}
+
+PropagationStats
+PropagationBatch::run_propagation(const PropagationOptions &options) {
+  size_t before = count_all();
+  PropagationStats stats;
+  bool changed = true;
+  while (changed &&
+         (options.maxRounds == 0 || stats.rounds < options.maxRounds)) {
+    ++stats.rounds;
+    changed = false;
+    for (Direction dir : {FORWARD, INTRA, BACKWARD}) {
+      changed |= graph.program.run_sliced(dir, slices);
+      stats.opsVisited += graph.program.size(dir);
+    }
+  }
+  stats.converged = !changed;
+  stats.bitsCleared = before - count_all();
+  return stats;
+}
+
+std::vector<int> PropagationBatch::scenario_bits(const Tensor &tensor,
+                                                 int dim) const {
+  std::vector<int> bits(numScenarios, 0);
+  int slot = graph.program.find_slot(&tensor, dim);
+  if (slot == -1) {
+    bits.assign(numScenarios,
+                count_bits(tensor.sparsities[dim], tensor.sizes[dim]));
+    return bits;
+  }
+  // count_bits() only looks at the first sizes[dim] bits
+  auto &slice = slices[slot];
+  size_t end = std::min<size_t>(slice.size(), tensor.sizes[dim]);
+  for (size_t j = 0; j < end; ++j)
+    for (Word word = slice[j]; word; word &= word - 1)
+      ++bits[__builtin_ctzll(word)];
+  return bits;
+}
+
+size_t PropagationBatch::count_all() const {
+  size_t bits = 0;
+  for (auto &slice : slices)
+    for (Word word : slice)
+      bits += __builtin_popcountll(word);
+  return bits;
+}
+
+std::vector<float> PropagationBatch::get_sparsity_ratios() const {
+  // same tensors, with the same multiplicity, as Graph::get_sparsity_ratio()
+  std::vector<const Tensor *> tensors;
+  for (auto &op : graph.nodes)
+    for (auto &input : op->inputs)
+      tensors.push_back(input.get());
+  tensors.push_back(graph.output.get());
+
+  std::vector<float> totals(numScenarios, 0);
+  for (const Tensor *tensor : tensors) {
+    std::vector<std::vector<int>> bits;
+    for (int dim = 0; dim < tensor->numDims; ++dim)
+      bits.push_back(scenario_bits(*tensor, dim));
+    std::vector<int> setBits(tensor->numDims);
+    for (size_t s = 0; s < numScenarios; ++s) {
+      for (int dim = 0; dim < tensor->numDims; ++dim)
+        setBits[dim] = bits[dim][s];
+      totals[s] += Tensor::get_sparsity_ratio(tensor->sizes, setBits);
+    }
+  }
+  for (auto &total : totals)
+    total /= tensors.size();
+  return totals;
+}
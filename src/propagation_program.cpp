@@ -0,0 +1,261 @@
+#include "../include/propagation_program.hpp"
+#include "../include/bit_kernels.hpp"
+#include "../include/tensor.hpp"
+#include <algorithm>
+
+using Word = SparsityVector::Word;
+
+void PropagationProgram::clear() {
+  slots.clear();
+  slotOf.clear();
+  sources.clear();
+  groups.clear();
+  for (auto &instructions : code)
+    instructions.clear();
+  readerIndex.clear();
+  writerIndex.clear();
+}
+
+uint32_t PropagationProgram::slot(Tensor *tensor, int dim) {
+  assert(dim >= 0 && dim < tensor->numDims);
+  auto &tensorSlots = slotOf[tensor];
+  if (tensorSlots.empty())
+    tensorSlots.assign(tensor->numDims, UINT32_MAX);
+  if (tensorSlots[dim] == UINT32_MAX) {
+    tensorSlots[dim] = static_cast<uint32_t>(slots.size());
+    slots.emplace_back(tensor, dim);
+  }
+  return tensorSlots[dim];
+}
+
+void PropagationProgram::begin_instruction(Direction dir, Tensor *tensor,
+                                           int dim) {
+  uint32_t next = static_cast<uint32_t>(groups.size());
+  code[dir].push_back({slot(tensor, dim), next, next});
+  currentDir = dir;
+  readerIndex.clear();
+  writerIndex.clear();
+}
+
+void PropagationProgram::begin_group() {
+  assert(!code[currentDir].empty() && "begin_instruction() must come first");
+  uint32_t next = static_cast<uint32_t>(sources.size());
+  groups.push_back({next, next});
+  code[currentDir].back().groupEnd = static_cast<uint32_t>(groups.size());
+}
+
+void PropagationProgram::add_source(Tensor *tensor, int dim) {
+  assert(!groups.empty() && "begin_group() must come first");
+  uint32_t src = slot(tensor, dim);
+  sources.push_back(src);
+  groups.back().end = static_cast<uint32_t>(sources.size());
+}
+
+template <class Operand>
+bool PropagationProgram::execute_words(const Instruction &ins, Word *dst,
+                                       size_t n, Operand operand,
+                                       std::vector<Word> &acc,
+                                       std::vector<Word> &term) const {
+  const BitKernels &kernels = bit_kernels();
+
+  // dst &= src: the most common instruction
+  if (ins.groupEnd - ins.groupBegin == 1 &&
+      groups[ins.groupBegin].end - groups[ins.groupBegin].begin == 1) {
+    auto src = operand(sources[groups[ins.groupBegin].begin]);
+    size_t covered = std::min(n, src.second);
+    bool changed = kernels.and_changed_words(dst, src.first, covered);
+    for (size_t i = covered; i < n; ++i) {
+      changed |= dst[i] != 0;
+      dst[i] = 0;
+    }
+    return changed;
+  }
+
+  // evaluate the sum of products into scratch buffers sized to dst,
+  // zero-extending shorter operands
+  acc.assign(n, 0);
+  term.resize(n);
+  for (uint32_t g = ins.groupBegin; g < ins.groupEnd; ++g) {
+    auto first = operand(sources[groups[g].begin]);
+    size_t covered = std::min(n, first.second);
+    std::copy(first.first, first.first + covered, term.begin());
+    for (uint32_t i = groups[g].begin + 1; i < groups[g].end; ++i) {
+      auto src = operand(sources[i]);
+      covered = std::min(covered, src.second);
+      kernels.and_words(term.data(), src.first, covered);
+    }
+    kernels.or_words(acc.data(), term.data(), covered);
+  }
+  return kernels.and_changed_words(dst, acc.data(), n);
+}
+
+bool PropagationProgram::run(Direction dir) const {
+  std::vector<Word> acc, term;
+  bool changed = false;
+  for (const Instruction &ins : code[dir])
+    changed |= execute(ins, acc, term);
+  return changed;
+}
+
+bool PropagationProgram::run_sliced(
+    Direction dir, std::vector<std::vector<Word>> &slices) const {
+  assert(slices.size() == slots.size());
+  auto operand = [&](uint32_t slot) {
+    return std::make_pair<const Word *, size_t>(slices[slot].data(),
+                                                slices[slot].size());
+  };
+  std::vector<Word> acc, term;
+  bool changed = false;
+  for (const Instruction &ins : code[dir]) {
+    if (has_empty_group(ins))
+      continue;
+    auto &dst = slices[ins.dst];
+    changed |= execute_words(ins, dst.data(), dst.size(), operand, acc, term);
+  }
+  return changed;
+}
+
+const PropagationProgram::Instruction &
+PropagationProgram::instruction(size_t id) const {
+  for (const auto &instructions : code) {
+    if (id < instructions.size())
+      return instructions[id];
+    id -= instructions.size();
+  }
+  assert(false && "instruction id out of range");
+  return code[BACKWARD].back();
+}
+
+bool PropagationProgram::run_instruction(size_t id) const {
+  std::vector<Word> acc, term;
+  return execute(instruction(id), acc, term);
+}
+
+size_t PropagationProgram::run_instruction_atomic(size_t id,
+                                                  std::vector<Word> &acc,
+                                                  std::vector<Word> &term) const {
+  const Instruction &ins = instruction(id);
+  if (has_empty_group(ins))
+    return 0;
+  SparsityVector &dst = sparsity(ins.dst);
+  assert(!dst.is_compressed() && "concurrent runs need dense slots");
+  const size_t n = dst.num_words();
+  auto load = [](const Word *word) {
+    return __atomic_load_n(word, __ATOMIC_RELAXED);
+  };
+
+  // the sum of products, zero-extending shorter operands as execute_words()
+  acc.assign(n, 0);
+  term.resize(n);
+  for (uint32_t g = ins.groupBegin; g < ins.groupEnd; ++g) {
+    const SparsityVector &first = sparsity(sources[groups[g].begin]);
+    assert(!first.is_compressed() && "concurrent runs need dense slots");
+    size_t covered = std::min(n, first.num_words());
+    for (size_t w = 0; w < covered; ++w)
+      term[w] = load(first.data() + w);
+    for (uint32_t i = groups[g].begin + 1; i < groups[g].end; ++i) {
+      const SparsityVector &src = sparsity(sources[i]);
+      assert(!src.is_compressed() && "concurrent runs need dense slots");
+      covered = std::min(covered, src.num_words());
+      for (size_t w = 0; w < covered; ++w)
+        term[w] &= load(src.data() + w);
+    }
+    for (size_t w = 0; w < covered; ++w)
+      acc[w] |= term[w];
+  }
+
+  Word *words = dst.data();
+  size_t cleared = 0;
+  for (size_t w = 0; w < n; ++w) {
+    if ((load(words + w) & ~acc[w]) == 0)
+      continue;
+    Word old = __atomic_fetch_and(words + w, acc[w], __ATOMIC_RELAXED);
+    cleared += __builtin_popcountll(old & ~acc[w]);
+  }
+  return cleared;
+}
+
+void PropagationProgram::index_slots() const {
+  if (readerIndex.size() == slots.size())
+    return;
+  readerIndex.assign(slots.size(), {});
+  writerIndex.assign(slots.size(), {});
+  size_t id = 0;
+  for (const auto &instructions : code)
+    for (const Instruction &ins : instructions) {
+      writerIndex[ins.dst].push_back(id);
+      for (uint32_t i = groups[ins.groupBegin].begin;
+           ins.groupEnd > ins.groupBegin && i < groups[ins.groupEnd - 1].end;
+           ++i) {
+        auto &list = readerIndex[sources[i]];
+        if (list.empty() || list.back() != id)
+          list.push_back(id);
+      }
+      ++id;
+    }
+}
+
+const std::vector<size_t> &PropagationProgram::readers(uint32_t slot) const {
+  index_slots();
+  return readerIndex[slot];
+}
+
+const std::vector<size_t> &PropagationProgram::writers(uint32_t slot) const {
+  index_slots();
+  return writerIndex[slot];
+}
+
+int PropagationProgram::find_slot(const Tensor *tensor, int dim) const {
+  auto it = slotOf.find(tensor);
+  if (it == slotOf.end() || dim < 0 || dim >= it->second.size() ||
+      it->second[dim] == UINT32_MAX)
+    return -1;
+  return static_cast<int>(it->second[dim]);
+}
+
+bool PropagationProgram::has_empty_group(const Instruction &ins) const {
+  for (uint32_t g = ins.groupBegin; g < ins.groupEnd; ++g)
+    if (groups[g].begin == groups[g].end)
+      return true;
+  return false;
+}
+
+SparsityVector &PropagationProgram::sparsity(uint32_t slot) const {
+  // looked up on every access: tensors may have replaced their vectors since
+  // the program was lowered
+  return slots[slot].first->sparsities[slots[slot].second];
+}
+
+bool PropagationProgram::execute(const Instruction &ins,
+                                 std::vector<Word> &acc,
+                                 std::vector<Word> &term) const {
+  // a group without sources is all ones, which leaves dst unchanged
+  if (has_empty_group(ins))
+    return false;
+  SparsityVector &dst = sparsity(ins.dst);
+
+  bool dense = !dst.is_compressed();
+  for (uint32_t g = ins.groupBegin; dense && g < ins.groupEnd; ++g)
+    for (uint32_t i = groups[g].begin; dense && i < groups[g].end; ++i)
+      dense = !sparsity(sources[i]).is_compressed();
+
+  if (!dense) {
+    SparsityVector result(dst.size());
+    for (uint32_t g = ins.groupBegin; g < ins.groupEnd; ++g) {
+      SparsityVector product(dst.size(), true);
+      for (uint32_t i = groups[g].begin; i < groups[g].end; ++i)
+        product &= sparsity(sources[i]);
+      result |= product;
+    }
+    return and_changed(dst, result);
+  }
+
+  auto operand = [&](uint32_t slot) {
+    const SparsityVector &src = sparsity(slot);
+    return std::make_pair(src.data(), src.num_words());
+  };
+  bool changed =
+      execute_words(ins, dst.data(), dst.num_words(), operand, acc, term);
+  dst.optimize();
+  return changed;
+}
@@ -0,0 +1,44 @@
+#include "../include/sparsity_arena.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace {
+constexpr size_t LINE_WORDS =
+    SparsityArena::ALIGNMENT / sizeof(SparsityArena::Word);
+} // namespace
+
+SparsityArena::SparsityArena(size_t words) : capacityWords(words) {
+  if (words == 0)
+    return;
+  void *ptr = nullptr;
+  if (posix_memalign(&ptr, ALIGNMENT, words * sizeof(Word)) != 0)
+    throw std::bad_alloc();
+  slab = static_cast<Word *>(ptr);
+}
+
+SparsityArena::~SparsityArena() { free(slab); }
+
+size_t SparsityArena::slot_words(size_t words) {
+  return (words + LINE_WORDS - 1) / LINE_WORDS * LINE_WORDS;
+}
+
+SparsityArena::Word *SparsityArena::allocate(size_t words) {
+  size_t slot = slot_words(words);
+  if (usedWords + slot > capacityWords)
+    return nullptr;
+  Word *ptr = slab + usedWords;
+  std::fill(ptr, ptr + slot, Word{0});
+  usedWords += slot;
+  return ptr;
+}
+
+bool SparsityArena::bind(SparsityVector &vector) {
+  if (vector.is_compressed() || vector.num_words() == 0)
+    return false;
+  Word *slot = allocate(vector.num_words());
+  if (!slot)
+    return false;
+  vector.bind(slot);
+  return true;
+}
@@ -0,0 +1,458 @@
+#include "../include/sparsity_vector.hpp"
+#include "../include/bit_kernels.hpp"
+#include <algorithm>
+#include <cassert>
+
+using Run = SparsityVector::Run;
+using Word = SparsityVector::Word;
+
+namespace {
+size_t words_for(size_t bits) {
+  return (bits + SparsityVector::WORD_BITS - 1) / SparsityVector::WORD_BITS;
+}
+
+// Sets (value = true) or clears the bits [begin, end) of a dense vector.
+void fill_range(Word *words, size_t begin, size_t end, bool value) {
+  const size_t bits = SparsityVector::WORD_BITS;
+  while (begin < end) {
+    size_t w = begin / bits;
+    size_t lo = begin % bits;
+    size_t hi = std::min(end - w * bits, bits);
+    Word mask = (hi == bits ? ~Word{0} : (Word{1} << hi) - 1) &
+                (~Word{0} << lo);
+    if (value)
+      words[w] |= mask;
+    else
+      words[w] &= ~mask;
+    begin = w * bits + hi;
+  }
+}
+
+// Number of runs of set bits: a run starts at every set bit whose predecessor
+// is clear.
+size_t count_runs(const Word *words, size_t n) {
+  size_t runs = 0;
+  Word carry = 0;
+  for (size_t i = 0; i < n; ++i) {
+    Word w = words[i];
+    runs += __builtin_popcountll(w & ~((w << 1) | carry));
+    carry = w >> (SparsityVector::WORD_BITS - 1);
+  }
+  return runs;
+}
+
+std::vector<Run> runs_of_words(const Word *words, size_t bits) {
+  const size_t n = words_for(bits);
+  std::vector<Run> runs;
+  size_t pos = 0;
+  while (pos < bits) {
+    // skip clear bits
+    size_t w = pos / SparsityVector::WORD_BITS;
+    Word cur = words[w] & (~Word{0} << (pos % SparsityVector::WORD_BITS));
+    while (cur == 0 && ++w < n)
+      cur = words[w];
+    if (cur == 0)
+      break;
+    size_t begin = w * SparsityVector::WORD_BITS + __builtin_ctzll(cur);
+    // skip set bits
+    cur = ~words[w] & (~Word{0} << (begin % SparsityVector::WORD_BITS));
+    while (cur == 0 && ++w < n)
+      cur = ~words[w];
+    size_t end = cur == 0 ? bits
+                          : std::min(bits, w * SparsityVector::WORD_BITS +
+                                               __builtin_ctzll(cur));
+    runs.push_back({static_cast<uint32_t>(begin), static_cast<uint32_t>(end)});
+    pos = end;
+  }
+  return runs;
+}
+
+void push_run(std::vector<Run> &runs, uint32_t begin, uint32_t end) {
+  if (begin >= end)
+    return;
+  if (!runs.empty() && runs.back().end >= begin)
+    runs.back().end = std::max(runs.back().end, end);
+  else
+    runs.push_back({begin, end});
+}
+
+std::vector<Run> intersect_runs(const std::vector<Run> &a,
+                                const std::vector<Run> &b) {
+  std::vector<Run> out;
+  size_t i = 0, j = 0;
+  while (i < a.size() && j < b.size()) {
+    push_run(out, std::max(a[i].begin, b[j].begin),
+             std::min(a[i].end, b[j].end));
+    if (a[i].end < b[j].end)
+      ++i;
+    else
+      ++j;
+  }
+  return out;
+}
+
+std::vector<Run> union_runs(const std::vector<Run> &a,
+                            const std::vector<Run> &b) {
+  std::vector<Run> out;
+  out.reserve(a.size() + b.size());
+  size_t i = 0, j = 0;
+  while (i < a.size() || j < b.size()) {
+    if (j == b.size() || (i < a.size() && a[i].begin < b[j].begin)) {
+      push_run(out, a[i].begin, a[i].end);
+      ++i;
+    } else {
+      push_run(out, b[j].begin, b[j].end);
+      ++j;
+    }
+  }
+  return out;
+}
+} // namespace
+
+SparsityVector::SparsityVector(size_t size, bool value) : numBits(size) {
+  if (size >= COMPRESSION_MIN_BITS) {
+    compressed = true;
+    if (value)
+      runList.push_back({0, static_cast<uint32_t>(size)});
+    return;
+  }
+  words.assign(words_for(size), value ? ~Word{0} : Word{0});
+  wordData = words.data();
+  clear_padding();
+}
+
+SparsityVector::SparsityVector(size_t size, const Word *words)
+    : numBits(size), words(words, words + words_for(size)) {
+  wordData = this->words.data();
+  clear_padding();
+  optimize();
+}
+
+SparsityVector::SparsityVector(const SparsityVector &other)
+    : numBits(other.numBits), compressed(other.compressed),
+      runList(other.runList) {
+  if (!compressed) {
+    words.assign(other.wordData, other.wordData + other.num_words());
+    wordData = words.data();
+  }
+}
+
+SparsityVector::SparsityVector(SparsityVector &&other) noexcept
+    : numBits(other.numBits), compressed(other.compressed), view(other.view),
+      words(std::move(other.words)), runList(std::move(other.runList)) {
+  wordData = view ? other.wordData : words.data();
+  if (compressed)
+    wordData = nullptr;
+  other.numBits = 0;
+  other.compressed = false;
+  other.view = false;
+  other.wordData = nullptr;
+}
+
+SparsityVector &SparsityVector::operator=(const SparsityVector &other) {
+  if (this == &other)
+    return *this;
+  if (view) {
+    assert(other.numBits == numBits && "a view cannot change length");
+    if (other.numBits == numBits) {
+      assign_in_place(other);
+      return *this;
+    }
+  }
+  view = false;
+  numBits = other.numBits;
+  compressed = other.compressed;
+  runList = other.runList;
+  if (compressed) {
+    std::vector<Word>().swap(words);
+    wordData = nullptr;
+  } else {
+    words.assign(other.wordData, other.wordData + other.num_words());
+    wordData = words.data();
+  }
+  return *this;
+}
+
+SparsityVector &SparsityVector::operator=(SparsityVector &&other) noexcept {
+  if (this == &other)
+    return *this;
+  if (view) {
+    assert(other.numBits == numBits && "a view cannot change length");
+    if (other.numBits == numBits) {
+      assign_in_place(other);
+      return *this;
+    }
+  }
+  numBits = other.numBits;
+  compressed = other.compressed;
+  view = other.view;
+  words = std::move(other.words);
+  runList = std::move(other.runList);
+  wordData = compressed ? nullptr : view ? other.wordData : words.data();
+  other.numBits = 0;
+  other.compressed = false;
+  other.view = false;
+  other.wordData = nullptr;
+  return *this;
+}
+
+void SparsityVector::assign_in_place(const SparsityVector &other) {
+  if (!other.compressed) {
+    std::copy(other.wordData, other.wordData + num_words(), wordData);
+    return;
+  }
+  std::fill(wordData, wordData + num_words(), Word{0});
+  for (const Run &r : other.runList)
+    fill_range(wordData, r.begin, r.end, true);
+}
+
+SparsityVector::SparsityVector(const std::string &bits)
+    : SparsityVector(bits.size()) {
+  for (size_t i = 0; i < numBits; ++i) {
+    char c = bits[numBits - 1 - i];
+    assert((c == '0' || c == '1') && "invalid character in bit string");
+    if (c == '1')
+      set(i);
+  }
+  optimize();
+}
+
+void SparsityVector::bind(Word *storage) {
+  decompress();
+  std::copy(wordData, wordData + num_words(), storage);
+  std::vector<Word>().swap(words);
+  wordData = storage;
+  view = true;
+}
+
+void SparsityVector::detach() {
+  if (!view)
+    return;
+  words.assign(wordData, wordData + num_words());
+  wordData = words.data();
+  view = false;
+}
+
+void SparsityVector::compress() {
+  if (compressed || view)
+    return;
+  runList = runs_of_words(wordData, numBits);
+  std::vector<Word>().swap(words);
+  wordData = nullptr;
+  compressed = true;
+}
+
+void SparsityVector::decompress() {
+  if (!compressed)
+    return;
+  words.assign(words_for(numBits), Word{0});
+  wordData = words.data();
+  for (const Run &r : runList)
+    fill_range(wordData, r.begin, r.end, true);
+  std::vector<Run>().swap(runList);
+  compressed = false;
+}
+
+void SparsityVector::optimize() {
+  if (view)
+    return;
+  if (numBits < COMPRESSION_MIN_BITS) {
+    decompress();
+    return;
+  }
+  // Runs cost 8 bytes each, like a word. Compress when runs take at most half
+  // the dense footprint and decompress once they exceed it, so vectors near
+  // the threshold do not flip on every operation.
+  size_t denseBytes = words_for(numBits) * sizeof(Word);
+  if (compressed) {
+    if (runList.size() * sizeof(Run) > denseBytes)
+      decompress();
+  } else if (count_runs(wordData, num_words()) * sizeof(Run) * 2 <=
+             denseBytes) {
+    compress();
+  }
+}
+
+size_t SparsityVector::memory_bytes() const {
+  if (compressed)
+    return runList.capacity() * sizeof(Run);
+  return view ? num_words() * sizeof(Word) : words.capacity() * sizeof(Word);
+}
+
+SparsityVector &SparsityVector::set() {
+  if (compressed) {
+    runList.assign(1, Run{0, static_cast<uint32_t>(numBits)});
+    if (numBits == 0)
+      runList.clear();
+    return *this;
+  }
+  std::fill(wordData, wordData + num_words(), ~Word{0});
+  clear_padding();
+  return *this;
+}
+
+SparsityVector &SparsityVector::set(size_t pos, bool value) {
+  assert(pos < numBits && "pos out of bounds");
+  decompress();
+  Word mask = Word{1} << (pos % WORD_BITS);
+  if (value)
+    wordData[pos / WORD_BITS] |= mask;
+  else
+    wordData[pos / WORD_BITS] &= ~mask;
+  return *this;
+}
+
+SparsityVector &SparsityVector::reset() {
+  if (compressed)
+    runList.clear();
+  else
+    std::fill(wordData, wordData + num_words(), Word{0});
+  return *this;
+}
+
+SparsityVector &SparsityVector::reset(size_t pos) { return set(pos, false); }
+
+void SparsityVector::resize(size_t size, bool value) {
+  if (view && words_for(size) != num_words())
+    detach();
+  size_t oldBits = numBits;
+  numBits = size;
+  if (compressed) {
+    while (!runList.empty() && runList.back().begin >= size)
+      runList.pop_back();
+    if (!runList.empty() && runList.back().end > size)
+      runList.back().end = static_cast<uint32_t>(size);
+    if (value && size > oldBits)
+      push_run(runList, static_cast<uint32_t>(oldBits),
+               static_cast<uint32_t>(size));
+    return;
+  }
+  if (!view) {
+    words.resize(words_for(size), value ? ~Word{0} : Word{0});
+    wordData = words.data();
+  }
+  if (value && size > oldBits && oldBits % WORD_BITS != 0)
+    wordData[oldBits / WORD_BITS] |= ~Word{0} << (oldBits % WORD_BITS);
+  clear_padding();
+}
+
+size_t SparsityVector::count() const {
+  if (compressed) {
+    size_t bits = 0;
+    for (const Run &r : runList)
+      bits += r.end - r.begin;
+    return bits;
+  }
+  return bit_kernels().popcount_words(wordData, num_words());
+}
+
+bool SparsityVector::any() const {
+  if (compressed)
+    return !runList.empty();
+  for (size_t i = 0; i < num_words(); ++i)
+    if (wordData[i])
+      return true;
+  return false;
+}
+
+SparsityVector &SparsityVector::operator&=(const SparsityVector &other) {
+  if (!compressed && !other.compressed) {
+    size_t common = std::min(num_words(), other.num_words());
+    bit_kernels().and_words(wordData, other.wordData, common);
+    std::fill(wordData + common, wordData + num_words(), Word{0});
+  } else if (compressed) {
+    runList = intersect_runs(runList, other.to_runs());
+  } else {
+    // dense &= runs: clear the gaps between the runs of other
+    size_t pos = 0;
+    for (const Run &r : other.runList) {
+      fill_range(wordData, pos, std::min<size_t>(r.begin, numBits), false);
+      pos = r.end;
+    }
+    fill_range(wordData, std::min(pos, numBits), numBits, false);
+  }
+  optimize();
+  return *this;
+}
+
+SparsityVector &SparsityVector::operator|=(const SparsityVector &other) {
+  if (other.numBits > numBits)
+    resize(other.numBits);
+  if (!compressed && !other.compressed) {
+    bit_kernels().or_words(wordData, other.wordData, other.num_words());
+  } else if (compressed) {
+    runList = union_runs(runList, other.to_runs());
+  } else {
+    for (const Run &r : other.runList)
+      fill_range(wordData, r.begin, r.end, true);
+  }
+  optimize();
+  return *this;
+}
+
+bool SparsityVector::operator==(const SparsityVector &other) const {
+  if (numBits != other.numBits)
+    return false;
+  if (!compressed && !other.compressed)
+    return std::equal(wordData, wordData + num_words(), other.wordData);
+  std::vector<Run> a = to_runs(), b = other.to_runs();
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                    [](const Run &x, const Run &y) {
+                      return x.begin == y.begin && x.end == y.end;
+                    });
+}
+
+std::string SparsityVector::to_string() const {
+  std::string bits(numBits, '0');
+  for (const Run &r : to_runs())
+    for (size_t i = r.begin; i < r.end; ++i)
+      bits[numBits - 1 - i] = '1';
+  return bits;
+}
+
+void SparsityVector::clear_padding() {
+  if (numBits % WORD_BITS != 0)
+    wordData[numBits / WORD_BITS] &= (Word{1} << (numBits % WORD_BITS)) - 1;
+}
+
+size_t SparsityVector::find_next(size_t pos) const {
+  if (pos >= numBits)
+    return numBits;
+  if (compressed) {
+    // the first run ending past pos holds the answer
+    auto it = std::upper_bound(
+        runList.begin(), runList.end(), pos,
+        [](size_t p, const Run &r) { return p < r.end; });
+    if (it == runList.end())
+      return numBits;
+    return std::max<size_t>(pos, it->begin);
+  }
+  const size_t n = num_words();
+  size_t w = pos / WORD_BITS;
+  Word cur = wordData[w] & (~Word{0} << (pos % WORD_BITS));
+  while (cur == 0 && ++w < n)
+    cur = wordData[w];
+  return cur == 0 ? numBits
+                  : std::min(numBits, w * WORD_BITS + __builtin_ctzll(cur));
+}
+
+bool SparsityVector::test_runs(size_t pos) const {
+  auto it = std::upper_bound(
+      runList.begin(), runList.end(), pos,
+      [](size_t p, const Run &r) { return p < r.begin; });
+  return it != runList.begin() && pos < (it - 1)->end;
+}
+
+std::vector<Run> SparsityVector::to_runs() const {
+  return compressed ? runList : runs_of_words(wordData, numBits);
+}
+
+SparsityVector operator&(SparsityVector lhs, const SparsityVector &rhs) {
+  lhs &= rhs;
+  return lhs;
+}
+
+SparsityVector operator|(SparsityVector lhs, const SparsityVector &rhs) {
+  lhs |= rhs;
+  return lhs;
+}
@@ -1,5 +1,8 @@
 #include "../include/tensor.hpp"
+#include "../include/thread_pool.hpp"
+#include <algorithm>
 #include <cstddef>
+#include <cstdlib>
 
 void Tensor::create_data(const double threshold) {
   taco::ModeFormat sparse = taco::Sparse;
@@ -17,6 +20,7 @@ void Tensor::create_data(const double threshold) {
   }
   this->data = std::make_shared<taco::Tensor<float>>(
       taco::Tensor<float>(this->name, this->sizes, modes));
+  this->assembled = false;
 }
 
 // constructor from sparsity vector (doesn't initialize tensor)
@@ -30,10 +34,8 @@ Tensor::Tensor(std::vector<int> sizes, std::vector<SparsityVector> sparsities,
 Tensor::Tensor(std::vector<int> sizes, const std::string &n)
     : name(n), sizes(sizes) {
   numDims = sizes.size();
-  for (int i = 0; i < numDims; ++i) {
-    sparsities.push_back(SparsityVector());
-    sparsities[i].set();
-  }
+  for (int i = 0; i < numDims; ++i)
+    sparsities.push_back(SparsityVector(sizes[i], true));
 }
 
 Tensor::Tensor(std::vector<int> sizes, const std::string &n,
@@ -41,10 +43,8 @@ Tensor::Tensor(std::vector<int> sizes, const std::string &n,
     : data(std::make_shared<taco::Tensor<float>>(n, sizes, format)), name(n),
       sizes(sizes) {
   numDims = sizes.size();
-  for (int i = 0; i < numDims; ++i) {
-    sparsities.push_back(SparsityVector());
-    sparsities[i].set();
-  }
+  for (int i = 0; i < numDims; ++i)
+    sparsities.push_back(SparsityVector(sizes[i], true));
 }
 
 Tensor::Tensor(std::vector<int> sizes, std::vector<float> sparsityRatios,
@@ -53,10 +53,8 @@ Tensor::Tensor(std::vector<int> sizes, std::vector<float> sparsityRatios,
       sizes(sizes) {
   numDims = sizes.size();
   // Initialize sparsity bitsets to 1 (active)
-  for (int i = 0; i < numDims; ++i) {
-    sparsities.push_back(SparsityVector());
-    sparsities[i].set();
-  }
+  for (int i = 0; i < numDims; ++i)
+    sparsities.push_back(SparsityVector(sizes[i], true));
 
   // number of dimensions can vary: compute indices for each one
   for (int i = 0; i < numDims; ++i) {
@@ -68,72 +66,318 @@ Tensor::Tensor(std::vector<int> sizes, std::vector<float> sparsityRatios,
 
     for (int j = 0; j < zeroCount; ++j)
       sparsities[i].set(indices[j], 0);
+    sparsities[i].optimize();
   }
 
   initialize_data();
 }
 
+Tensor::Tensor(std::shared_ptr<taco::Tensor<float>> data, size_t threads)
+    : data(data), sparsities(data_sparsities(*data, threads)),
+      name(data->getName()), sizes(data->getDimensions()) {
+  numDims = sizes.size();
+}
+
 void Tensor::create_data(taco::Format format) {
   this->data = std::make_shared<taco::Tensor<float>>(
       taco::Tensor<float>(this->name, this->sizes, format));
+  this->assembled = false;
 }
 
-void Tensor::fill_tensor() {
-  std::vector<int> positions;
-  std::vector<std::vector<int>> coords;
-  this->gen_coord(0, coords, positions);
-  for (auto coord : coords) {
-    float val = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-    this->data->insert(coord, val);
+void Tensor::fill_tensor() { initialize_data(); }
+
+namespace {
+/// Writes the values of a StorageLayout: counter_uniform(key, linear
+/// coordinate) at nonzeros, 0 at the explicit zeros of Dense levels.
+class ValueFiller {
+public:
+  ValueFiller(const StorageLayout &layout, const taco::Format &format,
+              const std::vector<int> &sizes, uint64_t key, float *values)
+      : layout(layout), modes(format.getModeFormats()),
+        ordering(format.getModeOrdering()), sizes(sizes),
+        strides(sizes.size(), 1), key(key), values(values) {
+    for (size_t dim = sizes.size() - 1; dim-- > 0;)
+      strides[dim] = strides[dim + 1] * sizes[dim + 1];
   }
-  this->data->pack();
-}
 
-void Tensor::gen_coord(size_t d, std::vector<std::vector<int>> &indices,
-                       std::vector<int> &positions) {
-  // TACO requires int
-  if (d == this->sizes.size()) {
-    indices.push_back(positions);
-  } else {
-    for (size_t i = 0; i < this->sizes[d]; i++) {
-      if (this->sparsities[d].test(i)) {
-        positions.push_back(i);
-        this->gen_coord(d + 1, indices, positions);
-        positions.pop_back();
+  /// A subtree of the storage: the children at `level` of the node at
+  /// `position` of the level above, whose coordinates so far add up to
+  /// `linear`. Subtrees of one level own disjoint value ranges.
+  struct Subtree {
+    size_t level;
+    size_t position;
+    uint64_t linear;
+  };
+
+  /// Splits the storage into the subtrees of the first level that has at
+  /// least \p minSubtrees of them, or of the values if none has.
+  std::vector<Subtree> split(size_t minSubtrees) const {
+    std::vector<Subtree> subtrees{{0, 0, 0}};
+    for (size_t level = 0;
+         level < modes.size() && subtrees.size() < minSubtrees; ++level) {
+      const int dim = ordering[level];
+      std::vector<Subtree> children;
+      for (const Subtree &parent : subtrees) {
+        if (modes[level] == taco::Dense) {
+          for (int i = 0; i < sizes[dim]; ++i)
+            children.push_back({level + 1, parent.position * sizes[dim] + i,
+                                parent.linear + i * strides[dim]});
+          continue;
+        }
+        const auto &pos = layout.pos[level];
+        const auto &crd = layout.crd[level];
+        for (int p = pos[parent.position]; p < pos[parent.position + 1]; ++p)
+          children.push_back(
+              {level + 1, size_t(p), parent.linear + crd[p] * strides[dim]});
       }
+      subtrees = std::move(children);
     }
+    return subtrees;
   }
-}
 
-void Tensor::initialize_data() {
-  // number of dimensions can vary so compute num elements
-  assert(numDims > 0);
-  taco::Format dense({taco::Dense, taco::Dense});
-  int numElements = 1;
-  for (auto size : sizes)
-    numElements *= size;
-
-  for (int numElement = 0; numElement < numElements; ++numElement) {
-    auto indices = get_indices(sizes, numElement);
-    bool isZero = false;
-
-    for (int i = 0; i < numDims; ++i) {
-      if (sparsities[i][indices[i]] == 0) {
-        isZero = true;
-        break;
+  /// Fills the values below \p subtree.
+  void fill(const Subtree &subtree) const {
+    fill(subtree.level, subtree.position, subtree.linear);
+  }
+
+private:
+  void fill(size_t level, size_t position, uint64_t linear) const {
+    if (level == modes.size()) {
+      values[position] =
+          layout.nonzero[position] ? counter_uniform(key, linear) : 0.0f;
+      return;
+    }
+    const int dim = ordering[level];
+    if (modes[level] == taco::Dense) {
+      for (int i = 0; i < sizes[dim]; ++i)
+        fill(level + 1, position * sizes[dim] + i, linear + i * strides[dim]);
+      return;
+    }
+    const auto &pos = layout.pos[level];
+    const auto &crd = layout.crd[level];
+    for (int p = pos[position]; p < pos[position + 1]; ++p)
+      fill(level + 1, p, linear + crd[p] * strides[dim]);
+  }
+
+  const StorageLayout &layout;
+  const std::vector<taco::ModeFormat> modes;
+  const std::vector<int> ordering;
+  const std::vector<int> &sizes;
+  std::vector<uint64_t> strides;
+  const uint64_t key;
+  float *values;
+};
+
+/// Below this many values a fill or scan runs on the calling thread.
+const size_t PARALLEL_FILL_MIN_VALUES = size_t{1} << 16;
+
+/// Marks the coordinates of the nonzero values of packed level arrays, the
+/// inverse of ValueFiller.
+class SparsityScanner {
+public:
+  explicit SparsityScanner(const taco::Tensor<float> &data)
+      : modes(data.getFormat().getModeFormats()),
+        ordering(data.getFormat().getModeOrdering()),
+        sizes(data.getDimensions()), pos(modes.size(), nullptr),
+        crd(modes.size(), nullptr) {
+    const auto &storage = data.getStorage();
+    const auto index = storage.getIndex();
+    for (size_t level = 0; level < modes.size(); ++level) {
+      if (modes[level] == taco::Dense)
+        continue;
+      const auto mode = index.getModeIndex(level);
+      pos[level] = static_cast<const int *>(mode.getIndexArray(0).getData());
+      crd[level] = static_cast<const int *>(mode.getIndexArray(1).getData());
+    }
+    const auto valueArray = storage.getValues();
+    values = static_cast<const float *>(valueArray.getData());
+    numValues = valueArray.getSize();
+  }
+
+  size_t num_values() const { return numValues; }
+
+  /// Number of children of the root, the unit of parallel work.
+  size_t num_top() const {
+    return modes[0] == taco::Dense ? sizes[ordering[0]] : pos[0][1];
+  }
+
+  /// Sets in \p marks (one vector per dimension) the coordinates of the
+  /// nonzeros below the \p child-th child of the root.
+  void scan_top(size_t child, std::vector<SparsityVector> &marks) const {
+    Walk walk{marks, std::vector<int>(modes.size()), 0};
+    walk.path[0] = modes[0] == taco::Dense ? child : crd[0][child];
+    scan(1, child, walk);
+  }
+
+private:
+  struct Walk {
+    std::vector<SparsityVector> &marks;
+    /// The coordinate of each level on the path to the current position.
+    std::vector<int> path;
+    /// The levels of the path already marked; a nonzero only marks the
+    /// levels below, so each coordinate is set once per subtree.
+    size_t marked;
+  };
+
+  void scan(size_t level, size_t position, Walk &walk) const {
+    if (level == modes.size()) {
+      if (values[position] != 0.0f) {
+        for (size_t l = walk.marked; l < modes.size(); ++l)
+          walk.marks[ordering[l]].set(walk.path[l]);
+        walk.marked = modes.size();
       }
+      return;
     }
-    if (isZero) {
-      if (this->data->getFormat() == dense) {
-        data->insert(indices, 0.0f);
+    const int dim = ordering[level];
+    if (modes[level] == taco::Dense) {
+      for (int i = 0; i < sizes[dim]; ++i) {
+        walk.path[level] = i;
+        walk.marked = std::min(walk.marked, level);
+        scan(level + 1, position * sizes[dim] + i, walk);
       }
-      continue;
+      return;
     }
+    for (int p = pos[level][position]; p < pos[level][position + 1]; ++p) {
+      walk.path[level] = crd[level][p];
+      walk.marked = std::min(walk.marked, level);
+      scan(level + 1, p, walk);
+    }
+  }
 
-    float val = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-    data->insert(indices, val);
+  const std::vector<taco::ModeFormat> modes;
+  const std::vector<int> ordering;
+  const std::vector<int> sizes;
+  std::vector<const int *> pos;
+  std::vector<const int *> crd;
+  const float *values{nullptr};
+  size_t numValues{0};
+};
+} // namespace
+
+std::vector<SparsityVector> data_sparsities(const taco::Tensor<float> &data,
+                                            size_t threads) {
+  const std::vector<int> sizes = data.getDimensions();
+  auto empty = [&]() {
+    std::vector<SparsityVector> marks;
+    for (int size : sizes)
+      marks.emplace_back(size);
+    return marks;
+  };
+  std::vector<SparsityVector> sparsities = empty();
+  if (sizes.empty())
+    return sparsities;
+  const SparsityScanner scanner(data);
+  if (scanner.num_values() == 0)
+    return sparsities;
+  const size_t numTop = scanner.num_top();
+  if (threads == 1 || scanner.num_values() < PARALLEL_FILL_MIN_VALUES) {
+    for (size_t child = 0; child < numTop; ++child)
+      scanner.scan_top(child, sparsities);
+  } else {
+    // every chunk marks its own vectors, merged afterwards
+    ThreadPool pool(threads);
+    const size_t chunks = std::min(numTop, pool.size() * 4);
+    std::vector<std::vector<SparsityVector>> marks(chunks);
+    pool.parallel_for(chunks, [&](size_t chunk) {
+      marks[chunk] = empty();
+      for (size_t child = numTop * chunk / chunks;
+           child < numTop * (chunk + 1) / chunks; ++child)
+        scanner.scan_top(child, marks[chunk]);
+    });
+    for (auto &chunkMarks : marks)
+      for (size_t dim = 0; dim < sizes.size(); ++dim)
+        sparsities[dim] |= chunkMarks[dim];
   }
-  data->pack();
+  for (auto &sparsity : sparsities)
+    sparsity.optimize();
+  return sparsities;
+}
+
+StorageLayout Tensor::storage_layout(const taco::Format &format) const {
+  const auto modes = format.getModeFormats();
+  const auto ordering = format.getModeOrdering();
+  assert(modes.size() == static_cast<size_t>(numDims));
+
+  StorageLayout layout;
+  layout.pos.resize(numDims);
+  layout.crd.resize(numDims);
+  // the positions of the current level, flagged 1 where every coordinate on
+  // the path to them is set; an empty dimension leaves no nonzero at all
+  std::vector<char> live{1};
+  for (int dim = 0; dim < numDims; ++dim)
+    if (count_bits(sparsities[dim], sizes[dim]) == 0)
+      live[0] = 0;
+
+  for (int level = 0; level < numDims; ++level) {
+    const int dim = ordering[level];
+    const SparsityVector &sparsity = sparsities[dim];
+    std::vector<char> next;
+    if (modes[level] == taco::Dense) {
+      next.reserve(live.size() * sizes[dim]);
+      for (char parent : live)
+        for (int i = 0; i < sizes[dim]; ++i)
+          next.push_back(parent && sparsity.test(i));
+    } else {
+      std::vector<int> setBits;
+      for (size_t i = sparsity.find_next(0); i < sparsity.size();
+           i = sparsity.find_next(i + 1))
+        setBits.push_back(i);
+      auto &pos = layout.pos[level];
+      auto &crd = layout.crd[level];
+      pos.reserve(live.size() + 1);
+      pos.push_back(0);
+      for (char parent : live) {
+        if (parent)
+          crd.insert(crd.end(), setBits.begin(), setBits.end());
+        pos.push_back(crd.size());
+      }
+      next.assign(crd.size(), 1);
+    }
+    live = std::move(next);
+  }
+  layout.nonzero = std::move(live);
+  return layout;
+}
+
+void fill_layout(taco::Tensor<float> &data, const std::vector<int> &sizes,
+                 const StorageLayout &layout, uint64_t key, size_t threads) {
+  const taco::Format format = data.getFormat();
+  const size_t numValues = layout.nonzero.size();
+  float *values =
+      static_cast<float *>(std::malloc(std::max<size_t>(numValues, 1) *
+                                       sizeof(float)));
+  const ValueFiller filler(layout, format, sizes, key, values);
+  if (threads == 1 || numValues < PARALLEL_FILL_MIN_VALUES) {
+    filler.fill({0, 0, 0});
+  } else {
+    // split below the top level when it is too short to keep every thread
+    // busy, e.g. a leading dimension of 2
+    ThreadPool pool(threads);
+    const auto subtrees = filler.split(pool.size() * 8);
+    const size_t chunks = std::min(subtrees.size(), pool.size() * 8);
+    pool.parallel_for(chunks, [&](size_t chunk) {
+      for (size_t k = subtrees.size() * chunk / chunks;
+           k < subtrees.size() * (chunk + 1) / chunks; ++k)
+        filler.fill(subtrees[k]);
+    });
+  }
+  set_level_storage(data, sizes, layout.pos, layout.crd, values, numValues);
+}
+
+void Tensor::initialize_data(size_t threads) {
+  assert(numDims > 0);
+  fill_layout(*data, sizes, storage_layout(data->getFormat()),
+              random_key(name), threads);
+}
+
+void Tensor::assemble_data() {
+  assert(numDims > 0);
+  const StorageLayout layout = storage_layout(data->getFormat());
+  float *values = static_cast<float *>(
+      std::calloc(std::max<size_t>(layout.nonzero.size(), 1), sizeof(float)));
+  set_level_storage(*data, sizes, layout.pos, layout.crd, values,
+                    layout.nonzero.size());
+  assembled = true;
 }
 
 void Tensor::print_matrix() {
@@ -166,12 +410,19 @@ void Tensor::print_full_sparsity() {
 }
 
 float Tensor::get_sparsity_ratio() {
+  std::vector<int> setBits;
+  for (int dim = 0; dim < this->numDims; dim++)
+    setBits.push_back(count_bits(this->sparsities[dim], this->sizes[dim]));
+  return get_sparsity_ratio(this->sizes, setBits);
+}
+
+float Tensor::get_sparsity_ratio(const std::vector<int> &sizes,
+                                 const std::vector<int> &setBits) {
   size_t total = 1;
   size_t nnz = 1;
-  for (int dim = 0; dim < this->numDims; dim++) {
-    int dimSize = this->sizes[dim];
-    total *= dimSize;
-    int bits = count_bits(this->sparsities[dim], dimSize);
+  for (size_t dim = 0; dim < sizes.size(); dim++) {
+    total *= sizes[dim];
+    int bits = setBits[dim];
     if (bits > 0)
       nnz *= bits;
   }
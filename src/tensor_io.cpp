@@ -0,0 +1,450 @@
+#include "../include/tensor_io.hpp"
+#include "../include/mapped_file.hpp"
+#include "../include/thread_pool.hpp"
+#include "../include/utils.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+/// A parse error at a byte of the file; the line is only counted on report.
+struct ParseError {
+  const char *pos;
+  std::string what;
+};
+
+/// The entries parsed from one chunk of a file, in file order.
+struct Chunk {
+  const char *begin;
+  const char *end;
+  /// One 0-based index per dimension for every entry.
+  std::vector<int> coords;
+  std::vector<float> values;
+  /// The slices holding an entry, grown on demand when sizes are unknown.
+  std::vector<SparsityVector> occupancy;
+  /// The largest index + 1 of every dimension.
+  std::vector<int> extents;
+  /// The number of entry lines.
+  size_t lines{0};
+  bool failed{false};
+  ParseError error;
+
+  void add(const int *coord, size_t order, float value) {
+    for (size_t dim = 0; dim < order; ++dim) {
+      const int c = coord[dim];
+      SparsityVector &slices = occupancy[dim];
+      if (static_cast<size_t>(c) >= slices.size())
+        slices.resize(std::max<size_t>(c + 1, 2 * slices.size()));
+      slices.set(c);
+      extents[dim] = std::max(extents[dim], c + 1);
+      coords.push_back(c);
+    }
+    values.push_back(value);
+  }
+};
+
+/// Reads numbers in place from a chunk of mapped text.
+class EntryCursor {
+public:
+  EntryCursor(const char *begin, const char *end) : pos(begin), end(end) {}
+
+  [[noreturn]] void fail(const std::string &what) const {
+    throw ParseError{pos, what};
+  }
+
+  void skip_spaces() {
+    while (pos != end && (*pos == ' ' || *pos == '\t'))
+      ++pos;
+  }
+
+  /// Skips spaces; true if only the line break or the end follows.
+  bool at_line_end() {
+    skip_spaces();
+    return pos == end || *pos == '\n' || *pos == '\r';
+  }
+
+  /// Moves past the next line break.
+  void next_line() {
+    while (pos != end && *pos != '\n')
+      ++pos;
+    if (pos != end)
+      ++pos;
+  }
+
+  /// Reads a non-negative integer no larger than \p limit.
+  long long read_integer(long long limit) {
+    skip_spaces();
+    if (pos == end || !std::isdigit(static_cast<unsigned char>(*pos)))
+      fail("expected an integer");
+    long long value = 0;
+    while (pos != end && std::isdigit(static_cast<unsigned char>(*pos))) {
+      value = value * 10 + (*pos++ - '0');
+      if (value > limit)
+        fail("integer out of range");
+    }
+    return value;
+  }
+
+  /// Reads a 1-based index no larger than \p limit, returned 0-based.
+  int read_index(int limit = std::numeric_limits<int>::max()) {
+    const long long value = read_integer(limit);
+    if (value == 0)
+      fail("indices start at 1");
+    return static_cast<int>(value - 1);
+  }
+
+  /// Reads a decimal number such as "-1.5e-3".
+  double read_value() {
+    skip_spaces();
+    bool negative = false;
+    if (pos != end && (*pos == '+' || *pos == '-'))
+      negative = *pos++ == '-';
+    // up to 19 significant digits fit the mantissa, far beyond float precision
+    uint64_t mantissa = 0;
+    int significant = 0;
+    int exponent = 0;
+    bool any = false;
+    auto digit = [&](bool fraction) {
+      any = true;
+      if (significant < 19) {
+        mantissa = mantissa * 10 + (*pos - '0');
+        if (mantissa != 0)
+          ++significant;
+        exponent -= fraction;
+      } else {
+        exponent += !fraction;
+      }
+      ++pos;
+    };
+    while (pos != end && std::isdigit(static_cast<unsigned char>(*pos)))
+      digit(false);
+    if (pos != end && *pos == '.') {
+      ++pos;
+      while (pos != end && std::isdigit(static_cast<unsigned char>(*pos)))
+        digit(true);
+    }
+    if (!any)
+      fail("expected a value");
+    if (pos != end && (*pos == 'e' || *pos == 'E')) {
+      ++pos;
+      bool negativeExponent = false;
+      if (pos != end && (*pos == '+' || *pos == '-'))
+        negativeExponent = *pos++ == '-';
+      if (pos == end || !std::isdigit(static_cast<unsigned char>(*pos)))
+        fail("expected an exponent");
+      int value = 0;
+      while (pos != end && std::isdigit(static_cast<unsigned char>(*pos)))
+        value = std::min(value * 10 + (*pos++ - '0'), 100000);
+      exponent += negativeExponent ? -value : value;
+    }
+    const double value = mantissa * std::pow(10.0, exponent);
+    return negative ? -value : value;
+  }
+
+  void expect_line_end() {
+    if (!at_line_end())
+      fail("expected the end of the line");
+    next_line();
+  }
+
+  const char *pos;
+  const char *end;
+};
+
+/// Splits [begin, end) into about \p numChunks chunks ending at line breaks.
+std::vector<Chunk> split_lines(const char *begin, const char *end,
+                               size_t numChunks, size_t order) {
+  // bound the entries per chunk so they can be numbered with 32 bits
+  const size_t length = end - begin;
+  numChunks = std::max(numChunks, length / (size_t{1} << 31) + 1);
+  std::vector<Chunk> chunks;
+  const char *first = begin;
+  for (size_t k = 1; k <= numChunks; ++k) {
+    const char *last = k == numChunks ? end : begin + length * k / numChunks;
+    if (last < first)
+      continue;
+    while (last != end && last != begin && last[-1] != '\n')
+      ++last;
+    Chunk chunk;
+    chunk.begin = first;
+    chunk.end = last;
+    chunk.occupancy.resize(order);
+    chunk.extents.assign(order, 0);
+    chunks.push_back(std::move(chunk));
+    first = last;
+  }
+  return chunks;
+}
+
+/// Runs \p parse over every chunk in parallel, then reports the first error
+/// in file order as "filename:line: what".
+template <typename Parse>
+void parse_chunks(std::vector<Chunk> &chunks, ThreadPool &pool,
+                  const MappedFile &file, const std::string &filename,
+                  Parse parse) {
+  pool.parallel_for(chunks.size(), [&](size_t k) {
+    try {
+      EntryCursor cursor(chunks[k].begin, chunks[k].end);
+      parse(chunks[k], cursor);
+    } catch (const ParseError &e) {
+      chunks[k].failed = true;
+      chunks[k].error = e;
+    }
+  });
+  for (auto &chunk : chunks) {
+    if (!chunk.failed)
+      continue;
+    const long line = 1 + std::count(file.bytes, chunk.error.pos, '\n');
+    std::ostringstream message;
+    message << filename << ":" << line << ": " << chunk.error.what;
+    throw std::runtime_error(message.str());
+  }
+}
+
+std::string stem(const std::string &filename) {
+  const size_t slash = filename.find_last_of('/');
+  std::string name =
+      slash == std::string::npos ? filename : filename.substr(slash + 1);
+  const size_t dot = name.find_last_of('.');
+  return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+/**
+ * Sorts the entries of every chunk into the storage order of \p format and
+ * merges them into packed TACO storage. Ties keep file order, so repeated
+ * coordinates are summed in the same order whatever the chunking.
+ */
+TensorPtr build_tensor(const std::string &filename, std::vector<Chunk> &chunks,
+                       const std::vector<int> &sizes,
+                       const taco::Format &format, ThreadPool &pool) {
+  const size_t order = sizes.size();
+  const auto ordering = format.getModeOrdering();
+  auto precedes = [&](const int *a, const int *b) {
+    for (size_t level = 0; level < order; ++level) {
+      const int dim = ordering[level];
+      if (a[dim] != b[dim])
+        return a[dim] < b[dim];
+    }
+    return false;
+  };
+
+  std::vector<std::vector<uint32_t>> sorted(chunks.size());
+  pool.parallel_for(chunks.size(), [&](size_t k) {
+    const int *coords = chunks[k].coords.data();
+    auto &entries = sorted[k];
+    entries.resize(chunks[k].values.size());
+    std::iota(entries.begin(), entries.end(), 0);
+    auto less = [&](uint32_t a, uint32_t b) {
+      return precedes(coords + a * order, coords + b * order);
+    };
+    if (!std::is_sorted(entries.begin(), entries.end(), less))
+      std::stable_sort(entries.begin(), entries.end(), less);
+  });
+
+  size_t nnz = 0;
+  for (auto &chunk : chunks)
+    nnz += chunk.values.size();
+  LevelArrayBuilder builder(sizes, format, nnz);
+  // (chunk, rank of its next entry); the heap yields the least entry, and
+  // among equal ones the earliest chunk
+  using Head = std::pair<size_t, size_t>;
+  auto coord = [&](const Head &h) {
+    return chunks[h.first].coords.data() + sorted[h.first][h.second] * order;
+  };
+  auto later = [&](const Head &a, const Head &b) {
+    if (precedes(coord(b), coord(a)))
+      return true;
+    if (precedes(coord(a), coord(b)))
+      return false;
+    return a.first > b.first;
+  };
+  std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+  for (size_t k = 0; k < chunks.size(); ++k)
+    if (!sorted[k].empty())
+      heads.push({k, 0});
+  while (!heads.empty()) {
+    Head head = heads.top();
+    heads.pop();
+    builder.append(coord(head),
+                   chunks[head.first].values[sorted[head.first][head.second]]);
+    if (++head.second < sorted[head.first].size())
+      heads.push(head);
+  }
+
+  std::vector<SparsityVector> sparsities(order);
+  for (size_t dim = 0; dim < order; ++dim) {
+    for (auto &chunk : chunks)
+      sparsities[dim] |= chunk.occupancy[dim];
+    sparsities[dim].resize(sizes[dim]);
+    sparsities[dim].optimize();
+  }
+  auto tensor = std::make_shared<Tensor>(sizes, sparsities, stem(filename));
+  tensor->create_data(format);
+  builder.finish(*tensor->data);
+  return tensor;
+}
+
+/// \p format, or all-Sparse levels if it is empty.
+taco::Format storage_format(const taco::Format &format, size_t order,
+                            const std::string &filename) {
+  if (format.getOrder() == 0)
+    return taco::Format(
+        std::vector<taco::ModeFormatPack>(order, taco::Sparse));
+  if (static_cast<size_t>(format.getOrder()) != order)
+    throw std::runtime_error(filename + ": the format does not match rank " +
+                             std::to_string(order));
+  return format;
+}
+} // namespace
+
+TensorPtr read_tns(const std::string &filename, const taco::Format &format,
+                   size_t numThreads) {
+  MappedFile file(filename);
+  const char *end = file.bytes + file.length;
+
+  // the rank is the number of fields of the first entry, minus the value
+  EntryCursor first(file.bytes, end);
+  while (first.pos != end && (first.at_line_end() || *first.pos == '#'))
+    first.next_line();
+  if (first.pos == end)
+    throw std::runtime_error(filename + ": no entries");
+  size_t order = 0;
+  for (EntryCursor fields(first.pos, end); !fields.at_line_end(); ++order)
+    while (fields.pos != end && !std::isspace(static_cast<unsigned char>(
+                                    *fields.pos)))
+      ++fields.pos;
+  if (order < 2)
+    throw std::runtime_error(filename + ": expected indices and a value");
+  --order;
+  const taco::Format storage = storage_format(format, order, filename);
+
+  ThreadPool pool(numThreads);
+  auto chunks = split_lines(first.pos, end, pool.size() * 4, order);
+  parse_chunks(chunks, pool, file, filename,
+               [&](Chunk &chunk, EntryCursor &cursor) {
+                 std::vector<int> coord(order);
+                 while (cursor.pos != cursor.end) {
+                   if (cursor.at_line_end() || *cursor.pos == '#') {
+                     cursor.next_line();
+                     continue;
+                   }
+                   for (size_t dim = 0; dim < order; ++dim)
+                     coord[dim] = cursor.read_index();
+                   const float value = cursor.read_value();
+                   cursor.expect_line_end();
+                   chunk.add(coord.data(), order, value);
+                 }
+               });
+
+  std::vector<int> sizes(order, 0);
+  for (auto &chunk : chunks)
+    for (size_t dim = 0; dim < order; ++dim)
+      sizes[dim] = std::max(sizes[dim], chunk.extents[dim]);
+  return build_tensor(filename, chunks, sizes, storage, pool);
+}
+
+TensorPtr read_mtx(const std::string &filename, const taco::Format &format,
+                   size_t numThreads) {
+  MappedFile file(filename);
+  const char *end = file.bytes + file.length;
+  auto fail = [&](const char *pos, const std::string &what) {
+    const long line = 1 + std::count(file.bytes, pos, '\n');
+    throw std::runtime_error(filename + ":" + std::to_string(line) + ": " +
+                             what);
+  };
+
+  // %%MatrixMarket matrix coordinate <field> <symmetry>
+  EntryCursor cursor(file.bytes, end);
+  const char *lineEnd = std::find(cursor.pos, end, '\n');
+  std::istringstream banner(std::string(cursor.pos, lineEnd));
+  std::string words[5];
+  for (auto &word : words) {
+    banner >> word;
+    std::transform(word.begin(), word.end(), word.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+  }
+  if (words[0] != "%%matrixmarket" || words[1] != "matrix")
+    fail(cursor.pos, "expected a MatrixMarket matrix header");
+  if (words[2] != "coordinate")
+    fail(cursor.pos, "only coordinate matrices are supported");
+  const bool pattern = words[3] == "pattern";
+  if (!pattern && words[3] != "real" && words[3] != "integer")
+    fail(cursor.pos, "unsupported field '" + words[3] + "'");
+  const bool skew = words[4] == "skew-symmetric";
+  const bool symmetric = skew || words[4] == "symmetric";
+  if (!symmetric && words[4] != "general")
+    fail(cursor.pos, "unsupported symmetry '" + words[4] + "'");
+  const taco::Format storage = storage_format(format, 2, filename);
+  cursor.next_line();
+
+  // comments, then "rows cols entries"
+  while (cursor.pos != end && (cursor.at_line_end() || *cursor.pos == '%'))
+    cursor.next_line();
+  std::vector<int> sizes(2);
+  long long numEntries = 0;
+  const char *sizeLine = cursor.pos;
+  try {
+    sizes[0] = cursor.read_index() + 1;
+    sizes[1] = cursor.read_index() + 1;
+    numEntries =
+        cursor.read_integer(std::numeric_limits<long long>::max() / 10);
+    cursor.expect_line_end();
+  } catch (const ParseError &e) {
+    fail(e.pos, e.what);
+  }
+  // mirrored entries must land inside the matrix
+  if (symmetric && sizes[0] != sizes[1])
+    fail(sizeLine, words[4] + " matrices must be square");
+
+  ThreadPool pool(numThreads);
+  auto chunks = split_lines(cursor.pos, end, pool.size() * 4, 2);
+  for (auto &chunk : chunks)
+    for (int dim = 0; dim < 2; ++dim)
+      chunk.occupancy[dim] = SparsityVector(sizes[dim]);
+  parse_chunks(chunks, pool, file, filename,
+               [&](Chunk &chunk, EntryCursor &cursor) {
+                 while (cursor.pos != cursor.end) {
+                   if (cursor.at_line_end() || *cursor.pos == '%') {
+                     cursor.next_line();
+                     continue;
+                   }
+                   int coord[2];
+                   coord[0] = cursor.read_index(sizes[0]);
+                   coord[1] = cursor.read_index(sizes[1]);
+                   const float value =
+                       pattern ? 1.0f : static_cast<float>(cursor.read_value());
+                   cursor.expect_line_end();
+                   ++chunk.lines;
+                   chunk.add(coord, 2, value);
+                   if (symmetric && coord[0] != coord[1]) {
+                     const int mirrored[2] = {coord[1], coord[0]};
+                     chunk.add(mirrored, 2, skew ? -value : value);
+                   }
+                 }
+               });
+
+  long long parsed = 0;
+  for (auto &chunk : chunks)
+    parsed += chunk.lines;
+  if (parsed != numEntries)
+    throw std::runtime_error(filename + ": expected " +
+                             std::to_string(numEntries) + " entries, found " +
+                             std::to_string(parsed));
+  return build_tensor(filename, chunks, sizes, storage, pool);
+}
+
+TensorPtr read_tensor_file(const std::string &filename,
+                           const taco::Format &format, size_t numThreads) {
+  const std::string suffix = ".mtx";
+  if (filename.size() > suffix.size() &&
+      filename.compare(filename.size() - suffix.size(), suffix.size(),
+                       suffix) == 0)
+    return read_mtx(filename, format, numThreads);
+  return read_tns(filename, format, numThreads);
+}
@@ -1,14 +1,29 @@
 #include "../include/tests.hpp"
+#include "../include/analysis_cache.hpp"
+#include "../include/bit_kernels.hpp"
+#include "../include/coordinate_iterator.hpp"
 #include "../include/einsum.hpp"
 #include "../include/graph.hpp"
 #include "../include/node.hpp"
+#include "../include/propagation_batch.hpp"
 #include "../include/tensor.hpp"
+#include "../include/tensor_io.hpp"
 #include "../include/utils.hpp"
 #include "taco/format.h"
 #include "taco/index_notation/index_notation.h"
 #include "taco/tensor.h"
+#include <algorithm>
 #include <cassert>
+#include <cctype>
 #include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <sys/stat.h>
 
 void print_matrix(taco::Tensor<float> &tensor, std::vector<int> sizes) {
   assert(sizes.size() == 2 && "Tensor must be a matrix to call this method");
@@ -148,6 +163,7 @@ void test_addition() {
   std::vector<TensorPtr> inputs{X1, X2, X3};
 
   auto add1 = std::make_shared<Add>(inputs, O1);
+  assert(add1->kind == OP_ADD);
 
   auto g = Graph::build_graph({X1, X2, X3}, O1, {add1});
   g.run_propagation();
@@ -223,18 +239,21 @@ void test_einsum() {
   auto einsum2 =
       std::make_shared<Einsum>(inputs2, O2, std::string{"ik,kj->ij"});
 
-  assert(einsum1->reductionDims['i'].size() == 0 &&
+  assert(einsum1->reductionDims[einsum1->index_var_id('i')].size() == 0 &&
          "Only 'k' should be a reduction dim!");
-  assert(einsum1->reductionDims['j'].size() == 0 &&
+  assert(einsum1->reductionDims[einsum1->index_var_id('j')].size() == 0 &&
          "Only 'k' should be a reduction dim!");
-  assert(einsum1->reductionDims['k'].size() == 2 && "'k' should appear twice!");
-  assert(einsum1->outputDims['i'].size() == 1 && "'i' should appear once!");
-  assert(einsum1->outputDims['j'].size() == 1 && "'j' should appear once!");
-  assert(einsum1->outputDims['k'].size() == 0 &&
+  assert(einsum1->reductionDims[einsum1->index_var_id('k')].size() == 2 &&
+         "'k' should appear twice!");
+  assert(einsum1->outputDims[einsum1->index_var_id('i')].size() == 1 &&
+         "'i' should appear once!");
+  assert(einsum1->outputDims[einsum1->index_var_id('j')].size() == 1 &&
+         "'j' should appear once!");
+  assert(einsum1->outputDims[einsum1->index_var_id('k')].size() == 0 &&
          "'k' shouldn't appear as an output dim!");
 
-  assert(einsum1->reductionDims['k'][1].first == 1 &&
-         einsum1->reductionDims['k'][1].second == 0 &&
+  assert(einsum1->reductionDims[einsum1->index_var_id('k')][1].first == 1 &&
+         einsum1->reductionDims[einsum1->index_var_id('k')][1].second == 0 &&
          "Should be the pair (1, 0)!");
 
   auto g = Graph::build_graph({X1, X2, X3}, O2, {einsum1, einsum2});
@@ -647,9 +666,335 @@ void test_einsum_utils() {
   auto graph = build_tree(tensorSizes, contractionStrings, contractionInds);
   assert(graph.inputs.size() == tensorSizes.size());
   assert(graph.nodes.size() == 4);
+
+  // the inputs' vectors can be drawn without building the graph
+  auto pruned =
+      build_tree(tensorSizes, contractionStrings, contractionInds, 0.4);
+  auto inputSparsities =
+      generate_input_sparsities(tensorSizes, contractionInds, 0.4);
+  assert(inputSparsities.size() == pruned.inputs.size());
+  for (size_t k = 0; k < pruned.inputs.size(); ++k)
+    for (int dim = 0; dim < pruned.inputs[k]->numDims; ++dim)
+      assert(inputSparsities[k][dim] == pruned.inputs[k]->sparsities[dim]);
   std::cout << "test_einsum_utils() OK " << std::endl;
 }
 
+void test_einsum_index_lists() {
+  auto labels = parse_einsum_labels("12 3,3 7 12->7 12");
+  assert((labels.inputs == std::vector<std::vector<int>>{{12, 3}, {3, 7, 12}}));
+  assert((labels.output == std::vector<int>{7, 12}));
+  labels = parse_einsum_labels("ij,jk->ik");
+  assert((labels.output == std::vector<int>{'i', 'k'}));
+
+  // the same tree in both forms gives the same analysis
+  std::vector<std::string> letters{"ajac,acaj->a", "ikbd,bdik->bik",
+                                   "bik,ikab->a", "a,a->a"};
+  std::vector<std::string> lists;
+  for (auto &expression : letters) {
+    std::string list;
+    for (char c : expression)
+      list += std::isalpha(c) ? std::to_string(c - 'a' + 100) + " "
+                              : std::string(1, c);
+    lists.push_back(list);
+  }
+  std::vector<std::pair<int, int>> contractionInds{
+      {1, 3}, {0, 2}, {0, 2}, {0, 1}};
+  std::vector<std::vector<int>> tensorSizes{{10, 17, 10, 9},
+                                            {16, 13, 16, 15},
+                                            {10, 9, 16, 10},
+                                            {16, 15, 16, 13},
+                                            {10, 9, 10, 17}};
+  auto g1 = build_tree(tensorSizes, letters, contractionInds, 0.3);
+  auto g2 = build_tree(tensorSizes, lists, contractionInds, 0.3);
+  for (size_t t = 0; t < g1.inputs.size(); ++t)
+    for (int dim = 0; dim < g1.inputs[t]->numDims; ++dim)
+      g2.inputs[t]->sparsities[dim] = g1.inputs[t]->sparsities[dim];
+  g1.run_propagation();
+  g2.run_propagation();
+  for (size_t i = 0; i < g1.nodes.size(); ++i)
+    for (int dim = 0; dim < g1.nodes[i]->output->numDims; ++dim)
+      assert(g1.nodes[i]->output->sparsities[dim] ==
+             g2.nodes[i]->output->sparsities[dim]);
+
+  // more index variables than letters: A(0..29, 60) * B(30..59, 60)
+  const int numVars = 60;
+  std::string lhs, rhs, out;
+  for (int v = 0; v < numVars; ++v) {
+    (v < numVars / 2 ? lhs : rhs) += std::to_string(v) + " ";
+    out += std::to_string(v) + " ";
+  }
+  std::string expression = lhs + "60," + rhs + "60->" + out;
+  auto A = std::make_shared<Tensor>(std::vector<int>(numVars / 2 + 1, 2), "A");
+  auto B = std::make_shared<Tensor>(std::vector<int>(numVars / 2 + 1, 2), "B");
+  auto O = std::make_shared<Tensor>(std::vector<int>(numVars, 2), "O");
+  A->sparsities[3] = SparsityVector("01");
+  B->sparsities[numVars / 2] = SparsityVector("10");
+  auto einsum = std::make_shared<Einsum>(std::vector<TensorPtr>{A, B}, O,
+                                         expression);
+  assert(einsum->indexVars.size() == numVars + 1);
+  assert(einsum->reductionDims[einsum->index_var_id(60)].size() == 2);
+  auto g = Graph::build_graph({A, B}, O, {einsum});
+  g.run_propagation();
+  assert(O->sparsities[3] == SparsityVector("01"));
+  // INTRA across the shared reduction index
+  assert(A->sparsities[numVars / 2] == SparsityVector("10"));
+  std::cout << "test_einsum_index_lists() OK " << std::endl;
+}
+
+// the message \p read throws, or "" when it succeeds
+std::string error_message(const std::function<void()> &read) {
+  try {
+    read();
+  } catch (const std::runtime_error &e) {
+    return e.what();
+  }
+  return "";
+}
+
+// the error of parsing \p text as a benchmark file named "f.txt"
+std::string parse_error(const std::string &text) {
+  return error_message([&] { parse_einsum_benchmark(text, "f.txt"); });
+}
+
+void test_einsum_parser() {
+  auto b = parse_einsum_benchmark("[(1, 0), (0, 1)]\r\n"
+                                  "['ij,jk->ik', \"0 1,1->0\",]\n"
+                                  "[(3, 4), (4,), ()]\n");
+  assert((b.path == std::vector<std::pair<int, int>>{{1, 0}, {0, 1}}));
+  assert((b.strings == std::vector<std::string>{"ij,jk->ik", "0 1,1->0"}));
+  assert((b.sizes == std::vector<std::vector<int>>{{3, 4}, {4}, {}}));
+  assert((get_tensor_sizes("[(2, 5)]") ==
+          std::vector<std::vector<int>>{{2, 5}}));
+
+  assert(parse_error("[(1, 0)]\n['ij,j->i']\n[(3 4)]\n") ==
+         "f.txt:3:5: expected ')', found '4'");
+  assert(parse_error("[(1, x)]\n") ==
+         "f.txt:1:6: expected a non-negative integer, found 'x'");
+  assert(parse_error("[(1, 0)]\n['ij,j->i]\n") ==
+         "f.txt:2:11: unterminated string");
+  assert(parse_error("[(1, 0)]\n[]\n[]\n") ==
+         "f.txt: 1 contractions but 0 einsum strings");
+  std::cout << "test_einsum_parser() OK " << std::endl;
+}
+
+void test_einsum_dataset() {
+  const std::string directory = "test_einsum_dataset";
+  mkdir(directory.c_str(), 0755);
+  const std::vector<std::string> files{"good.txt", "bad.txt", "notes.md"};
+  std::ofstream(directory + "/good.txt") << "[(1, 0)]\n['ij,jk->ik']\n"
+                                            "[(3, 4), (4, 5)]\n";
+  std::ofstream(directory + "/bad.txt") << "[(1, 0)]\n['ij,j->i]\n";
+  std::ofstream(directory + "/notes.md") << "not an instance\n";
+
+  // only .txt files are instances; a malformed one does not stop the others
+  auto entries = read_einsum_dataset(directory, 2);
+  assert(entries.size() == 2);
+  assert(entries[0].path == directory + "/bad.txt");
+  assert(entries[0].error == directory + "/bad.txt:2:11: unterminated string");
+  assert(entries[0].benchmark.strings.empty());
+  assert(entries[1].path == directory + "/good.txt");
+  assert(entries[1].error.empty());
+  assert((entries[1].benchmark.path ==
+          std::vector<std::pair<int, int>>{{1, 0}}));
+  assert((entries[1].benchmark.strings ==
+          std::vector<std::string>{"ij,jk->ik"}));
+  assert((entries[1].benchmark.sizes ==
+          std::vector<std::vector<int>>{{3, 4}, {4, 5}}));
+
+  for (auto &file : files)
+    std::remove((directory + "/" + file).c_str());
+  std::remove(directory.c_str());
+  std::cout << "test_einsum_dataset() OK " << std::endl;
+}
+
+// whether reading \p bytes as the snapshot at \p path fails
+bool snapshot_rejected(const std::string &path, const std::string &bytes) {
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes;
+  return !error_message([&] { read_graph_snapshot(path); }).empty();
+}
+
+// O1 = X1 X2 and O2 = O1 + O1, with X1 of 2x3 and X2 of 3x\p length; the
+// graph the snapshot and analysis cache tests store and load
+Graph make_stored_graph(int length) {
+  auto X1 = std::make_shared<Tensor>(
+      std::vector<int>{2, 3},
+      std::vector<SparsityVector>{SparsityVector("01"), SparsityVector("110")},
+      "X1");
+  auto X2 = std::make_shared<Tensor>(
+      std::vector<int>{3, length},
+      std::vector<SparsityVector>{SparsityVector(3, true),
+                                  SparsityVector(length, true)},
+      "X2");
+  X2->sparsities[1].reset(65);
+  auto O1 = std::make_shared<Tensor>(std::vector<int>{2, length}, "O1");
+  auto O2 = std::make_shared<Tensor>(std::vector<int>{2, length}, "O2");
+  auto matmul = std::make_shared<Einsum>(std::vector<TensorPtr>{X1, X2}, O1,
+                                         "0 1,1 2->0 2");
+  auto add = std::make_shared<Add>(std::vector<TensorPtr>{O1, O1}, O2);
+  return Graph::build_graph({X1, X2}, O2, {matmul, add});
+}
+
+void test_graph_snapshot() {
+  const std::string path = "test_graph_snapshot.snap";
+  std::vector<TensorPtr> original;
+  {
+    auto g = make_stored_graph(70);
+    g.run_propagation();
+    write_graph_snapshot(g, path);
+    original = g.get_tensors();
+  }
+
+  auto loaded = read_graph_snapshot(path);
+  assert(loaded.inputs.size() == 2 && loaded.nodes.size() == 2);
+  assert(loaded.output == loaded.nodes[1]->output);
+  assert(loaded.nodes[0]->kind == OP_EINSUM && loaded.nodes[1]->kind == OP_ADD);
+  assert(static_cast<Einsum &>(*loaded.nodes[0]).expression == "0 1,1 2->0 2");
+  assert(loaded.nodes[1]->inputs[0] == loaded.nodes[0]->output);
+  auto tensors = loaded.get_tensors();
+  assert(tensors.size() == original.size());
+  for (size_t t = 0; t < tensors.size(); ++t) {
+    assert(tensors[t]->name == original[t]->name);
+    assert(tensors[t]->sizes == original[t]->sizes);
+    for (int dim = 0; dim < tensors[t]->numDims; ++dim)
+      assert(tensors[t]->sparsities[dim] == original[t]->sparsities[dim]);
+  }
+
+  // a truncated file and a future version are rejected
+  std::ifstream file(path, std::ios::binary);
+  std::string bytes((std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+  file.close();
+  assert(snapshot_rejected(path, bytes.substr(0, bytes.size() - 1)));
+  std::string future = bytes;
+  future[8] = static_cast<char>(GRAPH_SNAPSHOT_VERSION + 1);
+  assert(snapshot_rejected(path, future));
+  assert(!snapshot_rejected(path, bytes));
+
+  // dimensions long enough to be compressed, in both representations
+  const int length = 70001;
+  auto V1 = std::make_shared<Tensor>(
+      std::vector<int>{length},
+      std::vector<SparsityVector>{generate_sparsity_vector(0.5, length)},
+      "V1");
+  SparsityVector clustered(length, true);
+  clustered &= SparsityVector(60000, true);
+  auto V2 = std::make_shared<Tensor>(std::vector<int>{length},
+                                     std::vector<SparsityVector>{clustered},
+                                     "V2");
+  auto V3 = std::make_shared<Tensor>(std::vector<int>{length}, "V3");
+  auto sum = std::make_shared<Add>(std::vector<TensorPtr>{V1, V2}, V3);
+  {
+    auto g = Graph::build_graph({V1, V2}, V3, {sum});
+    g.run_propagation();
+    write_graph_snapshot(g, path);
+  }
+  auto long_loaded = read_graph_snapshot(path);
+  original = {V1, V2, V3};
+  tensors = long_loaded.get_tensors();
+  assert(tensors.size() == original.size());
+  for (size_t t = 0; t < tensors.size(); ++t)
+    assert(tensors[t]->sparsities[0] == original[t]->sparsities[0]);
+  assert(tensors[1]->sparsities[0].count() == 60000);
+  std::remove(path.c_str());
+  std::cout << "test_graph_snapshot() OK " << std::endl;
+}
+
+void test_storage_layout() {
+  auto A = std::make_shared<Tensor>(std::vector<int>{3, 4}, "A");
+  A->sparsities[0].reset(1);
+  A->sparsities[1].reset(0);
+  A->sparsities[1].reset(2);
+
+  auto layout = A->storage_layout({taco::Dense, taco::Sparse});
+  assert(layout.pos[0].empty() && layout.crd[0].empty());
+  assert((layout.pos[1] == std::vector<int>{0, 2, 2, 4}));
+  assert((layout.crd[1] == std::vector<int>{1, 3, 1, 3}));
+  assert((layout.nonzero == std::vector<char>{1, 1, 1, 1}));
+
+  layout = A->storage_layout({taco::Sparse, taco::Sparse});
+  assert((layout.pos[0] == std::vector<int>{0, 2}));
+  assert((layout.crd[0] == std::vector<int>{0, 2}));
+  assert((layout.pos[1] == std::vector<int>{0, 2, 4}));
+  assert((layout.crd[1] == std::vector<int>{1, 3, 1, 3}));
+
+  // Dense levels keep explicit zeros
+  layout = A->storage_layout({taco::Sparse, taco::Dense});
+  assert((layout.crd[0] == std::vector<int>{0, 2}));
+  assert((layout.nonzero == std::vector<char>{0, 1, 0, 1, 0, 1, 0, 1}));
+  layout = A->storage_layout({taco::Dense, taco::Dense});
+  assert((layout.nonzero ==
+          std::vector<char>{0, 1, 0, 1, 0, 0, 0, 0, 0, 1, 0, 1}));
+
+  // levels follow the mode ordering
+  layout = A->storage_layout(taco::Format({taco::Dense, taco::Sparse}, {1, 0}));
+  assert((layout.pos[1] == std::vector<int>{0, 0, 2, 2, 4}));
+  assert((layout.crd[1] == std::vector<int>{0, 2, 0, 2}));
+
+  // an empty dimension leaves nothing to store below Sparse levels
+  A->sparsities[1].reset();
+  layout = A->storage_layout({taco::Sparse, taco::Sparse});
+  assert((layout.pos[0] == std::vector<int>{0, 0}));
+  assert(layout.crd[0].empty() && layout.nonzero.empty());
+  std::cout << "test_storage_layout() OK " << std::endl;
+}
+
+// true when the tensors of \p a and \p b, in order, have equal vectors
+bool same_vectors(const Graph &a, const Graph &b) {
+  auto x = a.get_tensors(), y = b.get_tensors();
+  for (size_t t = 0; t < x.size(); ++t)
+    for (int dim = 0; dim < x[t]->numDims; ++dim)
+      if (!(x[t]->sparsities[dim] == y[t]->sparsities[dim]))
+        return false;
+  return true;
+}
+
+void test_analysis_cache() {
+  const std::string directory = "test_analysis_cache";
+  // the second dimension of X2 is long enough to be kept compressed
+  auto make_graph = []() { return make_stored_graph(70001); };
+
+  AnalysisCache cache(directory);
+  auto reference = make_graph();
+  const auto key = AnalysisCache::key(reference);
+  auto computed = cache.run_propagation(reference);
+  assert(cache.counters().misses == 1 && cache.counters().hits == 0);
+
+  // the same graph and vectors hit, and end at the same fixed point
+  auto cached = make_graph();
+  assert(AnalysisCache::key(cached).name == key.name);
+  auto loaded = cache.run_propagation(cached);
+  (void)computed, (void)loaded;
+  assert(cache.counters().hits == 1);
+  assert(loaded.converged && loaded.bitsCleared == computed.bitsCleared);
+  assert(same_vectors(reference, cached));
+
+  // other input vectors miss
+  auto other = make_graph();
+  other.inputs[0]->sparsities[1].reset(1);
+  assert(AnalysisCache::key(other).name != key.name);
+
+  // a damaged entry is dropped and recomputed
+  {
+    std::fstream file(cache.entry_path(key),
+                      std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(-1, std::ios::end);
+    file.put('\x5a');
+  }
+  auto recomputed = make_graph();
+  cache.run_propagation(recomputed);
+  assert(cache.counters().corrupt == 1 && cache.counters().misses == 2);
+  assert(same_vectors(reference, recomputed));
+
+  // an entry over the budget is evicted right away
+  AnalysisCache tiny(directory, 1);
+  auto evicted = make_graph();
+  tiny.store(key, reference);
+  assert(tiny.counters().evictions == 1);
+  assert(!tiny.load(key, evicted) && tiny.counters().misses == 1);
+  std::remove(directory.c_str());
+  std::cout << "test_analysis_cache() OK " << std::endl;
+}
+
 void test_scalar_computation() {
   int size = 2;
 
@@ -786,6 +1131,1056 @@ void test_fill_tensor() {
   std::cout << "test_fill_tensor() OK " << std::endl;
 }
 
+void test_data_sparsities() {
+  std::mt19937 gen(5);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  // packs random elements (a tenth of them explicit zeros) of density
+  // \p density and returns the tensor with its expected vectors
+  auto pack = [&](const std::vector<int> &dims, const taco::Format &format,
+                  double density, std::vector<SparsityVector> &expected) {
+    const auto ordering = format.getModeOrdering();
+    auto data = std::make_shared<taco::Tensor<float>>("D", dims, format);
+    LevelArrayBuilder builder(dims, format);
+    expected.clear();
+    for (int size : dims)
+      expected.emplace_back(size);
+    long long total = 1;
+    for (int size : dims)
+      total *= size;
+    std::vector<int> coord(dims.size());
+    for (long long linear = 0; linear < total; ++linear) {
+      long long rest = linear;
+      for (size_t level = dims.size(); level-- > 0;) {
+        coord[ordering[level]] = rest % dims[ordering[level]];
+        rest /= dims[ordering[level]];
+      }
+      if (uniform(gen) >= density)
+        continue;
+      const float value = uniform(gen) < 0.1f ? 0.0f : 1.0f + uniform(gen);
+      builder.append(coord.data(), value);
+      if (value != 0.0f)
+        for (size_t dim = 0; dim < dims.size(); ++dim)
+          expected[dim].set(coord[dim]);
+    }
+    builder.finish(*data);
+    return data;
+  };
+
+  std::vector<SparsityVector> expected;
+  const std::vector<std::pair<std::vector<int>, taco::Format>> cases{
+      {{6, 9}, taco::Format({taco::Dense, taco::Sparse})},
+      {{6, 9}, taco::Format({taco::Dense, taco::Sparse}, {1, 0})},
+      {{5, 4, 7}, taco::Format({taco::Sparse, taco::Dense, taco::Sparse})},
+      {{5, 4, 7},
+       taco::Format({taco::Sparse, taco::Sparse, taco::Dense}, {2, 0, 1})},
+      // large enough to be walked in parallel
+      {{320, 260}, taco::Format({taco::Dense, taco::Dense})},
+      {{320, 260}, taco::Format({taco::Sparse, taco::Sparse})}};
+  for (auto &c : cases) {
+    for (double density : {0.0, 0.05, 0.5}) {
+      auto data = pack(c.first, c.second, density, expected);
+      for (size_t threads : {1, 4}) {
+        auto sparsities = data_sparsities(*data, threads);
+        assert(sparsities.size() == c.first.size());
+        for (size_t dim = 0; dim < c.first.size(); ++dim)
+          assert(sparsities[dim] == expected[dim]);
+      }
+    }
+  }
+
+  // entering SPA from existing data
+  auto data = pack({6, 9}, taco::Format({taco::Sparse, taco::Sparse}), 0.2,
+                   expected);
+  Tensor T(data);
+  assert(T.name == "D" && T.numDims == 2);
+  assert((T.sizes == std::vector<int>{6, 9}));
+  assert(T.sparsities[0] == expected[0] && T.sparsities[1] == expected[1]);
+  std::cout << "test_data_sparsities() OK " << std::endl;
+}
+
+// the stored values of \p data, in storage order
+std::vector<float> values_of(const taco::Tensor<float> &data) {
+  const auto array = data.getStorage().getValues();
+  const float *values = static_cast<const float *>(array.getData());
+  return std::vector<float>(values, values + array.getSize());
+}
+
+// the stored values of \p tensor's concrete data
+std::vector<float> values_of(const Tensor &tensor) {
+  return values_of(*tensor.data);
+}
+
+void test_tensor_io() {
+  auto write = [](const std::string &path, const std::string &text) {
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << text;
+  };
+  // the level arrays of a Sparse, Sparse tensor
+  auto levels = [](const Tensor &tensor) {
+    const auto index = tensor.data->getStorage().getIndex();
+    std::vector<std::vector<int>> arrays;
+    for (int level = 0; level < 2; ++level) {
+      const auto mode = index.getModeIndex(level);
+      for (int a = 0; a < 2; ++a) {
+        const auto array = mode.getIndexArray(a);
+        const int *data = static_cast<const int *>(array.getData());
+        arrays.emplace_back(data, data + array.getSize());
+      }
+    }
+    return arrays;
+  };
+  const taco::Format csr({taco::Dense, taco::Sparse});
+  const taco::Format dcsr({taco::Sparse, taco::Sparse});
+
+  // out of order, with a repeated coordinate and comments
+  const std::string tns = "test_tensor_io.tns";
+  write(tns, "# comment\n"
+             "3 2 2 1.5\n"
+             "1 1 1 -2e-1\n"
+             "\n"
+             "3 2 2 0.25\n"
+             "1 4 2 3\n");
+  for (size_t threads : {1, 3}) {
+    auto T = read_tns(tns, taco::Format(), threads);
+    assert(T->name == "test_tensor_io");
+    assert((T->sizes == std::vector<int>{3, 4, 2}));
+    assert(T->sparsities[0].to_string() == "101");
+    assert(T->sparsities[1].to_string() == "1011");
+    assert(T->sparsities[2].to_string() == "11");
+    assert((values_of(*T) == std::vector<float>{-0.2f, 3.0f, 1.75f}));
+  }
+
+  const std::string mtx = "test_tensor_io.mtx";
+  write(mtx, "%%MatrixMarket matrix coordinate real symmetric\n"
+             "% comment\n"
+             "4 4 3\n"
+             "2 1 1.0\n"
+             "4 4 2.0\n"
+             "4 2 3.0\n");
+  auto M = read_tensor_file(mtx, dcsr, 2);
+  assert((M->sizes == std::vector<int>{4, 4}));
+  assert(M->sparsities[0].to_string() == "1011");
+  assert(M->sparsities[1].to_string() == "1011");
+  auto arrays = levels(*M);
+  assert((arrays[0] == std::vector<int>{0, 3}));
+  assert((arrays[1] == std::vector<int>{0, 1, 3}));
+  assert((arrays[2] == std::vector<int>{0, 1, 3, 5}));
+  assert((arrays[3] == std::vector<int>{1, 0, 3, 1, 3}));
+  assert((values_of(*M) == std::vector<float>{1, 1, 3, 3, 2}));
+
+  write(mtx, "%%MatrixMarket matrix coordinate pattern general\n"
+             "3 2 2\n"
+             "3 1\n"
+             "1 2\n");
+  M = read_mtx(mtx, csr);
+  assert((values_of(*M) == std::vector<float>{1, 1}));
+  assert(M->sparsities[0].to_string() == "101");
+
+  // errors name the file and line
+  write(mtx, "%%MatrixMarket matrix coordinate real general\n"
+             "3 2 2\n"
+             "1 1 1\n"
+             "1 3 1\n");
+  assert(error_message([&] { read_mtx(mtx, csr); }) ==
+         mtx + ":4: integer out of range");
+  write(mtx, "%%MatrixMarket matrix coordinate real skew-symmetric\n"
+             "% comment\n"
+             "3 2 1\n"
+             "2 1 1\n");
+  assert(error_message([&] { read_mtx(mtx, csr); }) ==
+         mtx + ":3: skew-symmetric matrices must be square");
+  write(tns, "1 1 1\n2 2 x\n");
+  assert(error_message([&] { read_tns(tns, csr, 2); }) ==
+         tns + ":2: expected a value");
+  std::remove(tns.c_str());
+  std::remove(mtx.c_str());
+  std::cout << "test_tensor_io() OK " << std::endl;
+}
+
+void test_random_sparse_tensor() {
+  // the linear storage-order index of every stored nonzero, read back from
+  // the level arrays
+  auto stored = [](const taco::Tensor<float> &T, const std::vector<int> &dims) {
+    const taco::Format format = T.getFormat();
+    const auto modes = format.getModeFormats();
+    const auto ordering = format.getModeOrdering();
+    const auto index = T.getStorage().getIndex();
+    const float *values =
+        static_cast<const float *>(T.getStorage().getValues().getData());
+    std::vector<long long> linear;
+    std::function<void(size_t, size_t, long long)> walk =
+        [&](size_t level, size_t position, long long prefix) {
+          if (level == modes.size()) {
+            if (values[position] != 0.0f) {
+              assert(values[position] >= 1.0f && values[position] < 10.0f);
+              linear.push_back(prefix);
+            }
+            return;
+          }
+          const long long size = dims[ordering[level]];
+          if (modes[level] == taco::Dense) {
+            for (long long i = 0; i < size; ++i)
+              walk(level + 1, position * size + i, prefix * size + i);
+            return;
+          }
+          const auto mode = index.getModeIndex(level);
+          const int *pos =
+              static_cast<const int *>(mode.getIndexArray(0).getData());
+          const int *crd =
+              static_cast<const int *>(mode.getIndexArray(1).getData());
+          for (int p = pos[position]; p < pos[position + 1]; ++p)
+            walk(level + 1, p, prefix * size + crd[p]);
+        };
+    walk(0, 0, 0);
+    return linear;
+  };
+
+  const std::vector<int> dims{7, 5, 3};
+  for (const taco::Format &format :
+       {taco::Format({taco::Sparse, taco::Sparse, taco::Sparse}),
+        taco::Format({taco::Dense, taco::Sparse, taco::Dense}),
+        taco::Format({taco::Sparse, taco::Dense, taco::Sparse}),
+        taco::Format({taco::Sparse, taco::Sparse, taco::Dense}, {2, 0, 1})}) {
+    for (double sparsity : {0.0, 0.6, 0.95}) {
+      auto T = create_random_sparse_tensor(dims, sparsity, format);
+      auto linear = stored(T, dims);
+      assert(linear.size() == static_cast<size_t>((1.0 - sparsity) * 105));
+      // sorted and unique
+      assert(std::adjacent_find(linear.begin(), linear.end(),
+                                std::greater_equal<long long>()) ==
+             linear.end());
+    }
+  }
+
+  // sparse enough for the skip-ahead sampler
+  auto T = create_random_sparse_tensor({300, 200}, 0.99,
+                                       {taco::Dense, taco::Sparse});
+  auto linear = stored(T, {300, 200});
+  assert(linear.size() == 600 && linear.back() < 60000);
+  assert(std::adjacent_find(linear.begin(), linear.end(),
+                            std::greater_equal<long long>()) == linear.end());
+
+  // TACO indexes storage with int32
+  assert(!error_message([] {
+            create_random_sparse_tensor({50000, 50000}, 0.0,
+                                        {taco::Dense, taco::Sparse});
+          }).empty());
+  std::cout << "test_random_sparse_tensor() OK " << std::endl;
+}
+
+void test_parallel_fill() {
+  auto A = std::make_shared<Tensor>(
+      std::vector<int>{64, 40, 30}, "A",
+      taco::Format({taco::Dense, taco::Dense, taco::Dense}));
+  for (int i = 0; i < 64; i += 3)
+    A->sparsities[0].reset(i);
+  A->sparsities[2].reset(7);
+
+  // the same values for any number of threads
+  A->initialize_data(1);
+  const auto serial = values_of(*A);
+  assert(serial.size() == 64 * 40 * 30);
+  A->initialize_data(4);
+  assert(values_of(*A) == serial);
+
+  // and for any format: a sparse tensor keeps the nonzeros of the dense one
+  std::vector<float> nonzeros;
+  for (float value : serial)
+    if (value != 0.0f)
+      nonzeros.push_back(value);
+  assert(nonzeros.size() == A->get_nnz());
+  A->create_data({taco::Sparse, taco::Dense, taco::Sparse});
+  A->initialize_data(3);
+  assert(values_of(*A) == nonzeros);
+
+  // other tensors draw other values
+  auto B = std::make_shared<Tensor>(
+      std::vector<int>{64, 40, 30}, "B",
+      taco::Format({taco::Dense, taco::Dense, taco::Dense}));
+  B->initialize_data(1);
+  assert(values_of(*B) != serial);
+
+  // a short leading dimension is split below the top level
+  auto make_short = []() {
+    auto C = std::make_shared<Tensor>(
+        std::vector<int>{2, 300, 200}, "C",
+        taco::Format({taco::Dense, taco::Sparse, taco::Sparse}));
+    C->sparsities[1].reset(4);
+    C->sparsities[2].reset(9);
+    return C;
+  };
+  auto C1 = make_short(), C4 = make_short(), Cfill = make_short();
+  C1->initialize_data(1);
+  C4->initialize_data(4);
+  Cfill->fill_tensor();
+  assert(values_of(*C1).size() == 2 * 299 * 199);
+  assert(values_of(*C4) == values_of(*C1));
+  assert(values_of(*Cfill) == values_of(*C1));
+
+  // the matrix fills write the values of their masks, in any format
+  const int rows = 300, cols = 250;
+  const uint64_t maskKey = random_key("M/mask"), valueKey = random_key("M");
+  std::vector<float> dense, sparse, columns;
+  for (int i = 0; i < rows; ++i)
+    for (int j = 0; j < cols; ++j) {
+      const uint64_t linear = static_cast<uint64_t>(i) * cols + j;
+      const bool kept = counter_uniform(maskKey, linear) > 0.7;
+      dense.push_back(kept ? counter_uniform(valueKey, linear) : 0.0f);
+      if (kept)
+        sparse.push_back(dense.back());
+    }
+  for (int j = 0; j < cols; ++j)
+    for (int i = 0; i < rows; ++i)
+      if (dense[i * cols + j] != 0.0f)
+        columns.push_back(dense[i * cols + j]);
+  taco::Tensor<float> M("M", {rows, cols}, {taco::Dense, taco::Dense});
+  fill_tensor(M, 0.7, rows, cols);
+  assert(values_of(M) == dense);
+  M = taco::Tensor<float>("M", {rows, cols}, {taco::Sparse, taco::Sparse});
+  fill_tensor(M, 0.7, rows, cols);
+  assert(values_of(M) == sparse);
+  M = taco::Tensor<float>("M", {rows, cols},
+                          taco::Format({taco::Dense, taco::Sparse}, {1, 0}));
+  fill_tensor(M, 0.7, rows, cols);
+  assert(values_of(M) == columns);
+
+  // the row and column ratios zero whole slices, like a Tensor's vectors
+  M = taco::Tensor<float>("M", {rows, cols}, {taco::Dense, taco::Sparse});
+  fill_tensor(M, 0.5, 0.2, rows, cols);
+  assert(values_of(M).size() == (rows - rows / 2) * (cols - cols / 5));
+  std::cout << "test_parallel_fill() OK " << std::endl;
+}
+
+void test_coordinate_iterator() {
+  SparsityVector bits("0110010");
+  assert(bits.find_next(0) == 1 && bits.find_next(2) == 4);
+  assert(bits.find_next(5) == 5 && bits.find_next(6) == 7);
+  SparsityVector runs(1 << 17);
+  runs.set(70000).set(70001).set(100000);
+  runs.compress();
+  assert(runs.is_compressed());
+  assert(runs.find_next(0) == 70000 && runs.find_next(70001) == 70001);
+  assert(runs.find_next(70002) == 100000 &&
+         runs.find_next(100001) == runs.size());
+
+  std::vector<SparsityVector> sparsities{SparsityVector("1001"),
+                                         SparsityVector("110"),
+                                         SparsityVector("10110")};
+  std::vector<std::vector<int>> expected;
+  for (int i = 0; i < 4; ++i)
+    for (int j = 0; j < 3; ++j)
+      for (int k = 0; k < 5; ++k)
+        if (sparsities[0][i] && sparsities[1][j] && sparsities[2][k])
+          expected.push_back({i, j, k});
+  std::vector<std::vector<int>> visited;
+  for (CoordinateIterator it(sparsities); it.valid(); it.next())
+    visited.push_back(it.coordinate());
+  assert(visited == expected);
+
+  sparsities[1].reset();
+  assert(!CoordinateIterator(sparsities).valid());
+  std::cout << "test_coordinate_iterator() OK " << std::endl;
+}
+
+void test_sparsity_vector() {
+  SparsityVector bits("0110");
+  assert(bits.size() == 4);
+  assert(bits[0] == 0 && bits[1] == 1 && bits[2] == 1 && bits[3] == 0);
+  assert(bits.to_string() == "0110");
+
+  // dimensions are no longer bounded by a compile-time maximum
+  const int size = 100000;
+  SparsityVector large = generate_sparsity_vector(0.25, size);
+  assert(large.size() == size);
+  assert(count_bits(large, size) == 75000);
+  assert(large.count() == 75000);
+
+  SparsityVector wide(size, true);
+  wide &= SparsityVector("101");
+  assert(wide.size() == size && wide.count() == 2);
+  assert(count_bits(wide, 2) == 1);
+  SparsityVector empty;
+  empty |= SparsityVector("101");
+  assert(empty.size() == 3 && empty.count() == 2);
+  std::cout << "test_sparsity_vector() OK " << std::endl;
+}
+
+void test_bit_kernels() {
+  const unsigned int seed = SEED;
+  const std::string previous = bit_kernels().name;
+  // odd lengths exercise the vector bodies and the scalar/masked tails
+  for (int size : {1, 63, 64, 65, 300, 1000, 4099}) {
+    SparsityVector a = generate_sparsity_vector(0.5, size);
+    SEED++;
+    SparsityVector b = generate_sparsity_vector(0.3, size);
+    SEED++;
+    SparsityVector c = generate_sparsity_vector(0.7, size);
+    set_bit_kernels("scalar");
+    SparsityVector andRef(size, true), orRef(size);
+    and_all(andRef, {&a, &b, &c});
+    or_all(orRef, {&a, &b, &c});
+    size_t countRef = count_bits(a, size);
+    size_t andCountRef = and_count(a, b);
+    // read under the other kernels below, which NDEBUG compiles out
+    (void)countRef, (void)andCountRef;
+
+    for (const std::string &name : available_bit_kernels()) {
+      // selected outside assert, so that NDEBUG builds still switch kernels
+      const bool selected = set_bit_kernels(name);
+      (void)selected;
+      assert(selected);
+      SparsityVector andRes(size, true), orRes(size);
+      and_all(andRes, {&a, &b, &c});
+      or_all(orRes, {&a, &b, &c});
+      assert(andRes == andRef && "n-ary AND differs from scalar kernel");
+      assert(orRes == orRef && "n-ary OR differs from scalar kernel");
+      assert(count_bits(a, size) == countRef);
+      assert(and_count(a, b) == andCountRef);
+
+      SparsityVector narrowed = a;
+      assert(and_changed(narrowed, b) == (andCountRef != countRef));
+      assert(!and_changed(narrowed, b) && "second AND must be a no-op");
+    }
+  }
+  SEED = seed;
+  set_bit_kernels(previous);
+  std::cout << "test_bit_kernels() OK " << std::endl;
+}
+
+void test_compressed_sparsity_vector() {
+  const size_t size = 1 << 20;
+  // clustered slices: one long live range per vector
+  SparsityVector a(size), b(size);
+  a |= SparsityVector(size, true);
+  a &= SparsityVector(600000, true); // [0, 600000)
+  b.decompress();
+  for (size_t i = 400000; i < 900000; ++i)
+    b.set(i);
+  b.optimize();
+  assert(a.is_compressed() && b.is_compressed());
+  assert(a.memory_bytes() < 64 && "clustered vector should be tiny");
+
+  SparsityVector both = a & b, either = a | b;
+  assert(both.count() == 200000 && both[400000] && !both[600000]);
+  assert(either.count() == 900000 && either[0] && !either[900000]);
+
+  // mixed representations agree with the dense result
+  SparsityVector denseB = b;
+  denseB.decompress();
+  assert((a & denseB) == both && (denseB & a) == both);
+  assert((a | denseB) == either && (denseB | a) == either);
+  assert(count_bits(both, 500000) == 100000);
+
+  // built from dense words, a long vector picks its own representation and
+  // drops the bits past its end
+  std::vector<SparsityVector::Word> words(
+      SparsityVector::num_words_for(size + 5), 0);
+  words[3] = 0xff;
+  words.back() = ~SparsityVector::Word{0};
+  SparsityVector fromWords(size + 5, words.data());
+  assert(fromWords.is_compressed() && fromWords.count() == 8 + 5);
+  assert(fromWords[3 * 64] && fromWords[size + 4]);
+
+  // scattered bits do not compress
+  SparsityVector scattered = generate_sparsity_vector(0.5, size);
+  assert(!scattered.is_compressed());
+
+  // a dimension far beyond the old 2048-bit limit propagates cheaply
+  const int rows = 16, cols = 20000000;
+  SparsityVector live(cols);
+  live |= SparsityVector(cols / 2, true);
+  auto M = std::make_shared<Tensor>(
+      std::vector<int>{rows, cols},
+      std::vector<SparsityVector>{SparsityVector(rows, true), live}, "M");
+  auto V = std::make_shared<Tensor>(
+      std::vector<int>{cols},
+      std::vector<SparsityVector>{SparsityVector(cols, true)}, "V");
+  auto O = std::make_shared<Tensor>(std::vector<int>{rows}, "O");
+  auto matvec =
+      std::make_shared<Einsum>(std::vector<TensorPtr>{M, V}, O, "ij,j->i");
+  auto g = Graph::build_graph({M, V}, O, {matvec});
+  g.run_propagation();
+  assert(V->sparsities[0].is_compressed());
+  assert(count_bits(V->sparsities[0], cols) == cols / 2);
+  std::cout << "test_compressed_sparsity_vector() OK " << std::endl;
+}
+
+// true when every vector of \p tensors is an aligned view into \p arena
+bool bound_to(const std::vector<TensorPtr> &tensors,
+              const SparsityArena &arena) {
+  for (auto &tensor : tensors)
+    for (auto &sparsity : tensor->sparsities)
+      if (!sparsity.is_view() || !arena.contains(sparsity.data()) ||
+          reinterpret_cast<uintptr_t>(sparsity.data()) %
+              SparsityArena::ALIGNMENT)
+        return false;
+  return true;
+}
+
+void test_sparsity_arena() {
+  const int size = 130;
+  auto X1 = std::make_shared<Tensor>(
+      std::vector<int>{size, size},
+      std::vector<SparsityVector>{generate_sparsity_vector(0.5, size),
+                                  SparsityVector(size, true)},
+      "X1");
+  auto X2 = std::make_shared<Tensor>(std::vector<int>{size, size}, "X2");
+  auto O1 = std::make_shared<Tensor>(std::vector<int>{size, size}, "O1");
+  auto X3 = std::make_shared<Tensor>(std::vector<int>{size, size}, "X3");
+  auto O2 = std::make_shared<Tensor>(
+      std::vector<int>{size, size},
+      std::vector<SparsityVector>{SparsityVector(size, true),
+                                  generate_sparsity_vector(0.5, size)},
+      "O2");
+  auto einsum1 = std::make_shared<Einsum>(std::vector<TensorPtr>{X1, X2}, O1,
+                                          std::string{"ik,kj->ij"});
+  auto einsum2 = std::make_shared<Einsum>(std::vector<TensorPtr>{O1, X3}, O2,
+                                          std::string{"ik,kj->ij"});
+  SparsityVector rows = X1->sparsities[0], cols = O2->sparsities[1];
+  {
+    auto g = Graph::build_graph({X1, X2, X3}, O2, {einsum1, einsum2});
+    assert(bound_to({X1, X2, O1, X3, O2}, *g.arena));
+    assert(X1->sparsities[0] == rows && "binding must keep the bits");
+    // copies own their words; assigning to a view writes into its slot
+    SparsityVector copy = X1->sparsities[0];
+    assert(!copy.is_view() && copy == rows);
+    const auto *slot = O1->sparsities[0].data();
+    (void)slot;
+    O1->sparsities[0] = SparsityVector(size, true);
+    assert(O1->sparsities[0].data() == slot);
+    // compressed sources are decompressed into the slot
+    SparsityVector runs(size, true);
+    runs.compress();
+    O1->sparsities[1] = runs;
+    assert(O1->sparsities[1].is_view() && O1->sparsities[1] == runs);
+    slot = O1->sparsities[1].data();
+    O1->sparsities[1] = std::move(runs);
+    assert(O1->sparsities[1].data() == slot);
+    assert(O1->sparsities[1].count() == static_cast<size_t>(size));
+    g.run_propagation();
+  }
+  // the tensors keep the arena alive after the graph is gone
+  assert(O2->sparsities[0] == rows && "row sparsity should flow to O2");
+  assert(X3->sparsities[1] == cols && "O2 columns should flow back to X3");
+  std::cout << "test_sparsity_arena() OK " << std::endl;
+}
+
+// the bits of every vector of \p tensors, in order
+std::vector<std::string> vector_strings(const std::vector<TensorPtr> &tensors) {
+  std::vector<std::string> strings;
+  for (auto &t : tensors)
+    for (auto &sparsity : t->sparsities)
+      strings.push_back(sparsity.to_string());
+  return strings;
+}
+
+void test_fixed_point() {
+  const int size = 64;
+  auto build = [&](std::vector<TensorPtr> &tensors) {
+    tensors.clear();
+    for (auto name : {"A", "B", "D"})
+      tensors.push_back(std::make_shared<Tensor>(
+          std::vector<int>{size, size},
+          std::vector<SparsityVector>{generate_sparsity_vector(0.3, size),
+                                      generate_sparsity_vector(0.3, size)},
+          name));
+    auto C = std::make_shared<Tensor>(std::vector<int>{size, size}, "C");
+    auto E = std::make_shared<Tensor>(std::vector<int>{size, size}, "E");
+    tensors.push_back(C);
+    tensors.push_back(E);
+    auto matmul1 = std::make_shared<Einsum>(
+        std::vector<TensorPtr>{tensors[0], tensors[1]}, C, "ij,jk->ik");
+    auto matmul2 = std::make_shared<Einsum>(
+        std::vector<TensorPtr>{C, tensors[2]}, E, "ik,kl->il");
+    return Graph::build_graph({tensors[0], tensors[1], tensors[2]}, E,
+                              {matmul1, matmul2});
+  };
+  auto total_bits = [](const std::vector<TensorPtr> &tensors) {
+    size_t bits = 0;
+    for (auto &t : tensors)
+      for (auto &sparsity : t->sparsities)
+        bits += sparsity.count();
+    return bits;
+  };
+
+  std::vector<TensorPtr> tensors;
+  auto g = build(tensors);
+  size_t before = total_bits(tensors);
+  (void)before;
+  auto stats = g.run_propagation();
+  assert(stats.converged && stats.rounds >= 1);
+  assert(stats.opsVisited >= 3 * g.nodes.size());
+  assert(stats.bitsCleared == before - total_bits(tensors));
+
+  // a second run starts at the fixed point: one round, nothing cleared
+  const auto fixedPoint = vector_strings(tensors);
+  stats = g.run_propagation();
+  assert(stats.converged && stats.rounds == 1 && stats.bitsCleared == 0);
+  assert(stats.opsVisited == 3 * g.nodes.size());
+  for (auto dir : {FORWARD, INTRA, BACKWARD})
+    g.run_propagation(dir);
+  assert(vector_strings(tensors) == fixedPoint &&
+         "single passes must not move the fixed point");
+
+  // the round cap stops the solver early
+  auto capped = build(tensors);
+  PropagationOptions options;
+  options.maxRounds = 1;
+  stats = capped.run_propagation(options);
+  assert(stats.rounds == 1);
+  std::cout << "test_fixed_point() OK " << std::endl;
+}
+
+void test_schedule() {
+  const int size = 2;
+  auto make = [&](const std::string &name) {
+    return std::make_shared<Tensor>(std::vector<int>{size, size}, name);
+  };
+  auto X1 = make("X1"), X2 = make("X2"), O1 = make("O1"), O2 = make("O2"),
+       O3 = make("O3");
+  auto matmul1 =
+      std::make_shared<Einsum>(std::vector<TensorPtr>{X1, X2}, O1, "ik,kj->ij");
+  auto matmul2 =
+      std::make_shared<Einsum>(std::vector<TensorPtr>{O1, X2}, O2, "ik,kj->ij");
+  auto add = std::make_shared<Add>(std::vector<TensorPtr>{O1, O2}, O3);
+  // ops listed out of order: the schedule must still put producers first
+  auto g = Graph::build_graph({X1, X2}, O3, {add, matmul2, matmul1});
+  assert((g.schedule.forward == std::vector<size_t>{2, 1, 0}));
+  assert((g.schedule.backward == std::vector<size_t>{0, 1, 2}));
+  assert((g.schedule.numProducers == std::vector<size_t>{2, 1, 0}));
+  assert((g.schedule.numConsumers == std::vector<size_t>{0, 1, 2}));
+
+  X1->sparsities[0] = SparsityVector("01");
+  g.run_propagation(FORWARD);
+  assert(O3->sparsities[0] == SparsityVector("01") &&
+         "a single forward sweep should reach the last op");
+  std::cout << "test_schedule() OK " << std::endl;
+}
+
+void test_parallel_propagation() {
+  const int size = 96;
+  // deepFM-like: four ops read X1 in the first level, two more combine them
+  auto build = [&](std::vector<TensorPtr> &tensors) {
+    auto input = [&](const std::string &name, float r0, float r1) {
+      tensors.push_back(std::make_shared<Tensor>(
+          std::vector<int>{size, size},
+          std::vector<SparsityVector>{generate_sparsity_vector(r0, size),
+                                      generate_sparsity_vector(r1, size)},
+          name));
+      return tensors.back();
+    };
+    auto output = [&](const std::string &name) {
+      tensors.push_back(
+          std::make_shared<Tensor>(std::vector<int>{size, size}, name));
+      return tensors.back();
+    };
+    tensors.clear();
+    auto X1 = input("X1", 0.2, 0.1);
+    auto W1 = input("W1", 0.3, 0.0), W2 = input("W2", 0.0, 0.4);
+    auto W3 = input("W3", 0.5, 0.2), W4 = input("W4", 0.1, 0.6);
+    auto O1 = output("O1"), O2 = output("O2"), O3 = output("O3"),
+         O4 = output("O4"), O5 = output("O5"), O6 = output("O6"),
+         O7 = output("O7");
+    std::vector<OpNodePtr> ops{
+        std::make_shared<Einsum>(std::vector<TensorPtr>{X1, W1}, O1,
+                                 "ik,kj->ij"),
+        std::make_shared<Einsum>(std::vector<TensorPtr>{X1, W2}, O2,
+                                 "ik,kj->ij"),
+        std::make_shared<Einsum>(std::vector<TensorPtr>{X1, W3}, O3,
+                                 "ik,kj->ij"),
+        std::make_shared<Einsum>(std::vector<TensorPtr>{X1, W4}, O4,
+                                 "ik,kj->ij"),
+        std::make_shared<Add>(std::vector<TensorPtr>{O1, O2}, O5),
+        std::make_shared<Einsum>(std::vector<TensorPtr>{O3, O4}, O6,
+                                 "ik,kj->ij"),
+        std::make_shared<Einsum>(std::vector<TensorPtr>{O5, O6}, O7,
+                                 "ik,kj->ij")};
+    return Graph::build_graph({X1, W1, W2, W3, W4}, O7, ops);
+  };
+
+  std::vector<TensorPtr> sequential, parallel, async;
+  auto g1 = build(sequential);
+  auto g2 = build(parallel);
+  auto g3 = build(async);
+  assert(g2.schedule.levels.size() == 3 &&
+         g2.schedule.levels[0].size() == 4);
+  auto stats1 = g1.run_propagation();
+  PropagationOptions options;
+  options.threads = 4;
+  auto stats2 = g2.run_propagation(options);
+  (void)stats1, (void)stats2;
+  auto stats3 = g3.run_propagation_async(options);
+  (void)stats3;
+  assert(stats1.converged && stats2.converged && stats3.converged);
+  assert(stats1.bitsCleared == stats2.bitsCleared);
+  assert(stats1.bitsCleared == stats3.bitsCleared);
+  for (size_t t = 0; t < sequential.size(); ++t)
+    for (int d = 0; d < sequential[t]->numDims; ++d) {
+      assert(sequential[t]->sparsities[d] == parallel[t]->sparsities[d] &&
+             "parallel propagation must reach the same fixed point");
+      assert(sequential[t]->sparsities[d] == async[t]->sparsities[d] &&
+             "async propagation must reach the same fixed point");
+    }
+  std::cout << "test_parallel_propagation() OK " << std::endl;
+}
+
+void test_propagation_program() {
+  const int size = 96;
+  auto make = [&](const std::string &name, double sparsity) {
+    return std::make_shared<Tensor>(
+        std::vector<int>{size, size},
+        std::vector<SparsityVector>{generate_sparsity_vector(sparsity, size),
+                                    generate_sparsity_vector(sparsity, size)},
+        name);
+  };
+  // B feeds two einsums and C feeds an einsum and an add, so INTRA and
+  // BACKWARD combine several consumers
+  auto A = make("A", 0.3), B = make("B", 0.3), F = make("F", 0.3);
+  auto C = std::make_shared<Tensor>(std::vector<int>{size, size}, "C");
+  auto E = std::make_shared<Tensor>(std::vector<int>{size, size}, "E");
+  auto G = std::make_shared<Tensor>(std::vector<int>{size, size}, "G");
+  auto H = std::make_shared<Tensor>(std::vector<int>{size, size}, "H");
+  auto matmul1 =
+      std::make_shared<Einsum>(std::vector<TensorPtr>{A, B}, C, "ij,jk->ik");
+  auto add = std::make_shared<Add>(std::vector<TensorPtr>{C, F}, E);
+  auto matmul2 =
+      std::make_shared<Einsum>(std::vector<TensorPtr>{E, B}, G, "ij,jk->ik");
+  auto matmul3 =
+      std::make_shared<Einsum>(std::vector<TensorPtr>{C, G}, H, "ij,kj->ik");
+  auto g = Graph::build_graph({A, B, F}, H, {matmul1, add, matmul2, matmul3});
+  assert(g.program.size(FORWARD) == 8 && g.program.size(INTRA) == 6 &&
+         g.program.size(BACKWARD) == 6);
+
+  auto tensors = g.get_tensors();
+  auto snapshot = [&]() {
+    std::vector<SparsityVector> vectors;
+    for (auto &t : tensors)
+      for (auto &sparsity : t->sparsities)
+        vectors.push_back(sparsity);
+    return vectors;
+  };
+  auto restore = [&](const std::vector<SparsityVector> &vectors) {
+    size_t ind = 0;
+    for (auto &t : tensors)
+      for (auto &sparsity : t->sparsities)
+        sparsity = vectors[ind++];
+  };
+
+  // every single sweep matches the interpreted transfer functions
+  auto initial = snapshot();
+  for (auto dir : {FORWARD, INTRA, BACKWARD}) {
+    restore(initial);
+    g.run_propagation(FORWARD);
+    auto start = snapshot();
+    g.run_propagation(dir);
+    auto expected = snapshot();
+    restore(start);
+    g.run_program(dir);
+    assert(snapshot() == expected && "a program sweep must match propagate()");
+  }
+
+  // re-analysis with new input sparsities reaches the solver's fixed point
+  for (int trial = 0; trial < 3; ++trial) {
+    for (auto &input : g.inputs)
+      for (auto &sparsity : input->sparsities)
+        sparsity = generate_sparsity_vector(0.3, size);
+    for (auto &op : g.nodes)
+      for (auto &sparsity : op->output->sparsities)
+        sparsity.set();
+    auto start = snapshot();
+    g.run_propagation();
+    auto expected = snapshot();
+    restore(start);
+    auto stats = g.run_program();
+    (void)stats;
+    assert(stats.converged && snapshot() == expected);
+    assert(g.run_program().bitsCleared == 0);
+    assert(bound_to(tensors, *g.arena) && "the arena binding must survive");
+  }
+  std::cout << "test_propagation_program() OK " << std::endl;
+}
+
+void test_propagation_batch() {
+  const int size = 80;
+  auto A = std::make_shared<Tensor>(std::vector<int>{size, size}, "A");
+  auto B = std::make_shared<Tensor>(std::vector<int>{size, size / 2}, "B");
+  auto F = std::make_shared<Tensor>(std::vector<int>{size, size / 2}, "F");
+  auto C = std::make_shared<Tensor>(std::vector<int>{size, size / 2}, "C");
+  auto E = std::make_shared<Tensor>(std::vector<int>{size, size / 2}, "E");
+  auto G = std::make_shared<Tensor>(std::vector<int>{size}, "G");
+  auto matmul =
+      std::make_shared<Einsum>(std::vector<TensorPtr>{A, B}, C, "ij,jk->ik");
+  auto add = std::make_shared<Add>(std::vector<TensorPtr>{C, F}, E);
+  auto reduce = std::make_shared<Einsum>(std::vector<TensorPtr>{E}, G, "ik->i");
+  auto g = Graph::build_graph({A, B, F}, G, {matmul, add, reduce});
+  auto tensors = g.get_tensors();
+
+  std::mt19937 gen(7);
+  auto random_vector = [&](int length, double density) {
+    std::bernoulli_distribution bit(density);
+    SparsityVector sparsity(length);
+    for (int j = 0; j < length; ++j)
+      if (bit(gen))
+        sparsity.set(j);
+    return sparsity;
+  };
+
+  auto reset_outputs = [&]() {
+    for (auto &op : g.nodes)
+      for (auto &sparsity : op->output->sparsities)
+        sparsity.set();
+  };
+
+  for (size_t numScenarios : {size_t{3}, PropagationBatch::MAX_SCENARIOS}) {
+    std::vector<std::vector<std::vector<SparsityVector>>> scenarios;
+    reset_outputs();
+    PropagationBatch batch(g, numScenarios);
+    for (size_t s = 0; s < numScenarios; ++s) {
+      scenarios.emplace_back();
+      for (auto &input : g.inputs) {
+        scenarios.back().emplace_back();
+        for (int dim = 0; dim < input->numDims; ++dim) {
+          scenarios.back().back().push_back(
+              random_vector(input->sizes[dim], 0.4 + 0.01 * s));
+          batch.set_sparsity(s, *input, dim, scenarios.back().back().back());
+        }
+      }
+    }
+    auto stats = batch.run_propagation();
+    (void)stats;
+    assert(stats.converged);
+    auto ratios = batch.get_sparsity_ratios();
+
+    // each scenario on its own reaches the same vectors and ratio
+    for (size_t s = 0; s < numScenarios; ++s) {
+      for (size_t k = 0; k < g.inputs.size(); ++k)
+        for (int dim = 0; dim < g.inputs[k]->numDims; ++dim)
+          g.inputs[k]->sparsities[dim] = scenarios[s][k][dim];
+      reset_outputs();
+      g.run_propagation();
+      for (auto &t : tensors)
+        for (int dim = 0; dim < t->numDims; ++dim)
+          assert(batch.get_sparsity(s, *t, dim) == t->sparsities[dim] &&
+                 "a batched scenario must match its own analysis");
+      assert(ratios[s] == g.get_sparsity_ratio());
+    }
+  }
+  std::cout << "test_propagation_batch() OK " << std::endl;
+}
+
+void test_incremental_propagation() {
+  const int size = 64;
+  std::mt19937 gen(11);
+  auto random_vector = [&](int length) {
+    std::bernoulli_distribution bit(0.6);
+    SparsityVector sparsity(length);
+    for (int j = 0; j < length; ++j)
+      if (bit(gen))
+        sparsity.set(j);
+    return sparsity;
+  };
+  std::vector<std::vector<SparsityVector>> initial;
+  for (int t = 0; t < 5; ++t)
+    initial.push_back({random_vector(size), random_vector(size)});
+
+  // X2 @ X3 shares no index chain with X4 @ X5 until the final add
+  auto build = [&](const std::vector<std::vector<SparsityVector>> &vectors,
+                   std::vector<TensorPtr> &tensors) {
+    tensors.clear();
+    for (int t = 0; t < 5; ++t)
+      tensors.push_back(std::make_shared<Tensor>(
+          std::vector<int>{size, size}, vectors[t], "X" + std::to_string(t)));
+    auto make = [&](const std::string &name) {
+      tensors.push_back(
+          std::make_shared<Tensor>(std::vector<int>{size, size}, name));
+      return tensors.back();
+    };
+    auto O1 = make("O1"), O2 = make("O2"), O3 = make("O3"), O4 = make("O4");
+    auto matmul1 = std::make_shared<Einsum>(
+        std::vector<TensorPtr>{tensors[0], tensors[1]}, O1, "ij,jk->ik");
+    auto matmul2 = std::make_shared<Einsum>(
+        std::vector<TensorPtr>{O1, tensors[2]}, O2, "ij,jk->ik");
+    auto matmul3 = std::make_shared<Einsum>(
+        std::vector<TensorPtr>{tensors[3], tensors[4]}, O3, "ij,jk->ik");
+    auto add = std::make_shared<Add>(std::vector<TensorPtr>{O2, O3}, O4);
+    return Graph::build_graph(
+        {tensors[0], tensors[1], tensors[2], tensors[3], tensors[4]}, O4,
+        {matmul1, matmul2, matmul3, add});
+  };
+
+  std::vector<TensorPtr> tensors, expectedTensors;
+  auto g = build(initial, tensors);
+  g.run_propagation();
+  auto vectors = initial;
+  for (int trial = 0; trial < 4; ++trial) {
+    // even trials widen X1 (a fresh random vector), odd ones narrow it
+    int updated = 1;
+    std::vector<SparsityVector> next;
+    for (int dim = 0; dim < 2; ++dim) {
+      next.push_back(random_vector(size));
+      if (trial % 2)
+        next.back() &= tensors[updated]->sparsities[dim];
+    }
+    vectors[updated] = next;
+    auto stats = g.update_sparsity(tensors[updated], next);
+    (void)stats;
+    assert(stats.converged &&
+           stats.opsVisited < g.program.num_instructions());
+
+    auto expected = build(vectors, expectedTensors);
+    expected.run_propagation();
+    for (size_t t = 0; t < tensors.size(); ++t)
+      for (int dim = 0; dim < tensors[t]->numDims; ++dim)
+        assert(tensors[t]->sparsities[dim] ==
+                   expectedTensors[t]->sparsities[dim] &&
+               "an update must reach the fixed point of a full analysis");
+  }
+
+  // an update that changes nothing does no work
+  auto stats = g.update_sparsity(tensors[4], vectors[4]);
+  (void)stats;
+  assert(stats.opsVisited == 0 && stats.bitsCleared == 0);
+  std::cout << "test_incremental_propagation() OK " << std::endl;
+}
+
+// true when every tensor of \p expected has the vectors of its namesake in
+// \p named
+bool same_sparsities(const std::map<std::string, TensorPtr> &expected,
+                     const std::map<std::string, TensorPtr> &named) {
+  for (auto &kv : expected)
+    for (int dim = 0; dim < kv.second->numDims; ++dim)
+      if (!(named.at(kv.first)->sparsities[dim] == kv.second->sparsities[dim]))
+        return false;
+  return true;
+}
+
+void test_graph_edits() {
+  const int size = 48;
+  std::mt19937 gen(5);
+  auto random_vector = [&]() {
+    std::bernoulli_distribution bit(0.7);
+    SparsityVector sparsity(size);
+    for (int j = 0; j < size; ++j)
+      if (bit(gen))
+        sparsity.set(j);
+    return sparsity;
+  };
+  std::map<std::string, std::vector<SparsityVector>> initial;
+  for (auto name : {"X0", "X1", "X2", "X3", "X4", "Y"})
+    initial[name] = {random_vector(), random_vector()};
+
+  // an Einsum "ij,jk->ik" per entry: {inputs..., output}
+  using Spec = std::vector<std::vector<std::string>>;
+  auto build = [&](const Spec &spec, std::map<std::string, TensorPtr> &named,
+                   std::vector<OpNodePtr> &ops) {
+    named.clear();
+    ops.clear();
+    auto get = [&](const std::string &name) {
+      auto &tensor = named[name];
+      if (!tensor) {
+        if (initial.count(name))
+          tensor = std::make_shared<Tensor>(std::vector<int>{size, size},
+                                            initial[name], name);
+        else
+          tensor =
+              std::make_shared<Tensor>(std::vector<int>{size, size}, name);
+      }
+      return tensor;
+    };
+    for (auto &op : spec)
+      ops.push_back(std::make_shared<Einsum>(
+          std::vector<TensorPtr>{get(op[0]), get(op[1])}, get(op[2]),
+          "ij,jk->ik"));
+    std::vector<TensorPtr> inputs;
+    for (auto &kv : named)
+      if (initial.count(kv.first))
+        inputs.push_back(kv.second);
+    auto g = Graph::build_graph(inputs, named[spec.back()[2]], ops);
+    g.run_propagation();
+    return g;
+  };
+
+  Spec spec{{"X0", "X1", "O1"}, {"O1", "X2", "O2"}, {"X3", "X4", "O3"}};
+  std::map<std::string, TensorPtr> named;
+  std::vector<OpNodePtr> ops;
+  auto g = build(spec, named, ops);
+  auto check = [&](const Spec &expectedSpec) {
+    std::map<std::string, TensorPtr> expectedNamed;
+    std::vector<OpNodePtr> expectedOps;
+    auto expected = build(expectedSpec, expectedNamed, expectedOps);
+    assert(same_sparsities(expectedNamed, named) &&
+           "an edit must reach the fixed point of a rebuilt graph");
+  };
+
+  // skip connection O2 @ O3 -> O4
+  named["O4"] = std::make_shared<Tensor>(std::vector<int>{size, size}, "O4");
+  auto join = std::make_shared<Einsum>(
+      std::vector<TensorPtr>{named["O2"], named["O3"]}, named["O4"],
+      "ij,jk->ik");
+  g.add_op(join);
+  g.output = named["O4"];
+  check({spec[0], spec[1], spec[2], {"O2", "O3", "O4"}});
+
+  // X2 -> Y in the second matmul, then drop the join again
+  named["Y"] =
+      std::make_shared<Tensor>(std::vector<int>{size, size}, initial["Y"], "Y");
+  g.rewire_input(ops[1], 1, named["Y"]);
+  check({spec[0], {"O1", "Y", "O2"}, spec[2], {"O2", "O3", "O4"}});
+  g.output = named["O3"];
+  g.remove_op(join);
+  named.erase("O4");
+  check({spec[0], {"O1", "Y", "O2"}, spec[2]});
+
+  // a new X0 with different sparsity
+  initial["X0"] = {random_vector(), random_vector()};
+  auto X0 = std::make_shared<Tensor>(std::vector<int>{size, size},
+                                     initial["X0"], "X0");
+  g.replace_tensor(named["X0"], X0);
+  named["X0"] = X0;
+  assert(std::count(g.inputs.begin(), g.inputs.end(), X0) == 1);
+  check({spec[0], {"O1", "Y", "O2"}, spec[2]});
+  std::cout << "test_graph_edits() OK " << std::endl;
+}
+
+void test_graph_ownership() {
+  const int size = 8;
+  auto make = [&](const std::string &name) {
+    return std::make_shared<Tensor>(
+        std::vector<int>{size, size},
+        std::vector<SparsityVector>(2, SparsityVector(size, true)), name);
+  };
+  std::weak_ptr<Tensor> weakX, weakO;
+  std::weak_ptr<OpNode> weakOp;
+  OpNodePtr kept;
+  auto X = make("X");
+  {
+    auto W = make("W");
+    auto O1 = make("O1");
+    auto O2 = make("O2");
+    auto matmul1 = std::make_shared<Einsum>(std::vector<TensorPtr>{X, W}, O1,
+                                            "ik,kj->ij");
+    auto matmul2 = std::make_shared<Einsum>(std::vector<TensorPtr>{O1, X}, O2,
+                                            "ik,kj->ij");
+    auto g = Graph::build_graph({X, W}, O2, {matmul1, matmul2});
+    // a moved graph keeps its links
+    auto moved = std::move(g);
+    assert(matmul2->links == moved.links.get() && matmul2->id == 1);
+    assert(moved.tensors[moved.links->tensor_id(X.get())] == X);
+    assert(moved.links->consumers(moved.links->tensor_id(X.get())).size() == 2);
+    assert(moved.links->producers[moved.links->tensor_id(O1.get())] ==
+           matmul1->id);
+    moved.run_propagation();
+    weakX = X;
+    weakO = O2;
+    weakOp = matmul2;
+    kept = matmul1;
+  }
+  // tensors and ops only point at each other through the graph, so nothing
+  // but the handles kept here outlives it
+  assert(weakO.expired() && weakOp.expired() && !weakX.expired());
+  assert(!kept->links && kept->id == GraphLinks::NONE);
+  std::cout << "test_graph_ownership() OK " << std::endl;
+}
+
 int main(int argc, char **argv) {
   test_propagation();
   test_addition();
@@ -799,7 +2194,30 @@ int main(int argc, char **argv) {
   test_get_sparsity_ratio();
   test_init_data();
   test_einsum_utils();
+  test_einsum_index_lists();
+  test_einsum_parser();
+  test_einsum_dataset();
+  test_graph_snapshot();
+  test_analysis_cache();
+  test_storage_layout();
+  test_coordinate_iterator();
+  test_parallel_fill();
+  test_random_sparse_tensor();
+  test_tensor_io();
+  test_data_sparsities();
   test_count_bits();
   test_scalar_computation();
   test_fill_tensor();
+  test_sparsity_vector();
+  test_bit_kernels();
+  test_compressed_sparsity_vector();
+  test_sparsity_arena();
+  test_fixed_point();
+  test_schedule();
+  test_parallel_propagation();
+  test_propagation_program();
+  test_propagation_batch();
+  test_incremental_propagation();
+  test_graph_edits();
+  test_graph_ownership();
 }
@@ -0,0 +1,63 @@
+#include "../include/thread_pool.hpp"
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t numThreads) {
+  if (numThreads == 0)
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t i = 1; i < numThreads; ++i)
+    workers.emplace_back([this] { worker_loop(); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &worker : workers)
+    worker.join();
+}
+
+void ThreadPool::parallel_for(size_t n,
+                              const std::function<void(size_t)> &body) {
+  if (workers.empty() || n <= 1) {
+    for (size_t i = 0; i < n; ++i)
+      body(i);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    task = &body;
+    taskSize = n;
+    next = 0;
+    active = workers.size();
+    ++generation;
+  }
+  wake.notify_all();
+  run_iterations();
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this] { return active == 0; });
+  task = nullptr;
+}
+
+void ThreadPool::run_iterations() {
+  for (size_t i = next++; i < taskSize; i = next++)
+    (*task)(i);
+}
+
+void ThreadPool::worker_loop() {
+  size_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping || generation != seen; });
+      if (stopping)
+        return;
+      seen = generation;
+    }
+    run_iterations();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--active == 0)
+      done.notify_one();
+  }
+}
@@ -1,78 +1,377 @@
 #include "../include/utils.hpp"
+#include "../include/bit_kernels.hpp"
+#include "../include/tensor.hpp"
+#include "../include/thread_pool.hpp"
 #include "taco/format.h"
+#include <climits>
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <sys/resource.h>
 
 unsigned int SEED = 123;
 
+uint64_t random_key(const std::string &stream) {
+  // FNV-1a over the stream name, started from the seed
+  uint64_t key = 0xcbf29ce484222325ULL ^ SEED;
+  for (unsigned char c : stream)
+    key = (key ^ c) * 0x100000001b3ULL;
+  return key;
+}
+
+void set_level_storage(taco::Tensor<float> &data, const std::vector<int> &sizes,
+                       const std::vector<std::vector<int>> &pos,
+                       const std::vector<std::vector<int>> &crd, float *values,
+                       size_t numValues) {
+  const taco::Format format = data.getFormat();
+  const auto modes = format.getModeFormats();
+  const auto ordering = format.getModeOrdering();
+  std::vector<taco::ModeIndex> levels;
+  for (size_t level = 0; level < modes.size(); ++level) {
+    if (modes[level] == taco::Dense)
+      levels.push_back(taco::ModeIndex(
+          {taco::makeArray(std::vector<int>{sizes[ordering[level]]})}));
+    else
+      levels.push_back(taco::ModeIndex(
+          {taco::makeArray(pos[level]), taco::makeArray(crd[level])}));
+  }
+  auto &storage = data.getStorage();
+  storage.setIndex(taco::Index(format, levels));
+  storage.setValues(taco::makeArray(values, numValues, taco::Array::Free));
+}
+
+namespace {
+/// A uniform double in (0, 1], safe to take the log of.
+double open_uniform(std::mt19937_64 &gen) {
+  return 1.0 - std::uniform_real_distribution<double>(0.0, 1.0)(gen);
+}
+
+/// Vitter's Method A: calls \p emit with \p n distinct indices drawn
+/// uniformly from [current, current + N), in increasing order. Linear
+/// in N; Method D hands over once n is a sizeable fraction of N.
+template <typename Emit>
+void sample_method_a(uint64_t n, uint64_t N, uint64_t current,
+                     std::mt19937_64 &gen, Emit &emit) {
+  double top = static_cast<double>(N - n);
+  double remaining = static_cast<double>(N);
+  uint64_t next = current;
+  for (; n >= 2; --n) {
+    const double v = open_uniform(gen);
+    uint64_t skip = 0;
+    double quot = top / remaining;
+    while (quot > v) {
+      ++skip;
+      --top;
+      --remaining;
+      quot = quot * top / remaining;
+    }
+    next += skip + 1;
+    emit(next - 1);
+    --remaining;
+  }
+  if (n == 1) {
+    const uint64_t last = static_cast<uint64_t>(remaining) - 1;
+    emit(next + std::min(static_cast<uint64_t>(remaining * open_uniform(gen)),
+                         last));
+  }
+}
+
+/// Vitter's Method D ("An efficient algorithm for sequential random
+/// sampling", 1987): calls \p emit with \p n distinct indices drawn uniformly
+/// from [0, N), in increasing order, in time linear in n.
+template <typename Emit>
+void sample_sorted(uint64_t n, uint64_t N, std::mt19937_64 &gen, Emit emit) {
+  if (n == 0)
+    return;
+  // below N / n = ALPHA_INVERSE, Method A is faster
+  const double ALPHA_INVERSE = 13.0;
+  uint64_t next = 0;
+  double nInv = 1.0 / n;
+  double vPrime = std::exp(std::log(open_uniform(gen)) * nInv);
+  uint64_t qu1 = N - n + 1;
+  while (n > 1 && ALPHA_INVERSE * n < N) {
+    const double nMin1Inv = 1.0 / (n - 1);
+    uint64_t skip;
+    while (true) {
+      double x;
+      // draw a candidate skip from the continuous approximation
+      while (true) {
+        x = N * (1.0 - vPrime);
+        skip = static_cast<uint64_t>(x);
+        if (skip < qu1)
+          break;
+        vPrime = std::exp(std::log(open_uniform(gen)) * nInv);
+      }
+      const double u = open_uniform(gen);
+      const double y1 =
+          std::exp(std::log(u * N / static_cast<double>(qu1)) * nMin1Inv);
+      vPrime = y1 * (1.0 - x / N) *
+               (static_cast<double>(qu1) / static_cast<double>(qu1 - skip));
+      if (vPrime <= 1.0)
+        break; // accepted by the cheap test
+      // the exact test
+      double y2 = 1.0;
+      double top = N - 1.0;
+      double bottom;
+      uint64_t limit;
+      if (n - 1 > skip) {
+        bottom = static_cast<double>(N - n);
+        limit = N - skip;
+      } else {
+        bottom = static_cast<double>(N - skip) - 1.0;
+        limit = qu1;
+      }
+      for (uint64_t t = N - 1; t >= limit; --t) {
+        y2 = y2 * top / bottom;
+        --top;
+        --bottom;
+      }
+      if (N / (N - x) >= y1 * std::exp(std::log(y2) * nMin1Inv)) {
+        vPrime = std::exp(std::log(open_uniform(gen)) * nMin1Inv);
+        break;
+      }
+      vPrime = std::exp(std::log(open_uniform(gen)) * nInv);
+    }
+    next += skip + 1;
+    emit(next - 1);
+    N -= skip + 1;
+    --n;
+    nInv = nMin1Inv;
+    qu1 -= skip;
+  }
+  if (n > 1) {
+    sample_method_a(n, N, next, gen, emit);
+  } else {
+    const uint64_t skip = std::min(static_cast<uint64_t>(N * vPrime), N - 1);
+    emit(next + skip);
+  }
+}
+} // namespace
+
+LevelArrayBuilder::LevelArrayBuilder(const std::vector<int> &sizes,
+                                     const taco::Format &format,
+                                     size_t nnzHint)
+    : sizes(sizes), modes(format.getModeFormats()),
+      ordering(format.getModeOrdering()), pos(sizes.size()),
+      crd(sizes.size()), coord(sizes.size(), -1), position(sizes.size(), 0) {
+  const size_t order = sizes.size();
+  for (size_t level = 0; level < order; ++level)
+    if (modes[level] != taco::Dense)
+      pos[level].push_back(0);
+  if (order > 0 && modes[order - 1] != taco::Dense) {
+    crd[order - 1].reserve(nnzHint);
+    values.reserve(nnzHint);
+  }
+}
+
+namespace {
+/// Throws if \p count positions or values do not fit TACO's int32 indices.
+void check_int_positions(uint64_t count, const char *what) {
+  if (count > static_cast<uint64_t>(INT_MAX))
+    throw std::runtime_error(std::string("more than INT_MAX ") + what +
+                             ": TACO indexes storage with int32");
+}
+} // namespace
+
+void LevelArrayBuilder::append(const int *next, float value) {
+  const size_t order = sizes.size();
+  // levels from the first changed coordinate on get new positions
+  size_t changed = 0;
+  while (!empty && changed < order &&
+         next[ordering[changed]] == coord[changed])
+    ++changed;
+  for (size_t level = changed; level < order; ++level) {
+    const int c = next[ordering[level]];
+    const uint64_t parent = level == 0 ? 0 : position[level - 1];
+    if (modes[level] == taco::Dense) {
+      position[level] = parent * sizes[ordering[level]] + c;
+    } else {
+      // parents without children end where the crd array ends so far
+      check_int_positions(crd[level].size() + 1, "coordinates in a level");
+      auto &levelPos = pos[level];
+      while (levelPos.size() <= parent)
+        levelPos.push_back(crd[level].size());
+      crd[level].push_back(c);
+      if (levelPos.size() == parent + 1)
+        levelPos.push_back(crd[level].size());
+      else
+        levelPos[parent + 1] = crd[level].size();
+      position[level] = crd[level].size() - 1;
+    }
+    coord[level] = c;
+  }
+  empty = false;
+  const uint64_t leaf = order == 0 ? 0 : position[order - 1];
+  check_int_positions(leaf + 1, "stored values");
+  if (values.size() <= leaf)
+    values.resize(leaf + 1, 0.0f);
+  values[leaf] += value;
+}
+
+void LevelArrayBuilder::finish(taco::Tensor<float> &data) {
+  // close the trailing parents and pad Dense levels to full blocks
+  uint64_t parents = 1;
+  for (size_t level = 0; level < sizes.size(); ++level) {
+    if (modes[level] == taco::Dense) {
+      parents *= sizes[ordering[level]];
+      check_int_positions(parents, "stored values");
+    } else {
+      while (pos[level].size() <= parents)
+        pos[level].push_back(crd[level].size());
+      parents = crd[level].size();
+    }
+  }
+  values.resize(parents, 0.0f);
+
+  // TACO takes the buffers over: nothing is copied
+  const taco::Format format = data.getFormat();
+  std::vector<taco::ModeIndex> levels;
+  for (size_t level = 0; level < sizes.size(); ++level) {
+    if (modes[level] == taco::Dense) {
+      levels.push_back(taco::ModeIndex(
+          {taco::makeArray(std::vector<int>{sizes[ordering[level]]})}));
+      continue;
+    }
+    const size_t numPos = pos[level].size(), numCrd = crd[level].size();
+    levels.push_back(taco::ModeIndex(
+        {taco::makeArray(pos[level].release(), numPos, taco::Array::Free),
+         taco::makeArray(crd[level].release(), numCrd, taco::Array::Free)}));
+  }
+  const size_t numValues = values.size();
+  auto &storage = data.getStorage();
+  storage.setIndex(taco::Index(format, levels));
+  storage.setValues(
+      taco::makeArray(values.release(), numValues, taco::Array::Free));
+  *this = LevelArrayBuilder(sizes, format);
+}
+
 taco::Tensor<float> create_random_sparse_tensor(const std::vector<int> &dims,
                                                 const double sparsity,
                                                 const taco::Format &format) {
-  int order = dims.size();
+  const int order = dims.size();
   taco::Tensor<float> T(dims, format);
+  const auto ordering = format.getModeOrdering();
 
-  long long total = 1;
+  // elements are numbered in storage order, so the sampled indices arrive
+  // sorted level by level
+  uint64_t total = 1;
   for (int d : dims)
     total *= d;
+  const uint64_t nnzTarget = static_cast<uint64_t>((1.0 - sparsity) * total);
+  check_int_positions(nnzTarget, "nonzeros");
 
-  long long nnz_target = (long long)((1.0 - sparsity) * total);
-
-  std::mt19937 gen(42);
-  std::uniform_int_distribution<int> dist_dim(0, 1e9);
+  std::mt19937_64 gen(42);
   std::uniform_real_distribution<float> dist_val(1.0, 10.0);
 
-  std::unordered_set<long long> used;
-  used.reserve(nnz_target * 2);
+  LevelArrayBuilder builder(dims, format, nnzTarget);
+  std::vector<int> coord(order);
+  sample_sorted(nnzTarget, total, gen, [&](uint64_t linear) {
+    for (int level = order - 1; level >= 0; --level) {
+      const int dim = ordering[level];
+      coord[dim] = static_cast<int>(linear % dims[dim]);
+      linear /= dims[dim];
+    }
+    builder.append(coord.data(), dist_val(gen));
+  });
+  builder.finish(T);
+  return T;
+}
 
-  auto coord_to_key = [&](const std::vector<int> &idx) {
-    long long key = 0;
-    for (int i = 0; i < order; i++)
-      key = key * 1000003 + idx[i];
-    return key;
+namespace {
+/// Below this many elements a mask is evaluated on the calling thread.
+const size_t PARALLEL_MASK_MIN_ELEMENTS = size_t{1} << 16;
+
+/// The layout in \p format of a \p rows x \p cols matrix holding the
+/// elements whose row-major linear coordinate passes \p keep, the structure
+/// inserting those elements and packing would produce. The mask is evaluated
+/// in parallel over the outer storage level, twice: once to count the
+/// elements of each outer coordinate and once to write them.
+StorageLayout matrix_mask_layout(const taco::Format &format, int rows,
+                                 int cols,
+                                 const std::function<bool(uint64_t)> &keep) {
+  const auto modes = format.getModeFormats();
+  const auto ordering = format.getModeOrdering();
+  assert(modes.size() == 2 && "the mask fills only support matrices");
+  const bool rowMajor = ordering[0] == 0;
+  const int outer = rowMajor ? rows : cols;
+  const int inner = rowMajor ? cols : rows;
+  auto linear = [&](int o, int i) {
+    return rowMajor ? static_cast<uint64_t>(o) * cols + i
+                    : static_cast<uint64_t>(i) * cols + o;
+  };
+  ThreadPool pool(static_cast<uint64_t>(rows) * cols <
+                          PARALLEL_MASK_MIN_ELEMENTS
+                      ? 1
+                      : 0);
+  auto for_chunks = [&](size_t n, const std::function<void(size_t)> &body) {
+    const size_t chunks = std::min(n, pool.size() * 8);
+    pool.parallel_for(chunks, [&](size_t chunk) {
+      for (size_t k = n * chunk / chunks; k < n * (chunk + 1) / chunks; ++k)
+        body(k);
+    });
   };
 
-  while ((long long)used.size() < nnz_target) {
-    std::vector<int> idx(order);
-    for (int i = 0; i < order; i++)
-      idx[i] = dist_dim(gen) % dims[i];
-
-    long long key = coord_to_key(idx);
-    if (used.insert(key).second)
-      T.insert(idx, dist_val(gen));
+  std::vector<size_t> kept(outer, 0);
+  for_chunks(outer, [&](size_t o) {
+    for (int i = 0; i < inner; ++i)
+      kept[o] += keep(linear(o, i));
+  });
+
+  StorageLayout layout;
+  layout.pos.resize(2);
+  layout.crd.resize(2);
+  // the outer coordinates stored: all of them, or those keeping an element
+  std::vector<int> stored;
+  for (int o = 0; o < outer; ++o)
+    if (modes[0] == taco::Dense || kept[o] > 0)
+      stored.push_back(o);
+  if (modes[0] == taco::Sparse) {
+    layout.pos[0] = {0, static_cast<int>(stored.size())};
+    layout.crd[0] = stored;
   }
-
-  T.pack();
-
-  return T;
+  // first[k]: the first inner position of the k-th stored outer coordinate
+  std::vector<size_t> first(stored.size() + 1, 0);
+  for (size_t k = 0; k < stored.size(); ++k)
+    first[k + 1] =
+        first[k] + (modes[1] == taco::Dense ? size_t(inner) : kept[stored[k]]);
+  if (modes[1] == taco::Sparse) {
+    layout.pos[1].assign(first.begin(), first.end());
+    layout.crd[1].resize(first.back());
+  }
+  layout.nonzero.assign(first.back(), 1);
+  for_chunks(stored.size(), [&](size_t k) {
+    size_t position = first[k];
+    for (int i = 0; i < inner; ++i) {
+      const bool nonzero = keep(linear(stored[k], i));
+      if (modes[1] == taco::Dense)
+        layout.nonzero[position++] = nonzero;
+      else if (nonzero)
+        layout.crd[1][position++] = i;
+    }
+  });
+  return layout;
 }
+} // namespace
 
 void fill_tensor(taco::Tensor<float> &tensor, double sparsityRatio, int rows,
                  int cols) {
-  std::mt19937 gen(SEED);
-  std::uniform_real_distribution<> dist(0.0, 1.0);
-
-  for (int i = 0; i < rows; ++i) {
-    for (int j = 0; j < cols; ++j) {
-      if (dist(gen) < sparsityRatio) {
-        continue;
-      }
-
-      float val = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-      tensor.insert({i, j}, val);
-    }
-  }
-  tensor.pack();
+  const uint64_t maskKey = random_key(tensor.getName() + "/mask");
+  const StorageLayout layout =
+      matrix_mask_layout(tensor.getFormat(), rows, cols, [&](uint64_t linear) {
+        return counter_uniform(maskKey, linear) > sparsityRatio;
+      });
+  fill_layout(tensor, {rows, cols}, layout, random_key(tensor.getName()));
 }
+
 // should be used for creating non-adlet tensors for comparison
 void fill_tensor(taco::Tensor<float> &tensor, double rowSparsityRatio,
                  double colSparsityRatio, int rows, int cols) {
   int zeroRowCount = static_cast<int>(rows * rowSparsityRatio);
   int zeroColCount = static_cast<int>(cols * colSparsityRatio);
 
-  SparsityVector rowSparsity;
-  SparsityVector colSparsity;
-  rowSparsity.set();
-  colSparsity.set();
+  SparsityVector rowSparsity(rows, true);
+  SparsityVector colSparsity(cols, true);
 
   std::vector<int> rowIndices(rows), colIndices(cols);
   std::iota(rowIndices.begin(), rowIndices.end(), 0);
@@ -87,19 +386,12 @@ void fill_tensor(taco::Tensor<float> &tensor, double rowSparsityRatio,
   for (int j = 0; j < zeroColCount; ++j)
     colSparsity.set(colIndices[j], 0);
 
-  for (int i = 0; i < rows; ++i) {
-    if (!rowSparsity.test(i))
-      continue; // skip zeroed row
-    for (int j = 0; j < cols; ++j) {
-      if (!colSparsity.test(j))
-        continue; // skip zeroed col
-
-      float val = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-      tensor.insert({i, j}, val);
-    }
-  }
-
-  tensor.pack();
+  // the nonzeros are the product of the vectors: the layout of a Tensor
+  // holding them
+  const Tensor mask({rows, cols}, {rowSparsity, colSparsity},
+                    tensor.getName());
+  fill_layout(tensor, {rows, cols}, mask.storage_layout(tensor.getFormat()),
+              random_key(tensor.getName()));
 }
 
 taco::Format get_format(const std::string format) {
@@ -112,12 +404,24 @@ taco::Format get_format(const std::string format) {
   return modes;
 }
 
-size_t count_bits(SparsityVector A, int pos) {
-  assert(pos > 0 && pos <= MAX_SIZE && "pos out of bounds");
-  size_t bits = 0;
-  for (size_t i = 0; i < pos; i++)
-    if (A.test(i))
-      bits++;
+size_t count_bits(const SparsityVector &A, int pos) {
+  assert(pos > 0 && pos <= A.size() && "pos out of bounds");
+  if (A.is_compressed()) {
+    size_t bits = 0;
+    for (const SparsityVector::Run &r : A.runs()) {
+      if (r.begin >= pos)
+        break;
+      bits += std::min<size_t>(r.end, pos) - r.begin;
+    }
+    return bits;
+  }
+  const SparsityVector::Word *words = A.data();
+  size_t fullWords = pos / SparsityVector::WORD_BITS;
+  size_t bits = bit_kernels().popcount_words(words, fullWords);
+  size_t rest = pos % SparsityVector::WORD_BITS;
+  if (rest != 0)
+    bits += __builtin_popcountll(words[fullWords] &
+                                 ((SparsityVector::Word{1} << rest) - 1));
   return bits;
 }
 
@@ -133,8 +437,7 @@ std::vector<int> get_indices(std::vector<int> dimSizes, int numElement) {
 }
 
 SparsityVector generate_sparsity_vector(double sparsity, int length) {
-  SparsityVector sparsityVector;
-  sparsityVector.set();
+  SparsityVector sparsityVector(length, true);
 
   int numZeros = static_cast<int>(length * sparsity);
 
@@ -143,6 +446,7 @@ SparsityVector generate_sparsity_vector(double sparsity, int length) {
   std::shuffle(indices.begin(), indices.end(), std::mt19937{SEED});
   for (int i = 0; i < numZeros; ++i)
     sparsityVector.set(indices[i], 0);
+  sparsityVector.optimize();
 
   return sparsityVector;
 }
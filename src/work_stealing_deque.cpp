@@ -0,0 +1,56 @@
+#include "../include/work_stealing_deque.hpp"
+#include <cassert>
+
+namespace {
+size_t round_up_pow2(size_t n) {
+  size_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+} // namespace
+
+WorkStealingDeque::WorkStealingDeque(size_t capacity)
+    : buffer(round_up_pow2(capacity == 0 ? 1 : capacity)),
+      mask(buffer.size() - 1) {}
+
+void WorkStealingDeque::push(size_t item) {
+  int64_t b = bottom.load(std::memory_order_relaxed);
+  assert(b - top.load(std::memory_order_acquire) <
+             static_cast<int64_t>(buffer.size()) &&
+         "work-stealing deque is full");
+  buffer[b & mask].store(item, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+bool WorkStealingDeque::pop(size_t &item) {
+  int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+  bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = top.load(std::memory_order_relaxed);
+  if (t > b) {
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return false;
+  }
+  item = buffer[b & mask].load(std::memory_order_relaxed);
+  if (t == b) {
+    // last item: race against thieves for it
+    bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                           std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return won;
+  }
+  return true;
+}
+
+bool WorkStealingDeque::steal(size_t &item) {
+  int64_t t = top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t b = bottom.load(std::memory_order_acquire);
+  if (t >= b)
+    return false;
+  item = buffer[t & mask].load(std::memory_order_relaxed);
+  return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed);
+}